@@ -99,6 +99,7 @@ int Test::fail(const Source& where, const char *message, ...)
 #if _POSIX_TIMERS > 0
 
 #include <sys/time.h>
+#include <time.h>
 
 namespace Test {
    unsigned long microTime()
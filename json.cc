@@ -16,16 +16,49 @@
 #endif
 
 #include <ctype.h>
+#include <float.h>
+#include <limits.h>
+#include <new>
 #include <stdexcept>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if __cplusplus >= 201103L && !defined(JSON_NO_THREADS)
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <atomic>
+#define JSON_HAVE_THREADS 1
+#endif
+#include <vector>
+
+#include <errno.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define JSON_HAVE_MMAP 1
+#endif
+
+#if !defined(JSON_NO_SIMD) && defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_AVX2 1
+#elif !defined(JSON_NO_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#define SIMD_SSE2 1
+#endif
+
 using namespace Json;
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-static const size_t BLOCK_SIZE = 1024;
+static const size_t BLOCK_SIZE = 1024;            // size of the first chunk
+static const size_t MAX_BLOCK_SIZE = 64 << 20;    // chunk sizes double up to this limit
 static const unsigned ALIGNMENT  = 8;
 #define ROUND_UP(n) (((n) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT)
 
@@ -54,6 +87,31 @@ static unsigned int parseHex4(char *c)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
+/// Converts «mantissa» * 10^«exponent» to the nearest double. Uses Clinger's fast path when both
+/// factors are exactly representable (so a single IEEE multiplication or division rounds
+/// correctly) and falls back to strtod() on «text» otherwise.
+double Parser::decodeDouble(const char *text, uint64_t mantissa, int exponent, unsigned flags)
+{
+#if FLT_EVAL_METHOD == 0
+   static const double POW10[] = {
+      1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+   };
+   if (mantissa <= ((uint64_t) 1 << 53) && exponent >= -22 && exponent <= 22) {
+      double d = (double) mantissa;
+      d = (exponent < 0) ? d / POW10[-exponent] : d * POW10[exponent];
+      return (flags & Value::NUMBER_NEGATIVE) ? -d : d;
+   }
+#else
+   (void) mantissa;
+   (void) exponent;
+   (void) flags;
+#endif
+   return strtod(text, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
 typedef struct {
    Value* obj;
    void *tail;  // where to append the next child
@@ -61,520 +119,4681 @@ typedef struct {
 
 static inline void appendValue(StackEntry *tos, Value *child)
 {
-   child->next_ = 0;
-   *((Value**)tos->tail) = child;
-   tos->tail = &child->next_;
+   child->next_ = 0;
+   *((Value**)tos->tail) = child;
+   tos->tail = &child->next_;
+   ++tos->obj->length_;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Returns the first '"', '\\' or control character (including the terminating NUL) at or after
+/// «s». Whole blocks are only read below «limit», the rest byte by byte.
+static inline char *findStringSpecial(char *s, const char *limit)
+{
+#if SIMD_AVX2
+   const __m256i quote = _mm256_set1_epi8('"');
+   const __m256i backslash = _mm256_set1_epi8('\\');
+   const __m256i control = _mm256_set1_epi8(0x1F);
+#define SPECIAL(v) (uint32_t) _mm256_movemask_epi8(_mm256_or_si256( \
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)), \
+      _mm256_cmpeq_epi8(_mm256_min_epu8(v, control), v)))
+   for (; limit - s >= 32; s += 32) {
+      const __m256i v = _mm256_loadu_si256((const __m256i *) s);
+      const uint32_t mask = SPECIAL(v);
+      if (mask != 0) {
+         return s + __builtin_ctz(mask);
+      }
+   }
+#undef SPECIAL
+#elif SIMD_SSE2
+   const __m128i quote = _mm_set1_epi8('"');
+   const __m128i backslash = _mm_set1_epi8('\\');
+   const __m128i control = _mm_set1_epi8(0x1F);
+#define SPECIAL(v) (uint32_t) _mm_movemask_epi8(_mm_or_si128( \
+      _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)), \
+      _mm_cmpeq_epi8(_mm_min_epu8(v, control), v)))
+   for (; limit - s >= 16; s += 16) {
+      const __m128i v = _mm_loadu_si128((const __m128i *) s);
+      const uint32_t mask = SPECIAL(v);
+      if (mask != 0) {
+         return s + __builtin_ctz(mask);
+      }
+   }
+#undef SPECIAL
+#else
+   (void) limit;
+#endif
+   while (*s != '"' && *s != '\\' && (unsigned char) *s >= 0x20) {
+      ++s;
+   }
+   return s;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Scanners. The parser asks a scanner to skip white space and, optionally, to locate the end of
+// a string. ByteScanner does this byte by byte, IndexScanner uses a structural index built in
+// a separate, vectorized pass. Both read whole blocks only before the end of the source; if it is
+// not given, they locate the terminating NUL first.
+
+struct ByteScanner {
+   const char *const limit_;
+
+   ByteScanner(const char *source, const char *end)
+      : limit_(end ? end : source + strlen(source))
+   {
+   }
+
+   char *skipSpace(char *s)
+   {
+      while (IS_SPACE(*s)) {
+         ++s;
+      }
+      return s;
+   }
+
+   /// Returns the closing quote if the string at «s» contains no escapes or control characters.
+   /// Returns null if unknown.
+   char *stringEnd(char *)
+   {
+      return 0;
+   }
+
+   char *stringSpecial(char *s)
+   {
+      return findStringSpecial(s, limit_);
+   }
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Bit masks for a 64 byte block of source text. Bit i corresponds to byte i.
+struct BlockMasks {
+   uint64_t quote;
+   uint64_t backslash;
+   uint64_t space;
+   uint64_t structural;    // {}[]:,
+   uint64_t open;          // {[
+   uint64_t close;         // }]
+   uint64_t slash;
+   uint64_t control;       // < 0x20, including NUL
+};
+
+#if SIMD_AVX2
+
+static inline uint64_t bits(__m256i lo, __m256i hi)
+{
+   return (uint64_t)(uint32_t) _mm256_movemask_epi8(lo)
+      | ((uint64_t)(uint32_t) _mm256_movemask_epi8(hi) << 32);
+}
+
+static inline void classify(const char *p, BlockMasks &m)
+{
+   const __m256i a = _mm256_load_si256((const __m256i *) p);
+   const __m256i b = _mm256_load_si256((const __m256i *) (p + 32));
+#define EQ(v, c) _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c))
+#define EQ_LC(v, c) _mm256_cmpeq_epi8(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), _mm256_set1_epi8(c))
+#define STRUCTURAL(v) _mm256_or_si256(_mm256_or_si256(EQ_LC(v, '{'), EQ_LC(v, '}')), \
+                                      _mm256_or_si256(EQ(v, ':'), EQ(v, ',')))
+#define SPACE(v) _mm256_or_si256(_mm256_or_si256(EQ(v, ' '), EQ(v, '\t')), \
+                                 _mm256_or_si256(EQ(v, '\n'), EQ(v, '\r')))
+#define CONTROL(v) _mm256_cmpeq_epi8(_mm256_min_epu8(v, _mm256_set1_epi8(0x1F)), v)
+   m.quote = bits(EQ(a, '"'), EQ(b, '"'));
+   m.backslash = bits(EQ(a, '\\'), EQ(b, '\\'));
+   m.space = bits(SPACE(a), SPACE(b));
+   m.structural = bits(STRUCTURAL(a), STRUCTURAL(b));
+   m.open = bits(EQ_LC(a, '{'), EQ_LC(b, '{'));
+   m.close = bits(EQ_LC(a, '}'), EQ_LC(b, '}'));
+   m.slash = bits(EQ(a, '/'), EQ(b, '/'));
+   m.control = bits(CONTROL(a), CONTROL(b));
+#undef EQ
+#undef EQ_LC
+#undef STRUCTURAL
+#undef SPACE
+#undef CONTROL
+}
+
+#elif SIMD_SSE2
+
+static inline uint64_t bits(__m128i a, __m128i b, __m128i c, __m128i d)
+{
+   return (uint64_t)(uint16_t) _mm_movemask_epi8(a)
+      | ((uint64_t)(uint16_t) _mm_movemask_epi8(b) << 16)
+      | ((uint64_t)(uint16_t) _mm_movemask_epi8(c) << 32)
+      | ((uint64_t)(uint16_t) _mm_movemask_epi8(d) << 48);
+}
+
+static inline void classify(const char *p, BlockMasks &m)
+{
+   const __m128i a = _mm_load_si128((const __m128i *) p);
+   const __m128i b = _mm_load_si128((const __m128i *) (p + 16));
+   const __m128i c = _mm_load_si128((const __m128i *) (p + 32));
+   const __m128i d = _mm_load_si128((const __m128i *) (p + 48));
+#define EQ(v, ch) _mm_cmpeq_epi8(v, _mm_set1_epi8(ch))
+#define EQ_LC(v, ch) _mm_cmpeq_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)), _mm_set1_epi8(ch))
+#define STRUCTURAL(v) _mm_or_si128(_mm_or_si128(EQ_LC(v, '{'), EQ_LC(v, '}')), \
+                                   _mm_or_si128(EQ(v, ':'), EQ(v, ',')))
+#define SPACE(v) _mm_or_si128(_mm_or_si128(EQ(v, ' '), EQ(v, '\t')), \
+                              _mm_or_si128(EQ(v, '\n'), EQ(v, '\r')))
+#define CONTROL(v) _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x1F)), v)
+#define ALL(f) bits(f(a), f(b), f(c), f(d))
+#define QUOTE(v) EQ(v, '"')
+#define BACKSLASH(v) EQ(v, '\\')
+#define SLASH(v) EQ(v, '/')
+#define OPEN(v) EQ_LC(v, '{')
+#define CLOSE(v) EQ_LC(v, '}')
+   m.quote = ALL(QUOTE);
+   m.backslash = ALL(BACKSLASH);
+   m.space = ALL(SPACE);
+   m.structural = ALL(STRUCTURAL);
+   m.open = ALL(OPEN);
+   m.close = ALL(CLOSE);
+   m.slash = ALL(SLASH);
+   m.control = ALL(CONTROL);
+#undef EQ
+#undef EQ_LC
+#undef STRUCTURAL
+#undef SPACE
+#undef CONTROL
+#undef ALL
+#undef QUOTE
+#undef BACKSLASH
+#undef SLASH
+#undef OPEN
+#undef CLOSE
+}
+
+#else
+
+static inline void classify(const char *p, BlockMasks &m)
+{
+   memset(&m, 0, sizeof(m));
+   for (int i = 0; i < 64; ++i) {
+      const uint64_t bit = (uint64_t) 1 << i;
+      const unsigned char c = p[i];
+      if (c == '"') m.quote |= bit;
+      else if (c == '\\') m.backslash |= bit;
+      else if (c == '/') m.slash |= bit;
+      else if (c == '{' || c == '}' || c == '[' || c == ']' || c == ':' || c == ',') m.structural |= bit;
+      if (c == '{' || c == '[') m.open |= bit;
+      if (c == '}' || c == ']') m.close |= bit;
+      if (IS_SPACE(c)) m.space |= bit;
+      if (c < 0x20) m.control |= bit;
+   }
+}
+
+#endif
+
+/// Like classify() for a block that may start before «begin» and extend past «end». Such a block
+/// is copied first; only the bytes in between are read, the others count as NUL.
+static inline void classifyRange(const char *p, const char *begin, const char *end,
+                                 BlockMasks &m)
+{
+   if (p < begin || end - p < 64) {
+      char block[64] __attribute__((aligned(64)));
+      memset(block, 0, sizeof(block));
+      const char *from = p < begin ? begin : p;
+      const char *to = end - p < 64 ? end : p + 64;
+      if (from < to) {
+         memcpy(block + (from - p), from, to - from);
+      }
+      classify(block, m);
+      return;
+   }
+   classify(p, m);
+}
+
+/// Returns the characters escaped by a backslash. «prevEscaped» carries the state from one
+/// block to the next (1 if the first character of the next block is escaped).
+static inline uint64_t findEscaped(uint64_t backslash, uint64_t &prevEscaped)
+{
+   static const uint64_t EVEN_BITS = 0x5555555555555555ULL;
+   backslash &= ~prevEscaped;
+   const uint64_t followsEscape = backslash << 1 | prevEscaped;
+   const uint64_t oddStarts = backslash & ~EVEN_BITS & ~followsEscape;
+   uint64_t evenStarts;
+   prevEscaped = __builtin_add_overflow(oddStarts, backslash, &evenStarts);
+   return (EVEN_BITS ^ (evenStarts << 1)) & followsEscape;
+}
+
+/// Bit i of the result is the xor of bits 0..i of «x».
+static inline uint64_t prefixXor(uint64_t x)
+{
+   x ^= x << 1;
+   x ^= x << 2;
+   x ^= x << 4;
+   x ^= x << 8;
+   x ^= x << 16;
+   x ^= x << 32;
+   return x;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// States of the byte by byte scanners for strings and comments.
+#define LEX_STRING 1
+#define LEX_ESCAPE 2            // after '\\' in a string
+#define LEX_SLASH 3             // after '/', possibly starting a comment
+#define LEX_LINE_COMMENT 4
+#define LEX_BLOCK_COMMENT 5
+#define LEX_STAR 6              // after '*' in a block comment
+#define LEX_BACKSLASH 7         // after '\\' outside of strings. Invalid, but the next '"' or '\\'
+                                // is skipped like findEscaped() does in the block scanners.
+
+/// Scans «s» to «end» starting in «state» (see LEX_xxx) with «depth» open brackets. Returns the
+/// position after the bracket that closes the last one, or null if there is none before «end».
+static char *skipBytes(char *s, const char *end, unsigned &state, int &depth)
+{
+   for (; s < end; ++s) {
+      const char c = *s;
+      switch (state) {
+         case LEX_STRING:
+            state = (c == '"') ? 0 : (c == '\\') ? LEX_ESCAPE : LEX_STRING;
+            break;
+         case LEX_ESCAPE:
+            state = LEX_STRING;
+            break;
+         case LEX_LINE_COMMENT:
+            state = (c == '\n') ? 0 : LEX_LINE_COMMENT;
+            break;
+         case LEX_BLOCK_COMMENT:
+            state = (c == '*') ? LEX_STAR : LEX_BLOCK_COMMENT;
+            break;
+         case LEX_STAR:
+            state = (c == '/') ? 0 : (c == '*') ? LEX_STAR : LEX_BLOCK_COMMENT;
+            break;
+         default:
+            if (state == LEX_SLASH && (c == '/' || c == '*')) {
+               state = (c == '/') ? LEX_LINE_COMMENT : LEX_BLOCK_COMMENT;
+               break;
+            }
+            if (state == LEX_BACKSLASH && (c == '"' || c == '\\')) {
+               state = 0;
+               break;
+            }
+            state = 0;
+            if (c == '"') {
+               state = LEX_STRING;
+            } else if (c == '/') {
+               state = LEX_SLASH;
+            } else if (c == '\\') {
+               state = LEX_BACKSLASH;
+            } else if (c == '{' || c == '[') {
+               ++depth;
+            } else if ((c == '}' || c == ']') && --depth == 0) {
+               return s + 1;
+            }
+      }
+   }
+   return 0;
+}
+
+/// Like skipBytes(), starting with one open bracket, but classifies whole 64 byte blocks at once.
+/// Blocks that cannot contain the closing bracket cost a few instructions.
+static char *skipContainer(char *s, const char *end)
+{
+   unsigned state = 0;
+   int depth = 1;
+   char *p = (char *) (((uintptr_t) s + 63) & ~(uintptr_t) 63);
+   if (p >= end) {
+      return skipBytes(s, end, state, depth);
+   }
+   char *close = skipBytes(s, p, state, depth);
+   for (; close == 0 && end - p >= 64; p += 64) {
+      if (state == 0 || state == LEX_BACKSLASH || state == LEX_STRING || state == LEX_ESCAPE) {
+         BlockMasks m;
+         classify(p, m);
+         const bool inString = (state == LEX_STRING || state == LEX_ESCAPE);
+         uint64_t escaped = (state == LEX_ESCAPE || state == LEX_BACKSLASH);
+         const uint64_t quote = m.quote & ~findEscaped(m.backslash, escaped);
+         const uint64_t inside = prefixXor(quote) ^ (inString ? ~(uint64_t) 0 : 0);
+         if ((m.slash & ~inside) == 0) {
+            const uint64_t open = m.open & ~inside;
+            uint64_t brackets = (m.open | m.close) & ~inside;
+            if (__builtin_popcountll(brackets & ~open) < depth) {
+               depth += 2 * __builtin_popcountll(open) - __builtin_popcountll(brackets);
+            } else {
+               for (; brackets != 0; brackets &= brackets - 1) {
+                  const uint64_t bit = brackets & -brackets;
+                  if (open & bit) {
+                     ++depth;
+                  } else if (--depth == 0) {
+                     return p + __builtin_ctzll(bit) + 1;
+                  }
+               }
+            }
+            state = (inside >> 63) != 0 ? (escaped ? LEX_ESCAPE : LEX_STRING)
+                                        : (escaped ? LEX_BACKSLASH : 0);
+            continue;
+         }
+      }
+      close = skipBytes(p, p + 64, state, depth);
+   }
+   return close != 0 ? close : skipBytes(p, end, state, depth);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Scanner driven by a structural index. The index is built one window at a time, ahead of
+/// the parser, and contains the offsets of all structural characters, quotes and values
+/// following white space. The parser uses it to jump over white space and to find the end of
+/// strings without escapes in O(1).
+///
+/// Blocks are read 64-byte aligned, those at the start and the end of the source are copied
+/// first. Indexing stops at the first NUL or at the end. Comments are not indexed; when a '/' is
+/// found outside strings, the scanner falls back to byte by byte scanning for the rest of the
+/// document.
+class Json::IndexScanner {
+public:
+   static const size_t WINDOW = 16384;       // bytes indexed per refill, multiple of 64
+
+private:
+   static const uint32_t OPEN_QUOTE = 0x40000000;
+   static const uint32_t DIRTY = 0x80000000;        // string contains escapes or control chars
+   static const uint32_t OFFSET_MASK = 0x3FFFFFFF;
+
+   const char * const base_;
+   const char * const limit_;    // end of the source
+   const char *window_;          // start of current window, 64-byte aligned
+   const char *windowEnd_;
+   uint32_t *entries_;           // offsets relative to window_, plus flags
+   uint32_t *next_;
+   uint32_t *end_;
+   bool done_;                   // NUL or comment seen, no more windows
+
+   uint64_t prevEscaped_;
+   uint64_t prevInString_;
+   uint64_t prevSpace_;
+   uint32_t dirty_;
+
+   IndexScanner(const IndexScanner &);     // not implemented
+   void operator=(const IndexScanner &);   // not implemented
+
+   bool refill();
+
+   /// Advances to the first entry at or after «s». Returns false if there is none.
+   bool sync(const char *s)
+   {
+      while (true) {
+         while (next_ < end_) {
+            if (window_ + (*next_ & OFFSET_MASK) >= s) {
+               return true;
+            }
+            ++next_;
+         }
+         if (!refill()) {
+            return false;
+         }
+      }
+   }
+
+public:
+   IndexScanner(const char *source, const char *end);
+   ~IndexScanner();
+
+   char *skipSpace(char *s)
+   {
+      if (!IS_SPACE(*s)) {
+         return s;
+      }
+      if (sync(s)) {
+         return (char *) window_ + (*next_ & OFFSET_MASK);
+      }
+      while (IS_SPACE(*s)) {
+         ++s;
+      }
+      return s;
+   }
+
+   char *stringEnd(char *s)
+   {
+      if (!sync(s) || window_ + (*next_ & OFFSET_MASK) != s || next_ + 1 >= end_) {
+         return 0;
+      }
+      if (!(*next_ & OPEN_QUOTE) || (next_[1] & (DIRTY | OPEN_QUOTE))) {
+         return 0;
+      }
+      char *const e = (char *) window_ + next_[1];
+      next_ += 2;
+      return e;
+   }
+
+   char *stringSpecial(char *s)
+   {
+      return findStringSpecial(s, limit_);
+   }
+};
+
+IndexScanner::IndexScanner(const char *source, const char *end)
+   : base_(source),
+     limit_(end ? end : source + strlen(source)),
+     window_((const char *) ((uintptr_t) source & ~(uintptr_t) 63)),
+     windowEnd_(window_),
+     entries_((uint32_t *) ::malloc((WINDOW + 1) * sizeof(uint32_t))),
+     next_(0), end_(0), done_(false),
+     prevEscaped_(0), prevInString_(0), prevSpace_(1), dirty_(0)
+{
+   if (entries_ == 0) {
+      throw std::runtime_error("OOM");
+   }
+   next_ = end_ = entries_;
+}
+
+IndexScanner::~IndexScanner()
+{
+   ::free(entries_);
+}
+
+bool IndexScanner::refill()
+{
+   if (done_) {
+      return false;
+   }
+   window_ = windowEnd_;
+   windowEnd_ = window_ + WINDOW;
+   uint32_t *out = entries_;
+
+   for (const char *p = window_; p < windowEnd_ && !done_; p += 64) {
+      BlockMasks m;
+      classifyRange(p, base_, limit_, m);
+      if (p < base_) {
+         // First block: ignore everything before the source.
+         const uint64_t before = ((uint64_t) 1 << (base_ - p)) - 1;
+         m.quote &= ~before;
+         m.backslash &= ~before;
+         m.structural &= ~before;
+         m.slash &= ~before;
+         m.control &= ~before;
+         m.space |= before;
+      }
+      if (m.control) {
+         // Cut off at the terminating NUL or the end.
+         for (uint64_t c = m.control; c; c &= c - 1) {
+            const int i = __builtin_ctzll(c);
+            if (p + i >= limit_ || p[i] == 0) {
+               const uint64_t after = ~(((uint64_t) 2 << i) - 1);
+               m.quote &= ~after;
+               m.backslash &= ~after;
+               m.structural &= ~after;
+               m.slash &= ~after;
+               m.control &= ~after;
+               m.space &= ~after;
+               done_ = true;
+               break;
+            }
+         }
+      }
+
+      const uint64_t quote = m.quote & ~findEscaped(m.backslash, prevEscaped_);
+      const uint64_t inside = prefixXor(quote) ^ prevInString_;    // includes the opening quote
+      prevInString_ = (uint64_t) ((int64_t) inside >> 63);
+      if (m.slash & ~inside) {
+         // Comments are not indexed. Keep the entries before the block, give up afterwards.
+         done_ = true;
+         break;
+      }
+      const uint64_t scalar = ~(m.space | m.structural | quote | inside);
+      const uint64_t afterSpace = (m.space << 1) | prevSpace_;
+      prevSpace_ = m.space >> 63;
+      const uint64_t special = (m.backslash | m.control) & inside & ~quote;
+      uint64_t entries = (m.structural & ~inside) | quote | (scalar & afterSpace);
+      const uint32_t offset = p - window_;
+
+      if (special == 0 && dirty_ == 0) {
+         for (; entries; entries &= entries - 1) {
+            const uint64_t bit = entries & (0 - entries);
+            *out++ = (offset + __builtin_ctzll(entries)) | ((quote & inside & bit) ? OPEN_QUOTE : 0);
+         }
+      } else {
+         for (uint64_t all = entries | special; all; all &= all - 1) {
+            const uint64_t bit = all & (0 - all);
+            const uint32_t pos = offset + __builtin_ctzll(all);
+            if (special & bit) {
+               dirty_ = DIRTY;
+            } else if (quote & inside & bit) {
+               dirty_ = 0;
+               *out++ = pos | OPEN_QUOTE;
+            } else if (quote & bit) {
+               *out++ = pos | dirty_;
+               dirty_ = 0;
+            } else {
+               *out++ = pos;
+            }
+         }
+      }
+   }
+
+   next_ = entries_;
+   end_ = out;
+   return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+#if JSON_HAVE_THREADS
+
+/// Finds up to «n» split points for PARALLEL: commas outside strings at nesting level 1, about
+/// evenly spaced between «source» and «end». Returns the number of split points, 0 if the root
+/// is not a container or the document contains comments. Syntax errors are left to the parser,
+/// which detects them before reaching a split point.
+static int findSplits(const char *source, const char *end, const char **splits, int n)
+{
+   while (source < end && IS_SPACE(*source)) {
+      ++source;
+   }
+   if (source == end || (*source != '[' && *source != '{')) {
+      return 0;
+   }
+   const size_t step = (end - source) / (n + 1);
+   const char *target = source + step;
+   int found = 0;
+   int depth = 0;
+   uint64_t prevEscaped = 0;
+   uint64_t prevInString = 0;
+
+   for (const char *p = (const char *) ((uintptr_t) source & ~(uintptr_t) 63); p < end; p += 64) {
+      BlockMasks m;
+      classifyRange(p, source, end, m);
+      uint64_t valid = ~(uint64_t) 0;
+      if (p < source) {
+         valid &= ~(((uint64_t) 1 << (source - p)) - 1);
+      }
+      if (end - p < 64) {
+         valid &= ((uint64_t) 1 << (end - p)) - 1;
+      }
+      const uint64_t quote = m.quote & valid & ~findEscaped(m.backslash & valid, prevEscaped);
+      const uint64_t inside = prefixXor(quote) ^ prevInString;
+      prevInString = (uint64_t) ((int64_t) inside >> 63);
+      if (m.slash & valid & ~inside) {
+         return 0;
+      }
+      for (uint64_t bits = m.structural & valid & ~inside; bits; bits &= bits - 1) {
+         const char *c = p + __builtin_ctzll(bits);
+         if (*c == '[' || *c == '{') {
+            ++depth;
+         } else if (*c == ']' || *c == '}') {
+            if (--depth == 0) {
+               return found;
+            }
+         } else if (*c == ',' && depth == 1 && c >= target) {
+            splits[found++] = c;
+            if (found == n) {
+               return found;
+            }
+            target = source + (found + 1) * step;
+         }
+      }
+   }
+   return found;
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Key used for array elements.
+static char ANONYMOUS[] = "";
+
+static char BOOL_TRUE[] = "true";
+static char BOOL_FALSE[] = "false";
+static char NULL_VALUE[] = "null";
+static const Value CONST_NULL = {ANONYMOUS, NULL_VALUE, 0, 4, 0, JNULL, 0, {0}};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Hash index of an object's members (open addressing, linear probing). Holds the first member
+/// for each name, so lookups find the same member as a linear search.
+struct Json::MemberIndex {
+   size_t mask_;                // number of slots - 1
+   const Value *slots_[1];      // actually mask_ + 1 slots, null if unused
+};
+
+/// Objects with fewer members are not indexed, a linear search is faster.
+static const size_t INDEX_MIN_MEMBERS = 16;
+
+static inline size_t hashName(const char *s, size_t n)
+{
+   // FNV-1a
+   uint32_t h = 2166136261u;
+   for (const char *e = s + n; s < e; ++s) {
+      h = (h ^ (unsigned char) *s) * 16777619u;
+   }
+   return h;
+}
+
+/// Compares the name of «x» with «s», which has length «n».
+static inline bool sameName(const Value *x, const char *s, size_t n)
+{
+   if (n < Value::LONG_NAME) {
+      return x->nameLength_ == n && !memcmp(x->name_, s, n);
+   }
+   return x->nameLength_ == Value::LONG_NAME && !strcmp(x->name_, s);
+}
+
+/// Returns the first eight bytes of «s» as one word, see Key::prefix_.
+static inline uint64_t namePrefix(const char *s)
+{
+   uint64_t word;
+   memcpy(&word, s, 8);
+   return word;
+}
+
+/// Compares the name of «x» with «key».
+static inline bool sameName(const Value *x, const Key &key)
+{
+   if (x->name_ == key.name_ && x->nameLength_ == key.length_) {
+      return true;      // interned, see INTERN_KEYS
+   }
+   if (key.length_ < 8) {
+      return x->nameLength_ == key.length_ && !memcmp(x->name_, key.name_, key.length_);
+   }
+   if (key.length_ < Value::LONG_NAME) {
+      return x->nameLength_ == key.length_ && namePrefix(x->name_) == key.prefix_
+         && !memcmp(x->name_ + 8, key.name_ + 8, key.length_ - 8);
+   }
+   // Long names are NUL-terminated, but may be shorter than the key.
+   return x->nameLength_ == Value::LONG_NAME && namePrefix(x->name_) == key.prefix_
+      && !strncmp(x->name_ + 8, key.name_ + 8, key.length_ - 8) && x->name_[key.length_] == 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Key interning (INTERN_KEYS)
+
+/// Hash for KeyTable. Reads names of eight bytes or more as two words, which is faster than
+/// hashName() for the typical member name. The words are mixed with the finalizer of
+/// MurmurHash3, so that all bytes affect the low bits.
+static inline size_t internHash(const char *s, size_t n)
+{
+   uint64_t h = n;
+   if (n >= 8) {
+      uint64_t first, last;
+      memcpy(&first, s, 8);
+      memcpy(&last, s + n - 8, 8);
+      h ^= first ^ ((last << 32) | (last >> 32));
+   } else {
+      for (size_t i = 0; i < n; ++i) {
+         h = (h << 8) | (unsigned char) s[i];
+      }
+   }
+   h ^= h >> 33;
+   h *= 0xFF51AFD7ED558CCDull;
+   h ^= h >> 33;
+   h *= 0xC4CEB9FE1A85EC53ull;
+   return (size_t) (h ^ (h >> 33));
+}
+
+/// Interned names (open addressing, linear probing), in the memory of a Tree.
+class Json::KeyTable {
+   struct Slot {
+      const char *name;         // NUL-terminated, null if unused
+      size_t length;
+      size_t hash;
+   };
+   Slot *slots_;
+   size_t mask_;                // number of slots - 1
+   size_t used_;
+
+   /// Allocates «n» empty slots in «arena».
+   void allocate(Tree &arena, size_t n)
+   {
+      slots_ = (Slot *) arena.malloc(n * sizeof(Slot));
+      memset(slots_, 0, n * sizeof(Slot));
+      mask_ = n - 1;
+   }
+
+public:
+   /// Creates an empty table in «arena».
+   static KeyTable *create(Tree &arena)
+   {
+      KeyTable *table = (KeyTable *) arena.malloc(sizeof(KeyTable));
+      table->allocate(arena, 64);
+      table->used_ = 0;
+      return table;
+   }
+
+   size_t size() const
+   {
+      return used_;
+   }
+
+   /// Returns the interned copy of «name», null if there is none.
+   const char *find(const char *name, size_t length, size_t hash) const
+   {
+      for (size_t i = hash & mask_; slots_[i].name != 0; i = (i + 1) & mask_) {
+         const Slot &slot = slots_[i];
+         if (slot.hash == hash && slot.length == length && !memcmp(slot.name, name, length)) {
+            return slot.name;
+         }
+      }
+      return 0;
+   }
+
+   /// Adds «name», which must not be in the table yet, and returns its interned copy. With
+   /// «copy», the name is copied into «arena», otherwise «name» is the interned copy.
+   const char *add(Tree &arena, const char *name, size_t length, size_t hash, bool copy)
+   {
+      if (2 * (used_ + 1) > mask_ + 1) {
+         // The old slots stay in the arena until it is reset.
+         const Slot *old = slots_;
+         const size_t n = mask_ + 1;
+         allocate(arena, 2 * n);
+         for (size_t k = 0; k < n; ++k) {
+            if (old[k].name != 0) {
+               size_t i = old[k].hash & mask_;
+               while (slots_[i].name != 0) {
+                  i = (i + 1) & mask_;
+               }
+               slots_[i] = old[k];
+            }
+         }
+      }
+      if (copy) {
+         char *p = arena.malloc(length + 1);
+         memcpy(p, name, length);
+         p[length] = 0;
+         name = p;
+      }
+      size_t i = hash & mask_;
+      while (slots_[i].name != 0) {
+         i = (i + 1) & mask_;
+      }
+      slots_[i].name = name;
+      slots_[i].length = length;
+      slots_[i].hash = hash;
+      ++used_;
+      return name;
+   }
+
+   /// Returns the interned copy of the member name «name» for «tree», see INTERN_KEYS.
+   static char *intern(Tree &tree, const char *name, size_t length)
+   {
+      if (tree.keys_ == 0) {
+         tree.keys_ = create(tree);
+      }
+      const size_t hash = internHash(name, length);
+      const char *interned = tree.keys_->find(name, length, hash);
+      if (interned == 0) {
+         if (tree.dictionary_) {
+            interned = tree.keys_->add(tree, tree.dictionary_->intern(name, length, hash), length,
+                                       hash, false);
+         } else {
+            interned = tree.keys_->add(tree, name, length, hash, true);
+         }
+      }
+      return (char *) interned;
+   }
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct KeyDictionary::Lock {
+#if JSON_HAVE_THREADS
+   std::mutex mutex;
+#endif
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+KeyDictionary::KeyDictionary()
+   : table_(0), lock_(new Lock)
+{
+   table_ = KeyTable::create(storage_);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+KeyDictionary::~KeyDictionary()
+{
+   delete lock_;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+const char *KeyDictionary::intern(const char *name, size_t length, size_t hash)
+{
+#if JSON_HAVE_THREADS
+   std::lock_guard<std::mutex> guard(lock_->mutex);
+#endif
+   const char *interned = table_->find(name, length, hash);
+   return interned ? interned : table_->add(storage_, name, length, hash, true);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Key KeyDictionary::key(const char *name)
+{
+   return key(name, strlen(name));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Key KeyDictionary::key(const char *name, size_t length)
+{
+   if (length >= Value::LONG_NAME) {
+      return Key(name, length);
+   }
+   return Key(intern(name, length, internHash(name, length)), length);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t KeyDictionary::size() const
+{
+#if JSON_HAVE_THREADS
+   std::lock_guard<std::mutex> guard(lock_->mutex);
+#endif
+   return table_->size();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Builds the member index of «object» in the arena of «tree» if the object is large enough.
+static void indexObject(Tree &tree, Value *object)
+{
+   const size_t n = object->length_;
+   object->flags_ = 0;
+   if (n < INDEX_MIN_MEMBERS) {
+      return;
+   }
+   size_t nSlots = 2 * INDEX_MIN_MEMBERS;
+   while (nSlots < 2 * n) {
+      nSlots *= 2;
+   }
+   MemberIndex *index = (MemberIndex *)
+      tree.malloc(sizeof(MemberIndex) + (nSlots - 1) * sizeof(const Value *));
+   index->mask_ = nSlots - 1;
+   memset(index->slots_, 0, nSlots * sizeof(const Value *));
+   for (const Value *x = (const Value *) object->value_; x != 0; x = x->next_) {
+      const size_t length = x->nameLength();
+      size_t i = hashName(x->name_, length) & index->mask_;
+      while (index->slots_[i] != 0 && !sameName(index->slots_[i], x->name_, length)) {
+         i = (i + 1) & index->mask_;
+      }
+      if (index->slots_[i] == 0) {
+         index->slots_[i] = x;
+      }
+   }
+   object->index_ = index;
+   object->flags_ = Value::OBJECT_INDEXED;
+}
+
+/// Arrays with fewer elements get no element table.
+static const size_t INDEX_MIN_ELEMENTS = 8;
+
+/// Builds the element table of «array» in the arena of «tree» if the array is large enough.
+static void indexArray(Tree &tree, Value *array)
+{
+   array->flags_ = 0;
+   if (array->length_ < INDEX_MIN_ELEMENTS) {
+      return;
+   }
+   const Value **elements = (const Value **) tree.malloc(array->length_ * sizeof(const Value *));
+   const Value **e = elements;
+   for (const Value *x = (const Value *) array->value_; x != 0; x = x->next_) {
+      *e++ = x;
+   }
+   array->elements_ = elements;
+   array->flags_ = Value::ARRAY_INDEXED;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Object shapes (SHAPE_OBJECTS)
+
+/// The last Shape::id_ handed out.
+#if JSON_HAVE_THREADS
+static std::atomic<uint64_t> lastShapeId(0);
+#else
+static uint64_t lastShapeId = 0;
+#endif
+
+/// Shapes (open addressing, linear probing), in the memory of a Tree. Member names are interned,
+/// so two objects have the same Shape if their name pointers are equal.
+class Json::ShapeTable {
+   Shape **slots_;              // null if unused
+   size_t mask_;                // number of slots - 1
+   size_t used_;
+
+   /// Allocates «n» empty slots in «arena».
+   void allocate(Tree &arena, size_t n)
+   {
+      slots_ = (Shape **) arena.malloc(n * sizeof(Shape *));
+      memset(slots_, 0, n * sizeof(Shape *));
+      mask_ = n - 1;
+   }
+
+   /// Creates the Shape of «members», which are «n» Values with hash «hash», in «arena». The
+   /// Shape refers to «members», which must live as long as the arena.
+   static Shape *create(Tree &arena, const Value *const *members, size_t n, size_t hash)
+   {
+      size_t nIndex = 8;
+      while (nIndex < 2 * n) {
+         nIndex *= 2;
+      }
+      Shape *shape = (Shape *) arena.malloc(sizeof(Shape));
+      unsigned *index = (unsigned *) arena.malloc(nIndex * sizeof(unsigned));
+      memset(index, 0, nIndex * sizeof(unsigned));
+      shape->id_ = ++lastShapeId;
+      shape->size_ = n;
+      shape->mask_ = nIndex - 1;
+      shape->names_ = members;
+      shape->index_ = index;
+      shape->hash_ = hash;
+      for (size_t k = 0; k < n; ++k) {
+         const Value *x = members[k];
+         size_t i = hashName(x->name_, x->nameLength_) & shape->mask_;
+         while (index[i] != 0 && !sameName(members[index[i] - 1], x->name_, x->nameLength_)) {
+            i = (i + 1) & shape->mask_;
+         }
+         if (index[i] == 0) {
+            index[i] = k + 1;
+         }
+      }
+      return shape;
+   }
+
+public:
+   /// Returns the Shape of «members», which are «n» Values with interned names, creating it in
+   /// «tree» if needed. «hash» is shapeHash() of the names.
+   static const Shape *get(Tree &tree, const Value *const *members, size_t n, size_t hash)
+   {
+      ShapeTable *table = tree.shapes_;
+      if (table == 0) {
+         table = tree.shapes_ = (ShapeTable *) tree.malloc(sizeof(ShapeTable));
+         table->allocate(tree, 64);
+         table->used_ = 0;
+      }
+      size_t i = hash & table->mask_;
+      for (const Shape *s; (s = table->slots_[i]) != 0; i = (i + 1) & table->mask_) {
+         if (s->hash_ == hash && s->size_ == n) {
+            size_t k = 0;
+            while (k < n && s->names_[k]->name_ == members[k]->name_) {
+               ++k;
+            }
+            if (k == n) {
+               return s;
+            }
+         }
+      }
+      if (2 * (table->used_ + 1) > table->mask_ + 1) {
+         // The old slots stay in the arena until it is reset.
+         Shape *const *old = table->slots_;
+         const size_t nOld = table->mask_ + 1;
+         table->allocate(tree, 2 * nOld);
+         for (size_t k = 0; k < nOld; ++k) {
+            if (old[k] != 0) {
+               size_t j = old[k]->hash_ & table->mask_;
+               while (table->slots_[j] != 0) {
+                  j = (j + 1) & table->mask_;
+               }
+               table->slots_[j] = old[k];
+            }
+         }
+         i = hash & table->mask_;
+         while (table->slots_[i] != 0) {
+            i = (i + 1) & table->mask_;
+         }
+      }
+      ++table->used_;
+      return table->slots_[i] = create(tree, members, n, hash);
+   }
+};
+
+const char *Shape::name(size_t slot) const
+{
+   return names_[slot]->name_;
+}
+
+size_t Shape::nameLength(size_t slot) const
+{
+   return names_[slot]->nameLength_;
+}
+
+int Shape::slot(const Key &key) const
+{
+   for (size_t i = key.hash_ & mask_; index_[i] != 0; i = (i + 1) & mask_) {
+      const unsigned k = index_[i] - 1;
+      if (sameName(names_[k], key)) {
+         return (int) k;
+      }
+   }
+   return -1;
+}
+
+/// Gives «object» a Shape and a member table in the arena of «tree». Returns false if the object
+/// cannot have a Shape because it is empty or has a long name, which is not interned.
+static bool shapeObject(Tree &tree, Value *object)
+{
+   const size_t n = object->length_;
+   if (n == 0) {
+      return false;
+   }
+   MemberSlots *slots = (MemberSlots *)
+      tree.malloc(sizeof(MemberSlots) + (n - 1) * sizeof(const Value *));
+   uint64_t h = n;
+   size_t k = 0;
+   for (const Value *x = (const Value *) object->value_; x != 0; x = x->next_) {
+      if (x->nameLength_ == Value::LONG_NAME) {
+         return false;
+      }
+      slots->values_[k++] = x;
+      h = (h ^ (uintptr_t) x->name_) * 0x100000001B3ull;
+   }
+   h ^= h >> 33;
+   h *= 0xFF51AFD7ED558CCDull;
+   h ^= h >> 33;
+   slots->shape_ = ShapeTable::get(tree, slots->values_, n, (size_t) h);
+   object->slots_ = slots;
+   object->flags_ = Value::OBJECT_SHAPED;
+   return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Applies the INDEX_OBJECTS, INDEX_ARRAYS, LAZY_INDEX and SHAPE_OBJECTS parse modes to a closed
+/// «container». Indexes and Shapes are allocated in «tree», lazy indexes later in «owner».
+static void indexContainer(Tree &tree, Tree &owner, Value *container, ParseMode mode)
+{
+   if (container->type_ == JOBJECT && (mode & SHAPE_OBJECTS) && shapeObject(tree, container)) {
+      return;
+   }
+   if (container->type_ == JOBJECT ? (mode & INDEX_OBJECTS) : (mode & INDEX_ARRAYS)) {
+      if (container->type_ == JOBJECT) {
+         indexObject(tree, container);
+      } else {
+         indexArray(tree, container);
+      }
+   } else if (mode & LAZY_INDEX) {
+      container->tree_ = &owner;
+      container->flags_ = Value::OBJECT_LAZY;
+   }
+}
+
+#define SKIP_WS() while (IS_SPACE(*s)) { ++s; }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+char *Parser::findStringSpecial(char *s, const char *limit)
+{
+   return ::findStringSpecial(s, limit);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Unescapes the rest of a string from «s», the first backslash or control character, writing
+/// to «*wp». Returns the position after the closing quote or the terminating NUL.
+char *Parser::unescape(char *s, char **wp, bool zeroCopy, const char **errorPosition,
+                       const char **errorMessage)
+{
+   char *w = *wp;
+   while (*s) {
+      if ((unsigned char)*s < 0x20) {
+         *errorPosition = s;
+         *errorMessage = "control character in string";
+         return 0;
+      } else if (*s == '\\') {
+         switch (s[1]) {
+            case '"':  *w = '"'; break;
+            case '\\': *w = '\\'; break;
+            case '/':  *w = '/'; break;
+            case 'b':  *w = '\b'; break;
+            case 'f':  *w = '\f'; break;
+            case 'n':  *w = '\n'; break;
+            case 'r':  *w = '\r'; break;
+            case 't':  *w = '\t'; break;
+            case 'u':
+                       {
+                          unsigned int cp = parseHex4(s+2);
+                          if (cp >= 0xD800 && cp < 0xDC00) {
+                             // handle surrogates
+                             s += 6;
+                             if (*s != '\\' || s[1] != 'u') {
+                                *errorPosition = s;
+                                *errorMessage = "unrecognized escape sequence";
+                                return 0;
+                             }
+                             unsigned cp2 = parseHex4(s+2);
+                             if (cp2 < 0xDC00 || cp2 >= 0xE000)  {
+                                *errorPosition = s;
+                                *errorMessage = "unrecognized escape sequence";
+                                return 0;
+                             }
+                             cp = ((cp & 0x3FF) << 10) | (cp2 & 0x3FF) | 0x10000;
+                          }
+                          if (cp <= 0x7F) {
+                             *w = cp;
+                          } else if (cp <= 0x7FF) {
+                             *w++ = 0xC0 | (cp >> 6);
+                             *w =   0x80 | (cp & 0x3F);
+                          } else if (cp <= 0xFFFF) {
+                             *w++ = 0xE0 |  (cp >> 12);
+                             *w++ = 0x80 | ((cp >> 6) & 0x3F);
+                             *w =   0x80 |  (cp & 0x3F);
+                          } else if (cp <= 0x1FFFFF) {
+                             *w++ = 0xF0 |  (cp >> 18);
+                             *w++ = 0x80 | ((cp >> 12) & 0x3F);
+                             *w++ = 0x80 | ((cp >>  6) & 0x3F);
+                             *w =   0x80 |  (cp & 0x3F);
+                          } else {
+                             *errorPosition = s;
+                             *errorMessage = "unrecognized escape sequence";
+                             return 0;
+                          }
+                          s += 4;
+                       }
+                       break;
+            default:
+                       *errorPosition = s;
+                       *errorMessage = "unrecognized escape sequence";
+                       return 0;
+         }
+         ++w;
+         s += 2;
+      } else if (*s == '"') {
+         if (!zeroCopy || w != s) {
+            *w = 0;
+         }
+         ++s;
+         break;
+      } else {
+         *w++ = *s++;
+      }
+   }
+   *wp = w;
+   return s;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Part of a document parsed by one thread with PARALLEL: the elements of the root container
+/// between two split points, which are commas outside strings at nesting level 1.
+struct Tree::Segment {
+   Tree arena;                // memory for all segments but the first one, which uses the owner
+   Tree *owner;
+   char *start;               // the root container's '[' or '{', or after a split point
+   const char *stop;          // split point at the end, null for the last segment
+   Value *open;               // stand-in for the root container, null for the first segment
+   Value container;           // storage for «open»
+   Value **tail;              // where the element after «stop» is linked
+   Value *root;               // result, null on error
+   const char *errorPosition;
+   const char *errorMessage;
+#if JSON_HAVE_THREADS
+   std::exception_ptr exception;
+#endif
+};
+
+/// State of a PushParser between two parts of the text.
+struct Tree::PushState: Parser::State<StackEntry> {
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Number conversions shared by Value and TapeEntry («n» is a JNUMBER).
+
+template <class N>
+static int numberAsInt(const N &n)
+{
+   if (n.flags_ & Value::NUMBER_INTEGER) {
+      if (n.flags_ & Value::NUMBER_NEGATIVE) {
+         return n.uint_ > (uint64_t) INT_MAX + 1 ? INT_MIN : (int) -(int64_t) n.uint_;
+      }
+      return n.uint_ > (uint64_t) INT_MAX ? INT_MAX : (int) n.uint_;
+   }
+   return n.double_ <= INT_MIN ? INT_MIN : n.double_ >= INT_MAX ? INT_MAX : (int) n.double_;
+}
+
+static const uint64_t INT64_LIMIT = (uint64_t) 1 << 63;
+
+/// Integers up to this magnitude are exact as double.
+static const uint64_t DOUBLE_INTEGER_LIMIT = (uint64_t) 1 << 53;
+
+template <class N>
+static int64_t numberAsInt64(const N &n)
+{
+   if (n.flags_ & Value::NUMBER_INTEGER) {
+      if (n.flags_ & Value::NUMBER_NEGATIVE) {
+         if (n.uint_ <= INT64_LIMIT) {
+            return n.uint_ == 0 ? 0 : -(int64_t) (n.uint_ - 1) - 1;
+         }
+      } else if (n.uint_ < INT64_LIMIT) {
+         return (int64_t) n.uint_;
+      }
+   } else if (n.double_ >= -(double) INT64_LIMIT && n.double_ < (double) INT64_LIMIT) {
+      return (int64_t) n.double_;
+   }
+   throw std::out_of_range("number out of int64 range");
+}
+
+template <class N>
+static uint64_t numberAsUint64(const N &n)
+{
+   if (n.flags_ & Value::NUMBER_INTEGER) {
+      if (!(n.flags_ & Value::NUMBER_NEGATIVE) || n.uint_ == 0) {
+         return n.uint_;
+      }
+   } else if (n.double_ > -1.0 && n.double_ < 2.0 * (double) INT64_LIMIT) {
+      return (uint64_t) n.double_;
+   }
+   throw std::out_of_range("number out of uint64 range");
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Builder for Parser::parse(), creates the Values in «tree». Lazy indexes refer to «owner».
+/// With PARALLEL, «open» is the stand-in for the root container in segments after the first.
+class TreeBuilder {
+   Tree &tree_;
+   Tree &owner_;
+   const ParseMode mode_;
+   Value *const open_;
+   Value *pending_;                     // PACK_NUMBERS: the array whose numbers are in numbers_
+   std::vector<Value> numbers_;
+
+   Value *newValue(char *key, size_t keyLength)
+   {
+      Value *value = (Value *) tree_.malloc(sizeof(Value));
+      if (key) {
+         value->name_ = key;
+         value->nameLength_ = keyLength < Value::LONG_NAME ? keyLength : Value::LONG_NAME;
+      } else {
+         value->name_ = ANONYMOUS;
+         value->nameLength_ = 0;
+      }
+      return value;
+   }
+
+   /// Creates the Values of the numbers buffered for «parent», which cannot be packed. They are
+   /// already counted in its length_.
+   void unpack(StackEntry *parent)
+   {
+      pending_ = 0;
+      if (numbers_.empty()) {
+         return;
+      }
+      const size_t n = numbers_.size();
+      Value *values = (Value *) tree_.malloc(n * sizeof(Value));
+      for (size_t i = 0; i < n; ++i) {
+         values[i] = numbers_[i];
+         *((Value **) parent->tail) = values + i;
+         parent->tail = &values[i].next_;
+      }
+      values[n - 1].next_ = 0;
+      numbers_.clear();
+   }
+
+   /// Called before anything but a number is added to «parent».
+   void flush(StackEntry *parent)
+   {
+      if (parent != 0 && parent->obj == pending_) {
+         unpack(parent);
+      }
+   }
+
+   /// Stores the numbers buffered for «frame» as PackedNumbers. Returns false if there are none
+   /// or they fit neither int64_t nor double exactly.
+   bool pack(StackEntry *frame)
+   {
+      const size_t n = numbers_.size();
+      if (n == 0) {
+         return false;
+      }
+      const char *text = numbers_[0].value_;
+      bool integers = true;
+      bool doubles = true;
+      for (size_t i = 0; i < n; ++i) {
+         const Value &v = numbers_[i];
+         if ((size_t) (v.value_ - text) > UINT32_MAX) {
+            return false;
+         }
+         if (v.flags_ & Value::NUMBER_INTEGER) {
+            // -0 is a double, so that copyTo() keeps its sign like asDouble().
+            integers = integers && ((v.flags_ & Value::NUMBER_NEGATIVE) ? v.uint_ - 1 < INT64_LIMIT
+                                                                         : v.uint_ < INT64_LIMIT);
+            doubles = doubles && v.uint_ <= DOUBLE_INTEGER_LIMIT;
+         } else {
+            // Integers beyond 64 bits are rounded as doubles.
+            integers = false;
+            doubles = doubles && !(v.flags_ & Value::NUMBER_OVERFLOW);
+         }
+      }
+      if (!integers && !doubles) {
+         return false;
+      }
+
+      char *memory = tree_.malloc(sizeof(PackedNumbers)
+                                  + n * (sizeof(uint64_t) + sizeof(uint32_t)));
+      PackedNumbers *packed = (PackedNumbers *) memory;
+      uint64_t *values = (uint64_t *) (memory + sizeof(PackedNumbers));
+      uint32_t *offsets = (uint32_t *) (values + n);
+      packed->tree_ = &owner_;
+      packed->text_ = text;
+      packed->offsets_ = offsets;
+      packed->integers_ = integers;
+      packed->int64s_ = (const int64_t *) values;
+      for (size_t i = 0; i < n; ++i) {
+         const Value &v = numbers_[i];
+         offsets[i] = (uint32_t) (v.value_ - text);
+         if (integers) {
+            ((int64_t *) values)[i] = numberAsInt64(v);
+         } else {
+            ((double *) values)[i] = v.asDouble();
+         }
+      }
+      frame->obj->packed_ = packed;
+      frame->obj->flags_ |= Value::ARRAY_PACKED;
+      numbers_.clear();
+      pending_ = 0;
+      return true;
+   }
+
+public:
+   typedef StackEntry Frame;
+
+   Value *root;
+
+   TreeBuilder(Tree &tree, Tree &owner, ParseMode mode, Value *open)
+      : tree_(tree), owner_(owner), mode_(mode), open_(open), pending_(0), root(open)
+   {
+   }
+
+   /// With PACK_NUMBERS, packs the numbers of «array», which is already open (see
+   /// parseDeferred()).
+   void packNumbers(Value *array)
+   {
+      if (mode_ & PACK_NUMBERS) {
+         pending_ = array;
+      }
+   }
+
+   char *allocate(size_t size)
+   {
+      return tree_.malloc(size);
+   }
+
+   bool suspend() const
+   {
+      return false;
+   }
+
+   char *key(char *name, size_t length)
+   {
+      if ((mode_ & (INTERN_KEYS | SHAPE_OBJECTS)) && length < Value::LONG_NAME) {
+         return KeyTable::intern(tree_, name, length);
+      }
+      if ((mode_ & ZERO_COPY) && length >= Value::LONG_NAME) {
+         // Long names must be NUL-terminated.
+         char *copy = tree_.malloc(length + 1);
+         memcpy(copy, name, length);
+         copy[length] = 0;
+         return copy;
+      }
+      return name;
+   }
+
+   void string(Frame *parent, char *key, size_t keyLength, char *value, size_t length)
+   {
+      flush(parent);
+      Value *object = newValue(key, keyLength);
+      object->type_ = JSTRING;
+      object->value_ = value;
+      object->length_ = length;
+      appendValue(parent, object);
+   }
+
+   void number(Frame *parent, char *key, size_t keyLength, const Value &number)
+   {
+      if (parent->obj == pending_) {
+         numbers_.push_back(number);
+         numbers_.back().name_ = ANONYMOUS;
+         ++parent->obj->length_;
+         return;
+      }
+      Value *object = newValue(key, keyLength);
+      object->type_ = JNUMBER;
+      object->value_ = number.value_;
+      object->length_ = number.length_;
+      object->flags_ = number.flags_;
+      object->uint_ = number.uint_;
+      appendValue(parent, object);
+   }
+
+   void boolean(Frame *parent, char *key, size_t keyLength, bool value)
+   {
+      flush(parent);
+      Value *object = newValue(key, keyLength);
+      object->type_ = JBOOL;
+      object->value_ = value ? BOOL_TRUE : BOOL_FALSE;
+      object->length_ = value ? 4 : 5;
+      appendValue(parent, object);
+   }
+
+   void null(Frame *parent, char *key, size_t keyLength)
+   {
+      flush(parent);
+      Value *object = newValue(key, keyLength);
+      object->type_ = JNULL;
+      object->value_ = NULL_VALUE;
+      object->length_ = 4;
+      appendValue(parent, object);
+   }
+
+   void open(Frame *parent, Frame *frame, char *key, size_t keyLength, bool isObject)
+   {
+      flush(parent);
+      Value *object = newValue(key, keyLength);
+      object->type_ = isObject ? JOBJECT : JARRAY;
+      object->value_ = 0;
+      object->length_ = 0;
+      object->flags_ = 0;
+      if (parent == 0) {
+         PMU(ASSERT(root == 0));
+         root = object;
+      } else {
+         appendValue(parent, object);
+      }
+      frame->obj = object;
+      frame->tail = &object->value_;
+      // With PARALLEL, the first segment does not close the root.
+      if (!isObject && (parent != 0 || !(mode_ & PARALLEL))) {
+         packNumbers(object);
+      }
+   }
+
+   void close(Frame *frame, bool)
+   {
+      if (frame->obj == pending_) {
+         if (pack(frame)) {
+            return;
+         }
+         unpack(frame);
+      }
+      if ((mode_ & (INDEX_OBJECTS | INDEX_ARRAYS | LAZY_INDEX | SHAPE_OBJECTS))
+          && frame->obj != open_) {
+         indexContainer(tree_, owner_, frame->obj, mode_);
+      }
+   }
+
+   /// With ON_DEMAND, stores the nested container at «s» as its source text.
+   char *defer(Frame *parent, char *key, size_t keyLength, char *s, const char *end, bool isObject)
+   {
+      if (!(mode_ & ON_DEMAND) || end == 0) {
+         return 0;
+      }
+      flush(parent);
+      char *close = skipContainer(s + 1, end);
+      if (close == 0 || close - s > UINT_MAX) {
+         return 0;      // parse it now, which reports the error
+      }
+      Value *object = newValue(key, keyLength);
+      object->type_ = isObject ? JOBJECT : JARRAY;
+      object->value_ = s;
+      object->length_ = close - s;
+      object->flags_ = Value::OBJECT_DEFERRED;
+      object->tree_ = &owner_;
+      appendValue(parent, object);
+      return close;
+   }
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Projection. The paths are compiled into a tree of Nodes, one for each distinct prefix. A
+// wildcard step is also applied to the names and indexes next to it, so one Node stands for all
+// paths that can match at its place and the builder follows a single Node per container.
+
+/// One step of a projection path.
+struct ProjectionStep {
+   enum Kind { MEMBER, ANY_MEMBER, ELEMENT, ANY_ELEMENT };
+   Kind kind;
+   std::string name;
+   size_t index;
+};
+
+typedef std::vector<ProjectionStep> ProjectionPath;
+
+struct Projection::Paths {
+   std::vector<ProjectionPath> paths;
+};
+
+struct Projection::Node {
+   bool all;                    // keep the whole subtree
+   std::vector<std::pair<std::string, Node *> > members;
+   Node *anyMember;
+   std::vector<std::pair<size_t, Node *> > elements;
+   Node *anyElement;
+
+   Node() : all(false), anyMember(0), anyElement(0) {}
+
+   ~Node()
+   {
+      for (size_t i = 0; i < members.size(); ++i) {
+         delete members[i].second;
+      }
+      for (size_t i = 0; i < elements.size(); ++i) {
+         delete elements[i].second;
+      }
+      delete anyMember;
+      delete anyElement;
+   }
+
+   /// Builds the subtree for «paths», whose first «depth» steps lead here.
+   void build(const std::vector<const ProjectionPath *> &paths, size_t depth)
+   {
+      std::vector<const ProjectionPath *> anyMembers;
+      std::vector<const ProjectionPath *> anyElements;
+      for (size_t i = 0; i < paths.size(); ++i) {
+         if (paths[i]->size() == depth) {
+            all = true;
+            return;
+         }
+         const ProjectionStep &step = (*paths[i])[depth];
+         if (step.kind == ProjectionStep::ANY_MEMBER) {
+            anyMembers.push_back(paths[i]);
+         } else if (step.kind == ProjectionStep::ANY_ELEMENT) {
+            anyElements.push_back(paths[i]);
+         }
+      }
+      for (size_t i = 0; i < paths.size(); ++i) {
+         const ProjectionStep &step = (*paths[i])[depth];
+         if (step.kind == ProjectionStep::MEMBER && member(step.name.data(), step.name.size()) ==
+             anyMember) {
+            std::vector<const ProjectionPath *> matching(anyMembers);
+            for (size_t k = i; k < paths.size(); ++k) {
+               const ProjectionStep &other = (*paths[k])[depth];
+               if (other.kind == ProjectionStep::MEMBER && other.name == step.name) {
+                  matching.push_back(paths[k]);
+               }
+            }
+            members.push_back(std::make_pair(step.name, (Node *) 0));
+            members.back().second = new Node;
+            members.back().second->build(matching, depth + 1);
+         } else if (step.kind == ProjectionStep::ELEMENT && element(step.index) == anyElement) {
+            std::vector<const ProjectionPath *> matching(anyElements);
+            for (size_t k = i; k < paths.size(); ++k) {
+               const ProjectionStep &other = (*paths[k])[depth];
+               if (other.kind == ProjectionStep::ELEMENT && other.index == step.index) {
+                  matching.push_back(paths[k]);
+               }
+            }
+            elements.push_back(std::make_pair(step.index, (Node *) 0));
+            elements.back().second = new Node;
+            elements.back().second->build(matching, depth + 1);
+         }
+      }
+      if (!anyMembers.empty()) {
+         anyMember = new Node;
+         anyMember->build(anyMembers, depth + 1);
+      }
+      if (!anyElements.empty()) {
+         anyElement = new Node;
+         anyElement->build(anyElements, depth + 1);
+      }
+   }
+
+   /// The Node for the member «name», null if it is not selected.
+   const Node *member(const char *name, size_t length) const
+   {
+      for (size_t i = 0; i < members.size(); ++i) {
+         const std::string &s = members[i].first;
+         if (s.size() == length && !memcmp(s.data(), name, length)) {
+            return members[i].second;
+         }
+      }
+      return anyMember;
+   }
+
+   /// The Node for the array element «index», null if it is not selected.
+   const Node *element(size_t index) const
+   {
+      for (size_t i = 0; i < elements.size(); ++i) {
+         if (elements[i].first == index) {
+            return elements[i].second;
+         }
+      }
+      return anyElement;
+   }
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Parses the path from «s» to «end» into «path».
+static void parseProjectionPath(const char *s, const char *end, ProjectionPath &path)
+{
+   for (bool first = true; s < end; first = false) {
+      ProjectionStep step;
+      step.index = 0;
+      if (*s == '[') {
+         ++s;
+         if (s < end && *s == '*') {
+            step.kind = ProjectionStep::ANY_ELEMENT;
+            ++s;
+         } else {
+            if (s == end || !isdigit((unsigned char) *s)) {
+               throw std::invalid_argument("invalid array index in projection path");
+            }
+            step.kind = ProjectionStep::ELEMENT;
+            for (; s < end && isdigit((unsigned char) *s); ++s) {
+               step.index = step.index * 10 + (*s - '0');
+            }
+         }
+         if (s == end || *s != ']') {
+            throw std::invalid_argument("missing ']' in projection path");
+         }
+         ++s;
+      } else {
+         if (!first && *s++ != '.') {
+            throw std::invalid_argument("missing '.' in projection path");
+         }
+         const char *name = s;
+         while (s < end && *s != '.' && *s != '[' && *s != ']') {
+            ++s;
+         }
+         if (s == name) {
+            throw std::invalid_argument("empty member name in projection path");
+         }
+         step.name.assign(name, s);
+         step.kind = (step.name == "*") ? ProjectionStep::ANY_MEMBER : ProjectionStep::MEMBER;
+      }
+      path.push_back(step);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Projection::Projection()
+   : root_(new Node), paths_(new Paths)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Projection::Projection(const char *paths)
+   : root_(new Node), paths_(new Paths)
+{
+   try {
+      add(paths);
+   } catch (...) {
+      delete root_;
+      delete paths_;
+      throw;
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Projection::~Projection()
+{
+   delete root_;
+   delete paths_;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Projection::add(const char *paths)
+{
+   std::vector<ProjectionPath> added;
+   for (const char *s = paths; ; ++s) {
+      while (*s == ' ') {
+         ++s;
+      }
+      const char *end = s + strcspn(s, ",");
+      const char *next = end;
+      while (end > s && end[-1] == ' ') {
+         --end;
+      }
+      // "" is the whole document, but only as the only path.
+      if (end == s && (*next == ',' || s != paths + strspn(paths, " "))) {
+         throw std::invalid_argument("empty projection path");
+      }
+      added.push_back(ProjectionPath());
+      parseProjectionPath(s, end, added.back());
+      s = next;
+      if (*s == 0) {
+         break;
+      }
+   }
+
+   paths_->paths.insert(paths_->paths.end(), added.begin(), added.end());
+   std::vector<const ProjectionPath *> all;
+   for (size_t i = 0; i < paths_->paths.size(); ++i) {
+      all.push_back(&paths_->paths[i]);
+   }
+   Node *root = new Node;
+   try {
+      root->build(all, 0);
+   } catch (...) {
+      delete root;
+      paths_->paths.resize(paths_->paths.size() - added.size());
+      throw;
+   }
+   delete root_;
+   root_ = root;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Builder for Tree::parse() with a Projection. Passes the selected values to «builder» and drops
+/// the others.
+class Json::ProjectionBuilder {
+   TreeBuilder &builder_;
+   const Projection::Node *root_;
+
+public:
+   struct Frame {
+      StackEntry entry;
+      const Projection::Node *node;     // null if the container is dropped
+      size_t count;                     // elements so far
+   };
+
+private:
+   /// Returns the Node for the next child of «parent», null if the child is dropped.
+   const Projection::Node *select(Frame *parent, const char *key, size_t keyLength)
+   {
+      const Projection::Node *node = parent->node;
+      if (node == 0 || node->all) {
+         return node;
+      }
+      return key ? node->member(key, keyLength) : node->element(parent->count++);
+   }
+
+   /// Appends nulls for the dropped elements before the selected one.
+   void fill(Frame *parent, const char *key)
+   {
+      if (key == 0 && !parent->node->all) {
+         while (parent->entry.obj->length_ + 1 < parent->count) {
+            builder_.null(&parent->entry, 0, 0);
+         }
+      }
+   }
+
+   /// Returns true if the simple value is kept.
+   bool keep(Frame *parent, const char *key, size_t keyLength)
+   {
+      const Projection::Node *node = select(parent, key, keyLength);
+      if (node == 0 || !node->all) {
+         return false;
+      }
+      fill(parent, key);
+      return true;
+   }
+
+   /// Passes the name of a kept value to «builder_», which interns or copies it as its mode
+   /// requires. Null for array elements.
+   char *name(char *key, size_t keyLength)
+   {
+      return key ? builder_.key(key, keyLength) : 0;
+   }
+
+public:
+   ProjectionBuilder(TreeBuilder &builder, const Projection &projection)
+      : builder_(builder), root_(projection.root_)
+   {
+   }
+
+   bool suspend() const
+   {
+      return false;
+   }
+
+   char *defer(Frame *, char *, size_t, char *, const char *, bool)
+   {
+      return 0;
+   }
+
+   char *allocate(size_t size)
+   {
+      return builder_.allocate(size);
+   }
+
+   /// Returns the name as it is, see name().
+   char *key(char *name, size_t)
+   {
+      return name;
+   }
+
+   void string(Frame *parent, char *key, size_t keyLength, char *value, size_t length)
+   {
+      if (keep(parent, key, keyLength)) {
+         builder_.string(&parent->entry, name(key, keyLength), keyLength, value, length);
+      }
+   }
+
+   void number(Frame *parent, char *key, size_t keyLength, const Value &number)
+   {
+      if (keep(parent, key, keyLength)) {
+         builder_.number(&parent->entry, name(key, keyLength), keyLength, number);
+      }
+   }
+
+   void boolean(Frame *parent, char *key, size_t keyLength, bool value)
+   {
+      if (keep(parent, key, keyLength)) {
+         builder_.boolean(&parent->entry, name(key, keyLength), keyLength, value);
+      }
+   }
+
+   void null(Frame *parent, char *key, size_t keyLength)
+   {
+      if (keep(parent, key, keyLength)) {
+         builder_.null(&parent->entry, name(key, keyLength), keyLength);
+      }
+   }
+
+   void open(Frame *parent, Frame *frame, char *key, size_t keyLength, bool isObject)
+   {
+      frame->node = parent ? select(parent, key, keyLength) : root_;
+      frame->count = 0;
+      if (frame->node != 0) {
+         if (parent) {
+            fill(parent, key);
+         }
+         builder_.open(parent ? &parent->entry : 0, &frame->entry, name(key, keyLength),
+                       keyLength, isObject);
+      }
+   }
+
+   void close(Frame *frame, bool isObject)
+   {
+      if (frame->node != 0) {
+         builder_.close(&frame->entry, isObject);
+      }
+   }
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int Value::asInt() const
+{
+   switch (type()) {
+      case JBOOL:
+         return value_ == BOOL_TRUE ? 1 : 0;
+      case JNUMBER:
+         return numberAsInt(*this);
+      case JOBJECT:
+      case JARRAY:
+      case JSTRING:
+      case JNULL:
+         throw std::invalid_argument("illegal conversion to int");
+   }
+   return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int64_t Value::asInt64() const
+{
+   return type_ == JNUMBER ? numberAsInt64(*this) : asInt();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+uint64_t Value::asUint64() const
+{
+   return type_ == JNUMBER ? numberAsUint64(*this) : asInt();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+const char *Value::asString() const
+{
+   switch (type()) {
+      case JOBJECT:
+         throw std::invalid_argument("illegal conversion of object to string");
+      case JARRAY:
+         throw std::invalid_argument("illegal conversion of array to string");
+      default:
+         break;
+   }
+   return value_;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t Value::stringLength() const
+{
+   asString();
+   return length_;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t Value::nameLength() const
+{
+   return nameLength_ < LONG_NAME ? nameLength_ : strlen(name_);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool Value::asBool() const
+{
+   switch (type()) {
+      case JBOOL:
+         return value_ == BOOL_TRUE;
+      case JNULL:
+         return false;
+      case JNUMBER:
+         return !(flags_ & NUMBER_ZERO);
+      case JOBJECT:
+      case JARRAY:
+      case JSTRING:
+         return true;
+   }
+   return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Creates the element Values of a packed «array» (see PACK_NUMBERS) in one block, so get(int)
+/// finds them in O(1). The text of each number is scanned again, which gives it the same flags
+/// as without packing.
+static void unpackNumbers(Value *array)
+{
+   const PackedNumbers *packed = array->packed_;
+   const size_t n = array->length_;
+   Value *values = (Value *) packed->tree_->malloc(n * sizeof(Value));
+   for (size_t i = 0; i < n; ++i) {
+      Value &v = values[i];
+      const char *message;
+      Parser::scanNumber((char *) packed->text_ + packed->offsets_[i], v, &message);
+      v.name_ = ANONYMOUS;
+      v.nameLength_ = 0;
+      v.next_ = i + 1 < n ? values + i + 1 : 0;
+   }
+   array->value_ = (const char *) values;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+const Value* Value::children() const
+{
+   if ((type_ != JARRAY) && (type_ != JOBJECT)) {
+      throw std::invalid_argument("indexed access on simple type");
+   }
+   if (flags_ & OBJECT_DEFERRED) {
+      if (flags_ & OBJECT_INVALID) {
+         throw SyntaxError(uint_, value_);
+      }
+      tree_->parseDeferred(const_cast<Value *>(this));
+   }
+   if ((flags_ & ARRAY_PACKED) && value_ == 0) {
+      unpackNumbers(const_cast<Value *>(this));
+   }
+   return (const Value*) value_;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+const Value& Value::get(int i) const
+{
+   const Value*x = children();
+   if (type_ == JOBJECT && (flags_ & OBJECT_SHAPED) && i >= 0 && (unsigned) i < length_) {
+      return *slots_->values_[i];
+   }
+   if (type_ == JARRAY && i >= 0 && (unsigned) i < length_) {
+      if (flags_ & ARRAY_LAZY) {
+         indexArray(*tree_, const_cast<Value *>(this));
+      }
+      if (flags_ & ARRAY_INDEXED) {
+         return *elements_[i];
+      }
+      if (flags_ & ARRAY_PACKED) {
+         return x[i];
+      }
+   }
+   while (i > 0 && x != 0) {
+      --i;
+      x = x->next_;
+   }
+   if ((x == 0) || (i != 0)) {
+      throw std::invalid_argument("array index out of bounds");
+   }
+   return *x;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+const Value& Value::get(const char *s) const
+{
+   if (type_ != JOBJECT) {
+      throw std::invalid_argument("member access on non-object");
+   }
+   const size_t n = strlen(s);
+   if (flags_ & OBJECT_DEFERRED) {
+      children();
+   }
+   if ((flags_ & OBJECT_SHAPED) && length_ >= INDEX_MIN_MEMBERS) {
+      return get(Key(s, n));
+   }
+   if (flags_ & OBJECT_LAZY) {
+      indexObject(*tree_, const_cast<Value *>(this));
+   }
+   if (flags_ & OBJECT_INDEXED) {
+      const Value *x;
+      for (size_t i = hashName(s, n) & index_->mask_; (x = index_->slots_[i]) != 0;
+           i = (i + 1) & index_->mask_) {
+         if (sameName(x, s, n)) {
+            return *x;
+         }
+      }
+      return CONST_NULL;
+   }
+   const Value*x = (const Value*) value_;
+   if (n < LONG_NAME) {
+      for (; x != 0; x = x->next_) {
+         if (x->nameLength_ == n && !memcmp(x->name_, s, n)) {
+            return *x;
+         }
+      }
+   } else {
+      for (; x != 0; x = x->next_) {
+         if (x->nameLength_ == LONG_NAME && !strcmp(x->name_, s)) {
+            return *x;
+         }
+      }
+   }
+   return CONST_NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+const Value& Value::get(const Key &key) const
+{
+   if (type_ != JOBJECT) {
+      throw std::invalid_argument("member access on non-object");
+   }
+   if (flags_ & OBJECT_DEFERRED) {
+      children();
+   }
+   if (flags_ & OBJECT_SHAPED) {
+      const int slot = slots_->shape_->slot(key);
+      return slot < 0 ? CONST_NULL : *slots_->values_[slot];
+   }
+   if (flags_ & OBJECT_LAZY) {
+      indexObject(*tree_, const_cast<Value *>(this));
+   }
+   if (flags_ & OBJECT_INDEXED) {
+      const Value *x;
+      for (size_t i = key.hash_ & index_->mask_; (x = index_->slots_[i]) != 0;
+           i = (i + 1) & index_->mask_) {
+         if (sameName(x, key)) {
+            return *x;
+         }
+      }
+      return CONST_NULL;
+   }
+   for (const Value *x = (const Value*) value_; x != 0; x = x->next_) {
+      if (sameName(x, key)) {
+         return *x;
+      }
+   }
+   return CONST_NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+const Value& Value::lookup(const Field &field) const
+{
+   const Shape *shape = (flags_ & (OBJECT_SHAPED | OBJECT_DEFERRED)) ? this->shape() : 0;
+   if (shape == 0) {
+      return get(field.key_);
+   }
+   const int slot = shape->slot(field.key_);
+   if (slot < 0) {
+      return CONST_NULL;
+   }
+   field.shape_ = shape->id_;
+   field.slot_ = slot;
+   return *slots_->values_[slot];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+const Shape *Value::shape() const
+{
+   if (type_ != JOBJECT) {
+      return 0;
+   }
+   if (flags_ & OBJECT_DEFERRED) {
+      children();
+   }
+   return (flags_ & OBJECT_SHAPED) ? slots_->shape_ : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+const PackedNumbers *Value::packed() const
+{
+   if (type_ != JARRAY) {
+      return 0;
+   }
+   if (flags_ & ARRAY_DEFERRED) {
+      if (flags_ & ARRAY_INVALID) {
+         throw SyntaxError(uint_, value_);
+      }
+      tree_->parseDeferred(const_cast<Value *>(this));
+   }
+   return (flags_ & ARRAY_PACKED) ? packed_ : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t Value::copyTo(double *out, size_t n) const
+{
+   if (type_ != JARRAY) {
+      throw std::invalid_argument("copyTo() on non-array");
+   }
+   const PackedNumbers *numbers = packed();
+   n = std::min(n, (size_t) length_);
+   if (numbers != 0 && !numbers->integers_) {
+      memcpy(out, numbers->doubles_, n * sizeof(double));
+   } else if (numbers != 0) {
+      for (size_t i = 0; i < n; ++i) {
+         out[i] = (double) numbers->int64s_[i];
+      }
+   } else {
+      const Value *x = children();
+      for (size_t i = 0; i < n; ++i, x = x->next_) {
+         if (x->type_ != JNUMBER) {
+            throw std::invalid_argument("array element is not a number");
+         }
+         out[i] = x->asDouble();
+      }
+   }
+   return n;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t Value::copyTo(int64_t *out, size_t n) const
+{
+   if (type_ != JARRAY) {
+      throw std::invalid_argument("copyTo() on non-array");
+   }
+   const PackedNumbers *numbers = packed();
+   n = std::min(n, (size_t) length_);
+   if (numbers != 0 && numbers->integers_) {
+      memcpy(out, numbers->int64s_, n * sizeof(int64_t));
+   } else if (numbers != 0) {
+      // Integers in doubles_ are exact, so only fractions are truncated.
+      for (size_t i = 0; i < n; ++i) {
+         const double d = numbers->doubles_[i];
+         if (!(d >= -(double) INT64_LIMIT && d < (double) INT64_LIMIT)) {
+            throw std::out_of_range("number out of int64 range");
+         }
+         out[i] = (int64_t) d;
+      }
+   } else {
+      const Value *x = children();
+      for (size_t i = 0; i < n; ++i, x = x->next_) {
+         if (x->type_ != JNUMBER) {
+            throw std::invalid_argument("array element is not a number");
+         }
+         out[i] = numberAsInt64(*x);
+      }
+   }
+   return n;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Columns. Each column has one malloc()ed block with the values, the string lengths and the
+// null bitmap, each part aligned to COLUMN_ALIGNMENT. extract() visits each element once and
+// stores all of its cells, null rows included, so only the padding rows need clearing. The
+// padding makes the row count a multiple of 64, at least 64, so the buffers are never empty.
+
+static const size_t COLUMN_ALIGNMENT = 64;
+
+static inline size_t alignColumn(size_t n)
+{
+   return (n + COLUMN_ALIGNMENT - 1) & ~(COLUMN_ALIGNMENT - 1);
+}
+
+struct Columns::Column {
+   const std::string name;
+   const Field field;           // points to «name»
+   const ColumnType type;
+   char *memory;                // from ::malloc(), null if none
+   size_t capacity;             // rows
+   char *values;
+   size_t *lengths;             // COLUMN_STRING only
+   uint64_t *nulls;
+
+   Column(const char *n, ColumnType t)
+      : name(n), field(name.c_str(), name.size()), type(t), memory(0), capacity(0), values(0),
+        lengths(0), nulls(0)
+   {
+   }
+
+   ~Column()
+   {
+      ::free(memory);
+   }
+
+   size_t valueSize() const
+   {
+      switch (type) {
+         case COLUMN_BOOL:
+            return sizeof(bool);
+         case COLUMN_STRING:
+            return sizeof(const char *);
+         default:
+            return 8;
+      }
+   }
+
+   /// Makes room for «rows», a multiple of 64.
+   void reserve(size_t rows)
+   {
+      const size_t valueBytes = alignColumn(rows * valueSize());
+      const size_t lengthBytes = type == COLUMN_STRING ? alignColumn(rows * sizeof(size_t)) : 0;
+      const size_t nullBytes = alignColumn(rows / 8);
+      char *m = (char *) ::malloc(valueBytes + lengthBytes + nullBytes + COLUMN_ALIGNMENT);
+      if (m == 0) {
+         throw std::bad_alloc();
+      }
+      ::free(memory);
+      memory = m;
+      capacity = rows;
+      values = (char *) alignColumn((uintptr_t) m);
+      lengths = type == COLUMN_STRING ? (size_t *) (values + valueBytes) : 0;
+      nulls = (uint64_t *) (values + valueBytes + lengthBytes);
+   }
+
+   /// Makes room for «n» rows and the padding, clears the padding and the null bitmap.
+   void prepare(size_t n)
+   {
+      const size_t padded = n == 0 ? 64 : (n + 63) & ~(size_t) 63;
+      if (padded > capacity) {
+         reserve(padded);
+      }
+      const size_t size = valueSize();
+      memset(values + n * size, 0, (padded - n) * size);
+      if (lengths) {
+         memset(lengths + n, 0, (padded - n) * sizeof(size_t));
+      }
+      memset(nulls, 0, padded / 8);
+   }
+
+   /// Stores «v» in «row».
+   void store(size_t row, const Value &v)
+   {
+      if (v.type_ == JNULL) {
+         nulls[row / 64] |= (uint64_t) 1 << (row % 64);
+         switch (type) {
+            case COLUMN_BOOL:
+               ((bool *) values)[row] = false;
+               break;
+            case COLUMN_STRING:
+               ((const char **) values)[row] = ANONYMOUS;
+               lengths[row] = 0;
+               break;
+            default:
+               ((uint64_t *) values)[row] = 0;
+         }
+         return;
+      }
+      switch (type) {
+         case COLUMN_DOUBLE:
+            if (v.type_ == JNUMBER) {
+               ((double *) values)[row] = v.asDouble();
+               return;
+            }
+            break;
+         case COLUMN_INT64:
+            if (v.type_ == JNUMBER) {
+               const bool small = (v.flags_ & (Value::NUMBER_INTEGER | Value::NUMBER_NEGATIVE))
+                  == Value::NUMBER_INTEGER && v.uint_ < INT64_LIMIT;
+               ((int64_t *) values)[row] = small ? (int64_t) v.uint_ : numberAsInt64(v);
+               return;
+            }
+            break;
+         case COLUMN_BOOL:
+            if (v.type_ == JBOOL) {
+               ((bool *) values)[row] = v.value_ == BOOL_TRUE;
+               return;
+            }
+            break;
+         case COLUMN_STRING:
+            if (v.type_ == JSTRING) {
+               ((const char **) values)[row] = v.value_;
+               lengths[row] = v.length_;
+               return;
+            }
+            break;
+      }
+      throw std::invalid_argument("member type does not match column");
+   }
+};
+
+struct Columns::Data {
+   std::vector<Column *> columns;
+   size_t rows;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Columns::Columns()
+   : data_(new Data)
+{
+   data_->rows = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Columns::~Columns()
+{
+   for (size_t i = 0; i < data_->columns.size(); ++i) {
+      delete data_->columns[i];
+   }
+   delete data_;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t Columns::add(const char *name, ColumnType type)
+{
+   data_->columns.push_back(0);
+   data_->columns.back() = new Column(name, type);
+   data_->columns.back()->prepare(0);
+   data_->rows = 0;
+   return data_->columns.size() - 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Columns::extract(const Value &array)
+{
+   if (array.type() != JARRAY) {
+      throw std::invalid_argument("columns from non-array");
+   }
+   const std::vector<Column *> &columns = data_->columns;
+   const size_t n = array.length();
+   data_->rows = 0;
+   for (size_t c = 0; c < columns.size(); ++c) {
+      columns[c]->prepare(n);
+   }
+   size_t row = 0;
+   for (const Value *x = array.children(); x != 0; x = x->next_, ++row) {
+      for (size_t c = 0; c < columns.size(); ++c) {
+         Column &column = *columns[c];
+         column.store(row, x->type_ == JOBJECT ? x->get(column.field) : CONST_NULL);
+      }
+   }
+   data_->rows = n;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t Columns::rows() const
+{
+   return data_->rows;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+const Columns::Column &Columns::column(size_t column, ColumnType type) const
+{
+   if (column >= data_->columns.size()) {
+      throw std::out_of_range("no such column");
+   }
+   const Column &c = *data_->columns[column];
+   if (c.type != type) {
+      throw std::invalid_argument("column has a different type");
+   }
+   return c;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+const double *Columns::doubles(size_t c) const
+{
+   return (const double *) column(c, COLUMN_DOUBLE).values;
+}
+
+const int64_t *Columns::int64s(size_t c) const
+{
+   return (const int64_t *) column(c, COLUMN_INT64).values;
+}
+
+const bool *Columns::bools(size_t c) const
+{
+   return (const bool *) column(c, COLUMN_BOOL).values;
+}
+
+const char *const *Columns::strings(size_t c) const
+{
+   return (const char *const *) column(c, COLUMN_STRING).values;
+}
+
+const size_t *Columns::stringLengths(size_t c) const
+{
+   return column(c, COLUMN_STRING).lengths;
+}
+
+const uint64_t *Columns::nulls(size_t c) const
+{
+   if (c >= data_->columns.size()) {
+      throw std::out_of_range("no such column");
+   }
+   return column(c, data_->columns[c]->type).nulls;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Tree::reserveSource(size_t length, ParseMode mode)
+{
+   // The tree is usually about as large as the source. A parallel parse puts most of it into
+   // the segments' trees, an on-demand parse only builds the outer levels and a projection only
+   // the selected paths.
+   if (!(mode & (PARALLEL | ON_DEMAND)) && projection_ == 0) {
+      reserve(length);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Parses a whole document with the scanner selected by «mode».
+template <class Builder>
+static bool parseWith(Builder &builder, char *source, const char *end, ParseMode mode,
+                      const char **errorPosition, const char **errorMessage)
+{
+   if (mode & STRUCTURAL_INDEX) {
+      IndexScanner scanner(source, end);
+      return Parser::parse(source, end, mode, scanner, builder, 0, 0, 0,
+                           errorPosition, errorMessage);
+   }
+   ByteScanner scanner(source, end);
+   return Parser::parse(source, end, mode, scanner, builder, 0, 0, 0, errorPosition, errorMessage);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Tree::parseInternal(char *source, const char *end, ParseMode mode)
+{
+   if (projection_) {
+      mode = (ParseMode) (mode & ~(ON_DEMAND | PARALLEL));
+   }
+   if (mode & ON_DEMAND) {
+      // Nested containers are located with skipContainer(), which needs the end.
+      mode = (ParseMode) (mode & ~(STRUCTURAL_INDEX | PARALLEL));
+      end = end ? end : source + strlen(source);
+      source_ = source;
+      mode_ = mode;
+   }
+#if JSON_HAVE_THREADS
+   if ((mode & PARALLEL) && parseParallel(source, end, mode)) {
+      return;
+   }
+#endif
+   const char *errorPosition = 0;
+   const char *errorMessage = 0;
+   TreeBuilder builder(*this, *this, mode, 0);
+   bool ok;
+
+   if (projection_) {
+      ProjectionBuilder projector(builder, *projection_);
+      ok = parseWith(projector, source, end, mode, &errorPosition, &errorMessage);
+   } else {
+      ok = parseWith(builder, source, end, mode, &errorPosition, &errorMessage);
+   }
+   if (!ok) {
+      throw SyntaxError(errorPosition - source, errorMessage);
+   }
+   root_ = builder.root;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Parses the document at «source», which may be followed by more documents, and returns the
+/// text after it. Returns null if there is no document but only comments. «offset» is the
+/// position of «source» reported in errors.
+char *Tree::parseNext(char *source, const char *end, ParseMode mode, IndexScanner *scanner,
+                      size_t offset)
+{
+   const char *errorPosition = 0;
+   const char *errorMessage = 0;
+   char *rest = 0;
+   mode = (ParseMode) (mode & ~ON_DEMAND);
+   TreeBuilder builder(*this, *this, mode, 0);
+   bool ok;
+
+   if (scanner) {
+      ok = Parser::parse(source, end, mode, *scanner, builder, 0, 0, &rest,
+                         &errorPosition, &errorMessage);
+   } else {
+      ByteScanner byteScanner(source, end);
+      ok = Parser::parse(source, end, mode, byteScanner, builder, 0, 0, &rest,
+                         &errorPosition, &errorMessage);
+   }
+   root_ = builder.root;
+   if (!ok) {
+      if (errorMessage == 0) {
+         return 0;
+      }
+      throw SyntaxError(errorPosition - source + offset, errorMessage);
+   }
+   return rest;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Parses a container that was deferred with ON_DEMAND. Its own nested containers are deferred in
+/// turn. On error, the container keeps the error message.
+void Tree::parseDeferred(Value *container)
+{
+   char *const start = (char *) container->value_;
+   const char *const end = start + container->length_;
+   const bool object = (container->type_ == JOBJECT);
+   container->value_ = 0;
+   container->length_ = 0;
+   container->flags_ = 0;
+
+   // Start inside the container, like a segment of a PARALLEL parse.
+   TreeBuilder builder(*this, *this, mode_, 0);
+   Parser::State<StackEntry> state;
+   state.tos = 0;
+   state.stack[0].obj = container;
+   state.stack[0].tail = &container->value_;
+   state.objects = object ? 1 : 0;
+   if (!object) {
+      builder.packNumbers(container);
+   }
+   state.allowed = object ? Parser::T_CLOSE | Parser::T_KEY
+                          : Parser::T_CLOSE | Parser::T_OPEN | Parser::T_SIMPLE;
+   const char *errorPosition = 0;
+   const char *errorMessage = 0;
+   char *rest = 0;
+   ByteScanner scanner(start + 1, end);
+   if (!Parser::parse(start + 1, end, mode_, scanner, builder, &state, 0, &rest,
+                      &errorPosition, &errorMessage)) {
+      container->value_ = errorMessage;
+      container->length_ = 0;
+      container->flags_ = Value::OBJECT_DEFERRED | Value::OBJECT_INVALID;
+      container->uint_ = errorPosition - source_;
+      throw SyntaxError(container->uint_, errorMessage);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Checks the deferred containers in «v» and its subtree. «source» is the start of the source.
+static void validateDeferred(const Value &v, const char *source)
+{
+   if (v.type_ != JOBJECT && v.type_ != JARRAY) {
+      return;
+   }
+   if (!(v.flags_ & Value::OBJECT_DEFERRED)) {
+      for (const Value *c = (const Value *) v.value_; c != 0; c = c->next_) {
+         validateDeferred(*c, source);
+      }
+      return;
+   }
+   if (v.flags_ & Value::OBJECT_INVALID) {
+      throw SyntaxError(v.uint_, v.value_);
+   }
+   EventHandler handler;
+   EventBuilder<EventHandler> builder(handler);
+   Parser::DefaultScanner scanner(v.value_, v.value_ + v.length_);
+   const char *errorPosition = 0;
+   const char *errorMessage = 0;
+   char *rest = 0;
+   if (!Parser::parse((char *) v.value_, v.value_ + v.length_, ZERO_COPY, scanner, builder, 0, 0,
+                      &rest, &errorPosition, &errorMessage)) {
+      throw SyntaxError(errorPosition - source, errorMessage);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Tree::validate() const
+{
+   if (root_ != 0) {
+      validateDeferred(*root_, source_);
+   }
+}
+
+#if JSON_HAVE_THREADS
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Tree::parseSegment(Segment *segment, const char *end, ParseMode mode)
+{
+   try {
+      reserve((segment->stop ? segment->stop : end) - segment->start);
+      TreeBuilder builder(*this, *segment->owner, mode, segment->open);
+      Parser::State<StackEntry> state;
+      if (segment->open) {
+         // Start after a comma of the root container.
+         const bool object = segment->open->type_ == JOBJECT;
+         state.tos = 0;
+         state.stack[0].obj = segment->open;
+         state.stack[0].tail = &segment->open->value_;
+         state.objects = object ? 1 : 0;
+         state.allowed = object ? Parser::T_KEY : Parser::T_SIMPLE | Parser::T_OPEN;
+      }
+      bool ok;
+      // The scanners read up to the segment's stop, the other segments are being modified.
+      const char *const limit = segment->stop ? segment->stop : end;
+      if (mode & STRUCTURAL_INDEX) {
+         IndexScanner scanner(segment->start, limit);
+         ok = Parser::parse(segment->start, end, mode, scanner, builder, &state, segment->stop, 0,
+                            &segment->errorPosition, &segment->errorMessage);
+      } else {
+         ByteScanner scanner(segment->start, limit);
+         ok = Parser::parse(segment->start, end, mode, scanner, builder, &state, segment->stop, 0,
+                            &segment->errorPosition, &segment->errorMessage);
+      }
+      segment->root = ok ? builder.root : 0;
+      segment->tail = (Value **) state.stack[0].tail;
+   } catch (...) {
+      segment->exception = std::current_exception();
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Parses the document on several threads. Returns false if it cannot be split.
+bool Tree::parseParallel(char *source, const char *end, ParseMode mode)
+{
+   if (end == 0) {
+      end = source + strlen(source);
+   }
+   size_t n = threads_ ? threads_ : std::thread::hardware_concurrency();
+   n = std::min(n, (size_t) (end - source) / std::max(minSegment_, (size_t) 1));
+   if (n < 2) {
+      return false;
+   }
+   std::vector<const char *> splits(n - 1);
+   const int found = findSplits(source, end, &splits[0], (int) n - 1);
+   if (found == 0) {
+      return false;
+   }
+
+   // The first segment opens the root container and is parsed into this Tree, the others
+   // append to a stand-in in their own Tree.
+   root_ = 0;
+   std::vector<Segment> segments(found + 1);
+   const char *first = source;
+   while (IS_SPACE(*first)) {
+      ++first;
+   }
+   const Type rootType = (*first == '{') ? JOBJECT : JARRAY;
+   for (int i = 0; i <= found; ++i) {
+      Segment &segment = segments[i];
+      segment.arena.allocator_ = allocator_;
+      segment.arena.dictionary_ = dictionary_;
+      segment.owner = this;
+      segment.start = i == 0 ? source : (char *) splits[i - 1] + 1;
+      segment.stop = i < found ? splits[i] : 0;
+      segment.open = 0;
+      segment.tail = 0;
+      segment.root = 0;
+      segment.errorPosition = 0;
+      segment.errorMessage = 0;
+      if (i > 0) {
+         Value &container = segment.container;
+         container.name_ = ANONYMOUS;
+         container.nameLength_ = 0;
+         container.value_ = 0;
+         container.next_ = 0;
+         container.length_ = 0;
+         container.type_ = rootType;
+         container.flags_ = 0;
+         segment.open = &container;
+      }
+   }
+
+   // Share the memory retained by reset() in proportion to the segment lengths, largest chunks
+   // first, each to the segment with the largest unmet share.
+   size_t retained = 0;
+   for (const Chunk *c = spare_; c != 0; c = c->next_) {
+      retained += c->size_;
+   }
+   std::vector<double> share(found + 1);
+   for (int i = 0; i <= found; ++i) {
+      const char *stop = segments[i].stop ? segments[i].stop : end;
+      share[i] = (double) retained * (stop - segments[i].start) / (end - source);
+   }
+   for (Chunk **c = &spare_; *c != 0; ) {
+      int best = 0;
+      for (int i = 1; i <= found; ++i) {
+         if (share[i] > share[best]) {
+            best = i;
+         }
+      }
+      Chunk *chunk = *c;
+      share[best] -= chunk->size_;
+      if (best == 0) {
+         c = &chunk->next_;
+      } else {
+         *c = chunk->next_;
+         chunk->next_ = segments[best].arena.spare_;
+         segments[best].arena.spare_ = chunk;
+      }
+   }
+
+   // The segments modify disjoint parts of the source, see parseSegment().
+   std::vector<std::thread> workers;
+   for (int i = 1; i <= found; ++i) {
+      try {
+         workers.push_back(std::thread(&Tree::parseSegment, &segments[i].arena, &segments[i],
+                                       end, mode));
+      } catch (const std::system_error &) {
+         segments[i].arena.parseSegment(&segments[i], end, mode);
+      }
+   }
+   parseSegment(&segments[0], end, mode);
+   for (size_t i = 0; i < workers.size(); ++i) {
+      workers[i].join();
+   }
+
+   // Report the first error, which is the one a serial parse would find.
+   for (int i = 0; i <= found; ++i) {
+      if (segments[i].exception) {
+         std::rethrow_exception(segments[i].exception);
+      }
+      if (segments[i].root == 0) {
+         throw SyntaxError(segments[i].errorPosition - source, segments[i].errorMessage);
+      }
+   }
+
+   // Link the elements and take over the memory of the other segments.
+   Value *root = segments[0].root;
+   for (int i = 1; i <= found; ++i) {
+      *segments[i - 1].tail = (Value *) segments[i].container.value_;
+      root->length_ += segments[i].container.length_;
+      Tree &arena = segments[i].arena;
+      if (arena.head_ != 0) {
+         Chunk *last = arena.head_;
+         while (last->next_ != 0) {
+            last = last->next_;
+         }
+         last->next_ = head_->next_;
+         head_->next_ = arena.head_;
+         arena.head_ = 0;
+      }
+      while (arena.spare_ != 0) {
+         Chunk *chunk = arena.spare_;
+         arena.spare_ = chunk->next_;
+         chunk->next_ = spare_;
+         spare_ = chunk;
+      }
+   }
+   if (mode & (INDEX_OBJECTS | INDEX_ARRAYS | LAZY_INDEX | SHAPE_OBJECTS)) {
+      indexContainer(*this, *this, root, mode);
+   }
+   root_ = root;
+   return true;
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Tree::Chunk *Tree::newChunk(size_t size)
+{
+   Chunk *chunk = (Chunk*) (allocator_ ? allocator_->allocate(size) : ::malloc(size));
+   if (chunk == 0) {
+      throw std::runtime_error("OOM");
+   }
+   chunk->eofs_ = (char*) chunk + size;
+   chunk->size_ = size;
+   return chunk;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Tree::Chunk *Tree::takeSpare(size_t size)
+{
+   // Best fit
+   Chunk **best = 0;
+   for (Chunk **c = &spare_; *c != 0; c = &(*c)->next_) {
+      if ((*c)->size_ >= size && (best == 0 || (*c)->size_ < (*best)->size_)) {
+         best = c;
+      }
+   }
+   if (best == 0) {
+      return 0;
+   }
+   Chunk *chunk = *best;
+   *best = chunk->next_;
+   return chunk;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+char *Tree::malloc(size_t size)
+{
+   size = ROUND_UP(size);
+
+   if (head_ == 0 || head_->eofs_ < (char*) head_ + sizeof(Chunk) + size) {
+      // Insufficient free space, use a spare chunk or allocate a new one.
+      const size_t needed = sizeof(Chunk) + size;
+      Chunk *chunk = takeSpare(needed);
+      if (chunk == 0) {
+         if (needed > chunkSize_ && head_ != 0) {
+            // Large block: give it a chunk of its own behind the current one, which keeps
+            // serving small blocks.
+            chunk = newChunk(needed);
+            chunk->next_ = head_->next_;
+            head_->next_ = chunk;
+            return chunk->eofs_ -= size;
+         }
+         chunk = newChunk(std::max(needed, chunkSize_));
+         chunkSize_ = std::max(chunkSize_, std::min(2 * chunkSize_, MAX_BLOCK_SIZE));
+      }
+      chunk->next_ = head_;
+      head_ = chunk;
+   }
+
+   // Allocate from current chunk.
+   return head_->eofs_ -= size;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Tree::reserve(size_t size)
+{
+   size = ROUND_UP(size);
+   if (head_ == 0 || head_->eofs_ < (char*) head_ + sizeof(Chunk) + size) {
+      Chunk *chunk = takeSpare(sizeof(Chunk) + size);
+      if (chunk == 0) {
+         chunk = newChunk(sizeof(Chunk) + size);
+      }
+      chunk->next_ = head_;
+      head_ = chunk;
+      // A one-off, the chunks after it keep growing from chunkSize_.
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Tree::freeChunks(Chunk *c)
+{
+   while (c) {
+      Chunk *next = c->next_;
+      if (c != inline_) {
+         if (allocator_) {
+            allocator_->deallocate(c, c->size_);
+         } else {
+            ::free(c);
+         }
+      }
+      c = next;
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Tree::useBuffer(void *buffer, size_t size)
+{
+   char *start = (char*) ROUND_UP((uintptr_t) buffer);
+   if (size < (size_t) (start - (char*) buffer) + sizeof(Chunk)) {
+      return;
+   }
+   size = (size - (start - (char*) buffer)) / ALIGNMENT * ALIGNMENT;
+   inline_ = (Chunk*) start;
+   inline_->eofs_ = start + size;
+   inline_->size_ = size;
+   inline_->next_ = 0;
+   head_ = inline_;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Tree::clear()
+{
+   reset(0);
+   chunkSize_ = BLOCK_SIZE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Tree::reset(size_t maxRetained)
+{
+   unmapFiles();
+   keys_ = 0;
+   shapes_ = 0;
+
+   // Collect all chunks.
+   Chunk *all = spare_;
+   while (head_) {
+      Chunk *c = head_;
+      head_ = c->next_;
+      c->next_ = all;
+      all = c;
+   }
+   spare_ = 0;
+   root_ = 0;
+
+   // Keep the largest chunks, in descending order of size.
+   Chunk **tail = &spare_;
+   size_t retained = 0;
+   while (all) {
+      Chunk **largest = &all;
+      for (Chunk **c = &all; *c != 0; c = &(*c)->next_) {
+         if ((*c)->size_ > (*largest)->size_) {
+            largest = c;
+         }
+      }
+      Chunk *chunk = *largest;
+      *largest = chunk->next_;
+      if (chunk == inline_ || retained + chunk->size_ <= maxRetained) {
+         retained += (chunk == inline_) ? 0 : chunk->size_;
+         chunk->eofs_ = (char*) chunk + chunk->size_;
+         chunk->next_ = 0;
+         *tail = chunk;
+         tail = &chunk->next_;
+      } else {
+         chunk->next_ = 0;
+         freeChunks(chunk);
+      }
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t Tree::capacity() const
+{
+   size_t n = 0;
+   for (const Chunk *c = head_; c != 0; c = c->next_) {
+      n += c->size_;
+   }
+   for (const Chunk *c = spare_; c != 0; c = c->next_) {
+      n += c->size_;
+   }
+   return n;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Tree::~Tree()
+{
+   unmapFiles();
+   freeChunks(head_);
+   freeChunks(spare_);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Tree::Tree()
+   : head_(0), spare_(0), root_(0), chunkSize_(BLOCK_SIZE), allocator_(0), inline_(0),
+     threads_(0), minSegment_(MIN_SEGMENT_SIZE), source_(0), mode_(NON_DESTRUCTIVE),
+     projection_(0), mappings_(0), keys_(0), dictionary_(0), shapes_(0)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Tree::Tree(Allocator &allocator)
+   : head_(0), spare_(0), root_(0), chunkSize_(BLOCK_SIZE), allocator_(&allocator), inline_(0),
+     threads_(0), minSegment_(MIN_SEGMENT_SIZE), source_(0), mode_(NON_DESTRUCTIVE),
+     projection_(0), mappings_(0), keys_(0), dictionary_(0), shapes_(0)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Tree::Tree(void *buffer, size_t size)
+   : head_(0), spare_(0), root_(0), chunkSize_(BLOCK_SIZE), allocator_(0), inline_(0),
+     threads_(0), minSegment_(MIN_SEGMENT_SIZE), source_(0), mode_(NON_DESTRUCTIVE),
+     projection_(0), mappings_(0), keys_(0), dictionary_(0), shapes_(0)
+{
+   useBuffer(buffer, size);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Tree::Tree(void *buffer, size_t size, Allocator &allocator)
+   : head_(0), spare_(0), root_(0), chunkSize_(BLOCK_SIZE), allocator_(&allocator), inline_(0),
+     threads_(0), minSegment_(MIN_SEGMENT_SIZE), source_(0), mode_(NON_DESTRUCTIVE),
+     projection_(0), mappings_(0), keys_(0), dictionary_(0), shapes_(0)
+{
+   useBuffer(buffer, size);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Tree::Tree(char *source, ParseMode mode)
+   : head_(0), spare_(0), root_(0), chunkSize_(BLOCK_SIZE), allocator_(0), inline_(0),
+     threads_(0), minSegment_(MIN_SEGMENT_SIZE), source_(0), mode_(NON_DESTRUCTIVE),
+     projection_(0), mappings_(0), keys_(0), dictionary_(0), shapes_(0)
+{
+   try {
+      parse(source, mode);
+   } catch (...) {
+      // The destructor does not run if the constructor throws.
+      freeChunks(head_);
+      freeChunks(spare_);
+      throw;
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Tree::Tree(const char *source )
+   : head_(0), spare_(0), root_(0), chunkSize_(BLOCK_SIZE), allocator_(0), inline_(0),
+     threads_(0), minSegment_(MIN_SEGMENT_SIZE), source_(0), mode_(NON_DESTRUCTIVE),
+     projection_(0), mappings_(0), keys_(0), dictionary_(0), shapes_(0)
+{
+   try {
+      parse(source);
+   } catch (...) {
+      freeChunks(head_);
+      freeChunks(spare_);
+      throw;
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Tree::Tree(const std::string &source)
+   : head_(0), spare_(0), root_(0), chunkSize_(BLOCK_SIZE), allocator_(0), inline_(0),
+     threads_(0), minSegment_(MIN_SEGMENT_SIZE), source_(0), mode_(NON_DESTRUCTIVE),
+     projection_(0), mappings_(0), keys_(0), dictionary_(0), shapes_(0)
+{
+   try {
+      parse(source);
+   } catch (...) {
+      freeChunks(head_);
+      freeChunks(spare_);
+      throw;
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Tree::parse(char *source, ParseMode mode)
+{
+   if (mode & (DESTRUCTIVE | ZERO_COPY)) {
+      parseInternal(source, 0, mode);
+   } else {
+      parse((const char *) source, strlen(source), mode);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Tree::parse(const char *source)
+{
+   parse(source, strlen(source), NON_DESTRUCTIVE);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Tree::parse(const char *source, ParseMode mode)
+{
+   if (mode & ZERO_COPY) {
+      parseInternal((char *) source, 0, mode);
+   } else {
+      parse(source, strlen(source), mode);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Tree::parse(const std::string& source)
+{
+   parse(source.data(), source.size(), NON_DESTRUCTIVE);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Tree::parse(const char *source, size_t length, ParseMode mode)
+{
+   if ((mode & ZERO_COPY) && (mode & PADDED) && source[length] == 0) {
+      reserveSource(length, mode);
+      parseInternal((char *) source, source + length, mode);
+      return;
+   }
+   // No reserve(), the copy already takes the source length from the arena.
+   char *workingBuffer = malloc(length + PADDING);
+   memcpy(workingBuffer, source, length);
+   memset(workingBuffer + length, 0, PADDING);
+   parseInternal(workingBuffer, workingBuffer + length, mode);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Tree::parse(char *source, size_t length, ParseMode mode)
+{
+   if ((mode & DESTRUCTIVE) && (mode & PADDED)) {
+      source[length] = 0;
+      reserveSource(length, mode);
+      parseInternal(source, source + length, mode);
+   } else {
+      parse((const char *) source, length, mode);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Tree::parse(const char *source, const Projection &projection, ParseMode mode)
+{
+   projection_ = &projection;
+   try {
+      parse(source, mode);
+   } catch (...) {
+      projection_ = 0;
+      throw;
+   }
+   projection_ = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Tree::parse(const char *source, size_t length, const Projection &projection, ParseMode mode)
+{
+   projection_ = &projection;
+   try {
+      parse(source, length, mode);
+   } catch (...) {
+      projection_ = 0;
+      throw;
+   }
+   projection_ = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Files
+
+/// Files smaller than this are read into the Tree, mapping them costs more than copying.
+static const size_t MIN_MAPPED_FILE = 64 << 10;
+
+/// A file mapped by Tree::parseFile(), kept in the Tree's memory.
+struct Tree::Mapping {
+   void *address;
+   size_t size;
+   Mapping *next;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Tree::unmapFiles()
+{
+#if JSON_HAVE_MMAP
+   for (Mapping *m = mappings_; m != 0; m = m->next) {
+      munmap(m->address, m->size);
+   }
+#endif
+   mappings_ = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Throws std::runtime_error for «path» with the message for «error».
+static void throwFileError(const char *what, const char *path, int error)
+{
+   throw std::runtime_error(std::string(what) + " " + path + ": " + strerror(error));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Tree::parseFile(const char *path, ParseMode mode)
+{
+   // The source is ours, so it can always be parsed in place.
+   mode = (ParseMode) (mode | PADDED | ((mode & ZERO_COPY) ? 0 : DESTRUCTIVE));
+   std::string contents;
+   char *buffer;
+   size_t length;
+
+#if JSON_HAVE_MMAP
+   const int fd = open(path, O_RDONLY);
+   if (fd < 0) {
+      throwFileError("cannot open", path, errno);
+   }
+   struct stat st;
+   if (fstat(fd, &st) != 0) {
+      const int error = errno;
+      close(fd);
+      throwFileError("cannot read", path, error);
+   }
+   if (!S_ISREG(st.st_mode)) {
+      // Pipes and devices have no size, read them to the end.
+      char block[65536];
+      ssize_t n;
+      while ((n = read(fd, block, sizeof(block))) > 0 || (n < 0 && errno == EINTR)) {
+         contents.append(block, n > 0 ? n : 0);
+      }
+      const int error = errno;
+      close(fd);
+      if (n < 0) {
+         throwFileError("cannot read", path, error);
+      }
+      parse(contents.data(), contents.size(),
+            (ParseMode) (mode & ~(DESTRUCTIVE | ZERO_COPY | PADDED)));
+      return;
+   }
+   length = st.st_size;
+   if (length >= MIN_MAPPED_FILE) {
+      // Reserve room for the padding first, then map the file over the beginning. The rest of
+      // the last page of the file and the following pages are zero, so the source is
+      // NUL-terminated and padded.
+      const size_t page = sysconf(_SC_PAGESIZE);
+      const size_t size = (length + PADDING + page - 1) / page * page;
+      const int protection = (mode & ZERO_COPY) ? PROT_READ : PROT_READ | PROT_WRITE;
+      Mapping *mapping = (Mapping*) malloc(sizeof(Mapping));
+      void *address = mmap(0, size, protection, MAP_PRIVATE | MAP_ANON, -1, 0);
+      int error = errno;
+      if (address != MAP_FAILED &&
+          mmap(address, length, protection, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+         error = errno;
+         munmap(address, size);
+         address = MAP_FAILED;
+      }
+      close(fd);
+      if (address == MAP_FAILED) {
+         throwFileError("cannot map", path, error);
+      }
+      mapping->address = address;
+      mapping->size = size;
+      mapping->next = mappings_;
+      mappings_ = mapping;
+#ifdef MADV_SEQUENTIAL
+      madvise(address, length, MADV_SEQUENTIAL);
+#endif
+#ifdef MADV_WILLNEED
+      // Start reading the file ahead. Unlike MAP_POPULATE, this does not copy the pages of a
+      // writable mapping, they are only copied when the parser writes to them.
+      madvise(address, length, MADV_WILLNEED);
+#endif
+      reserveSource(length, mode);
+      parseInternal((char*) address, (char*) address + length, mode);
+      return;
+   }
+   buffer = malloc(length + PADDING);
+   size_t done = 0;
+   while (done < length) {
+      const ssize_t n = read(fd, buffer + done, length - done);
+      if (n <= 0 && !(n < 0 && errno == EINTR)) {
+         const int error = n < 0 ? errno : EIO;
+         close(fd);
+         throwFileError("cannot read", path, error);
+      }
+      done += n > 0 ? n : 0;
+   }
+   close(fd);
+#else
+   FILE *f = fopen(path, "rb");
+   if (f == 0) {
+      throwFileError("cannot open", path, errno);
+   }
+   char block[65536];
+   size_t n;
+   while ((n = fread(block, 1, sizeof(block), f)) > 0) {
+      contents.append(block, n);
+   }
+   const int error = ferror(f) ? errno : 0;
+   fclose(f);
+   if (error != 0) {
+      throwFileError("cannot read", path, error);
+   }
+   length = contents.size();
+   buffer = malloc(length + PADDING);
+   memcpy(buffer, contents.data(), length);
+#endif
+   memset(buffer + length, 0, PADDING);
+   parseInternal(buffer, buffer + length, mode);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+const Value& Tree::root() const
+{
+   if (root_ == 0) {
+      throw std::runtime_error("empty JSON document");
+   }
+   return *root_;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Returns a NUL-terminated and padded copy of the source.
+static char *copySource(const char *source, size_t length)
+{
+   char *copy = (char *) ::malloc(length + PADDING);
+   if (copy == 0) {
+      throw std::runtime_error("OOM");
+   }
+   memcpy(copy, source, length);
+   memset(copy + length, 0, PADDING);
+   return copy;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+DocumentStream::DocumentStream(const char *source, ParseMode mode)
+   : buffer_(0), base_(0), next_(0), end_(0), mode_(mode), scanner_(0), offset_(0), length_(0)
+{
+   if (mode & ZERO_COPY) {
+      init((char *) source, 0, mode);
+   } else {
+      const size_t length = strlen(source);
+      buffer_ = copySource(source, length);
+      init(buffer_, buffer_ + length, mode);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+DocumentStream::DocumentStream(char *source, ParseMode mode)
+   : buffer_(0), base_(0), next_(0), end_(0), mode_(mode), scanner_(0), offset_(0), length_(0)
+{
+   if (mode & (DESTRUCTIVE | ZERO_COPY)) {
+      init(source, 0, mode);
+   } else {
+      const size_t length = strlen(source);
+      buffer_ = copySource(source, length);
+      init(buffer_, buffer_ + length, mode);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+DocumentStream::DocumentStream(const char *source, size_t length, ParseMode mode)
+   : buffer_(0), base_(0), next_(0), end_(0), mode_(mode), scanner_(0), offset_(0), length_(0)
+{
+   if ((mode & ZERO_COPY) && (mode & PADDED) && source[length] == 0) {
+      init((char *) source, source + length, mode);
+   } else {
+      buffer_ = copySource(source, length);
+      init(buffer_, buffer_ + length, mode);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+DocumentStream::DocumentStream(char *source, size_t length, ParseMode mode)
+   : buffer_(0), base_(0), next_(0), end_(0), mode_(mode), scanner_(0), offset_(0), length_(0)
+{
+   if ((mode & DESTRUCTIVE) && (mode & PADDED)) {
+      source[length] = 0;
+      init(source, source + length, mode);
+   } else if ((mode & ZERO_COPY) && (mode & PADDED) && source[length] == 0) {
+      init(source, source + length, mode);
+   } else {
+      buffer_ = copySource(source, length);
+      init(buffer_, buffer_ + length, mode);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void DocumentStream::init(char *source, const char *end, ParseMode mode)
+{
+   base_ = next_ = source;
+   end_ = end;
+   if (mode & STRUCTURAL_INDEX) {
+      try {
+         scanner_ = new IndexScanner(source, end);
+      } catch (...) {
+         ::free(buffer_);
+         throw;
+      }
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+DocumentStream::~DocumentStream()
+{
+   delete scanner_;
+   ::free(buffer_);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool DocumentStream::next(Tree &tree, bool reset)
+{
+   if (next_ == 0) {
+      return false;
+   }
+   char *s = next_;
+   while (IS_SPACE(*s)) {
+      ++s;
+   }
+   next_ = 0;
+   if (*s == 0 && (end_ == 0 || s >= end_)) {
+      return false;
+   }
+   if (reset) {
+      tree.reset();
+   }
+   char *rest = tree.parseNext(s, end_, mode_, scanner_, s - base_);
+   if (rest == 0) {
+      return false;
+   }
+   offset_ = s - base_;
+   length_ = rest - s;
+   next_ = rest;
+   return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// parseLines(). Block i holds the lines starting in [i * blockSize_, (i + 1) * blockSize_). Each
+// worker owns a range of blocks and takes them in order. When its range is empty, it steals the
+// first half of another worker's remaining range. With «ordered», each block is parsed into a
+// Tree of its own and delivered when all blocks before it have been delivered. At most «window_»
+// blocks are parsed ahead.
+
+class Json::LineParser {
+   struct Block {
+      Tree tree;
+      std::vector<char> text;           // the Values point into it
+      std::vector<const Value *> roots;
+      std::vector<size_t> offsets;
+#if JSON_HAVE_THREADS
+      std::exception_ptr error;
+#endif
+   };
+
+   const char *const source_;
+   const size_t length_;
+   DocumentHandler &handler_;
+   const ParseMode mode_;
+   const bool ordered_;
+   size_t blockSize_;
+   size_t blocks_;
+   size_t index_;                       // documents delivered, with «ordered»
+
+   LineParser(const LineParser &);      // not implemented
+   void operator=(const LineParser &);  // not implemented
+
+   size_t lineStart(size_t pos) const;
+   void parseBlock(size_t i, Tree &tree, std::vector<char> &buffer, Block *block);
+   void deliver(Block *block);
+
+#if JSON_HAVE_THREADS
+   struct Range {
+      std::mutex mutex;
+      size_t begin;
+      size_t end;
+   };
+
+   std::vector<Range> ranges_;
+   std::mutex mutex_;                   // protects the following members
+   std::condition_variable delivered_;
+   std::vector<Block *> pending_;       // parsed, not yet delivered blocks
+   std::vector<Block *> free_;
+   size_t next_;                        // next block to deliver
+   bool delivering_;
+   size_t window_;
+   size_t errorBlock_;
+   std::exception_ptr error_;
+
+   bool take(unsigned worker, size_t &i);
+   void fail(size_t i, std::exception_ptr error);
+   void work(unsigned worker);
+   void parseOrdered(size_t i);
+#endif
+
+public:
+   LineParser(const char *source, size_t length, DocumentHandler &handler, ParseMode mode,
+              bool ordered);
+   void run(unsigned threads);
+};
+
+LineParser::LineParser(const char *source, size_t length, DocumentHandler &handler,
+                       ParseMode mode, bool ordered)
+   : source_(source), length_(length), handler_(handler),
+     mode_((ParseMode) ((mode & ~(ZERO_COPY | STRUCTURAL_INDEX | PARALLEL | ON_DEMAND))
+                        | DESTRUCTIVE)),
+     ordered_(ordered), blockSize_(length + 1), blocks_(1), index_(0)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Returns the start of the first line at or after «pos».
+size_t LineParser::lineStart(size_t pos) const
+{
+   if (pos == 0 || pos >= length_) {
+      return std::min(pos, length_);
+   }
+   const char *nl = (const char *) memchr(source_ + pos - 1, '\n', length_ - pos + 1);
+   return nl ? nl - source_ + 1 : length_;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Parses block «i» in a copy in «buffer». Delivers the documents or, with «block», collects them
+/// in block->tree; «buffer» must be block->text then.
+void LineParser::parseBlock(size_t i, Tree &tree, std::vector<char> &buffer, Block *block)
+{
+   // The block starts with the first line start in its range, if any. Searching no further
+   // keeps the cost linear when a single line spans many blocks.
+   const size_t from = i * blockSize_;
+   size_t start = 0;
+   if (i > 0) {
+      const size_t n = std::min(blockSize_, length_ - from + 1);
+      const char *nl = (const char *) memchr(source_ + from - 1, '\n', n);
+      if (nl == 0) {
+         return;
+      }
+      start = nl - source_ + 1;
+   }
+   const size_t end = lineStart(from + blockSize_);
+   if (start >= end) {
+      return;
+   }
+
+   buffer.assign(source_ + start, source_ + end);
+   buffer.resize(end - start + PADDING, 0);
+   char *const base = &buffer[0];
+   char *const last = base + (end - start);
+   for (char *line = base; line < last; ) {
+      char *nl = (char *) memchr(line, '\n', last - line);
+      if (nl == 0) {
+         nl = last;
+      }
+      *nl = 0;
+      char *s = line;
+      while (true) {
+         while (IS_SPACE(*s)) {
+            ++s;
+         }
+         if (s >= nl) {
+            break;
+         }
+         if (block == 0) {
+            tree.reset();
+         }
+         const size_t offset = start + (s - base);
+         char *rest = tree.parseNext(s, nl, mode_, 0, offset);
+         if (rest == 0) {
+            break;
+         }
+         if (block) {
+            block->roots.push_back(tree.root_);
+            block->offsets.push_back(offset);
+         } else {
+            handler_.document(*tree.root_, offset, ordered_ ? index_++ : (size_t) -1);
+         }
+         s = rest;
+      }
+      line = nl + 1;
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void LineParser::deliver(Block *block)
+{
+   for (size_t k = 0; k < block->roots.size(); ++k) {
+      handler_.document(*block->roots[k], block->offsets[k], index_++);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void LineParser::run(unsigned threads)
+{
+#if JSON_HAVE_THREADS
+   if (threads == 0) {
+      threads = std::max(std::thread::hardware_concurrency(), 1u);
+   }
+   if (threads > 1) {
+      // About 16 blocks per thread for load balancing, but not too small or too large.
+      blockSize_ = std::max((size_t) 4096, std::min(length_ / threads / 16, (size_t) 1 << 20));
+      blocks_ = length_ / blockSize_ + 1;
+      threads = (unsigned) std::min((size_t) threads, blocks_);
+   }
+   if (threads > 1) {
+      ranges_ = std::vector<Range>(threads);
+      for (unsigned w = 0; w < threads; ++w) {
+         ranges_[w].begin = blocks_ * w / threads;
+         ranges_[w].end = blocks_ * (w + 1) / threads;
+      }
+      pending_.assign(blocks_, 0);
+      next_ = 0;
+      delivering_ = false;
+      window_ = 4 * threads;
+      errorBlock_ = blocks_;
+
+      std::vector<std::thread> workers;
+      for (unsigned w = 1; w < threads; ++w) {
+         try {
+            workers.push_back(std::thread(&LineParser::work, this, w));
+         } catch (const std::system_error &) {
+            // The other workers steal this worker's blocks.
+         }
+      }
+      work(0);
+      for (size_t w = 0; w < workers.size(); ++w) {
+         workers[w].join();
+      }
+      for (size_t k = 0; k < free_.size(); ++k) {
+         delete free_[k];
+      }
+      for (size_t k = 0; k < pending_.size(); ++k) {
+         delete pending_[k];
+      }
+      if (error_) {
+         std::rethrow_exception(error_);
+      }
+      return;
+   }
+#endif
+   (void) threads;
+   Tree tree;
+   std::vector<char> buffer;
+   parseBlock(0, tree, buffer, 0);
+}
+
+#if JSON_HAVE_THREADS
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Takes the next block of «worker», stealing if necessary. Returns false if there is none.
+bool LineParser::take(unsigned worker, size_t &i)
+{
+   Range &own = ranges_[worker];
+   {
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (own.begin < own.end) {
+         i = own.begin++;
+         return true;
+      }
+   }
+   const unsigned n = (unsigned) ranges_.size();
+   for (unsigned k = 1; k < n; ++k) {
+      Range &victim = ranges_[(worker + k) % n];
+      size_t begin;
+      size_t end;
+      {
+         std::lock_guard<std::mutex> lock(victim.mutex);
+         if (victim.begin >= victim.end) {
+            continue;
+         }
+         begin = victim.begin;
+         end = begin + (victim.end - victim.begin + 1) / 2;
+         victim.begin = end;
+      }
+      std::lock_guard<std::mutex> lock(own.mutex);
+      i = begin;
+      own.begin = begin + 1;
+      own.end = end;
+      return true;
+   }
+   return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Records an error in block «i». The first one in source order is reported.
+void LineParser::fail(size_t i, std::exception_ptr error)
+{
+   std::lock_guard<std::mutex> lock(mutex_);
+   if (i < errorBlock_) {
+      errorBlock_ = i;
+      error_ = error;
+   }
+   delivered_.notify_all();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void LineParser::work(unsigned worker)
+{
+   Tree tree;
+   std::vector<char> buffer;
+   size_t i;
+   while (take(worker, i)) {
+      {
+         std::lock_guard<std::mutex> lock(mutex_);
+         if (i > errorBlock_) {
+            continue;
+         }
+      }
+      if (ordered_) {
+         parseOrdered(i);
+      } else {
+         try {
+            parseBlock(i, tree, buffer, 0);
+         } catch (...) {
+            fail(i, std::current_exception());
+         }
+      }
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void LineParser::parseOrdered(size_t i)
+{
+   Block *block;
+   {
+      // The block to be delivered next never waits, so there is always progress.
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (i >= next_ + window_ && i < errorBlock_) {
+         delivered_.wait(lock);
+      }
+      if (i > errorBlock_) {
+         return;
+      }
+      if (free_.empty()) {
+         block = new Block;
+      } else {
+         block = free_.back();
+         free_.pop_back();
+      }
+   }
+   try {
+      parseBlock(i, block->tree, block->text, block);
+   } catch (...) {
+      block->error = std::current_exception();
+   }
+
+   std::unique_lock<std::mutex> lock(mutex_);
+   pending_[i] = block;
+   if (delivering_) {
+      return;
+   }
+   delivering_ = true;
+   while (next_ < blocks_ && next_ <= errorBlock_ && pending_[next_] != 0) {
+      Block *ready = pending_[next_];
+      pending_[next_] = 0;
+      lock.unlock();
+      try {
+         deliver(ready);
+      } catch (...) {
+         if (!ready->error) {
+            ready->error = std::current_exception();
+         }
+      }
+      lock.lock();
+      if (ready->error && next_ < errorBlock_) {
+         errorBlock_ = next_;
+         error_ = ready->error;
+      }
+      ready->tree.reset();
+      ready->roots.clear();
+      ready->offsets.clear();
+      ready->error = std::exception_ptr();
+      free_.push_back(ready);
+      ++next_;
+      delivered_.notify_all();
+   }
+   delivering_ = false;
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Json::parseLines(const char *source, size_t length, DocumentHandler &handler,
+                      ParseMode mode, unsigned threads, bool ordered)
+{
+   LineParser parser(source, length, handler, mode, ordered);
+   parser.run(threads);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// PushParser. feed() appends the text to «buffer_» and tracks strings and comments to find the
+// last structural character outside of them. The text up to this character contains only
+// complete tokens and is parsed right away. The rest is kept for the next feed() or finish().
+// If the buffer is full, the unparsed rest is moved to a new, larger buffer; the Values keep
+// pointing into the old one.
+
+/// Scans «s» to «end» starting in «state». Sets «*complete» after the last structural character
+/// outside of strings and comments, if any, and returns the state at «end».
+static unsigned scanCompleteBytes(const char *s, const char *end, unsigned state, const char **complete)
+{
+   for (; s < end; ++s) {
+      const char c = *s;
+      switch (state) {
+         case LEX_STRING:
+            state = (c == '"') ? 0 : (c == '\\') ? LEX_ESCAPE : LEX_STRING;
+            break;
+         case LEX_ESCAPE:
+            state = LEX_STRING;
+            break;
+         case LEX_LINE_COMMENT:
+            state = (c == '\n') ? 0 : LEX_LINE_COMMENT;
+            break;
+         case LEX_BLOCK_COMMENT:
+            state = (c == '*') ? LEX_STAR : LEX_BLOCK_COMMENT;
+            break;
+         case LEX_STAR:
+            state = (c == '/') ? 0 : (c == '*') ? LEX_STAR : LEX_BLOCK_COMMENT;
+            break;
+         default:
+            if (state == LEX_SLASH && (c == '/' || c == '*')) {
+               state = (c == '/') ? LEX_LINE_COMMENT : LEX_BLOCK_COMMENT;
+               break;
+            }
+            if (state == LEX_BACKSLASH && (c == '"' || c == '\\')) {
+               state = 0;
+               break;
+            }
+            state = 0;
+            if (c == '"') {
+               state = LEX_STRING;
+            } else if (c == '/') {
+               state = LEX_SLASH;
+            } else if (c == '\\') {
+               state = LEX_BACKSLASH;
+            } else if (c == '{' || c == '}' || c == '[' || c == ']' || c == ',' || c == ':') {
+               *complete = s + 1;
+            }
+      }
+   }
+   return state;
+}
+
+/// Like scanCompleteBytes(), but classifies whole 64 byte blocks at once. Blocks with comments
+/// and partial blocks at either end are scanned byte by byte.
+static unsigned scanComplete(const char *s, const char *end, unsigned state, const char **complete)
+{
+   const char *p = (const char *) (((uintptr_t) s + 63) & ~(uintptr_t) 63);
+   if (p >= end) {
+      return scanCompleteBytes(s, end, state, complete);
+   }
+   state = scanCompleteBytes(s, p, state, complete);
+   for (; end - p >= 64; p += 64) {
+      if (state == 0 || state == LEX_BACKSLASH || state == LEX_STRING || state == LEX_ESCAPE) {
+         BlockMasks m;
+         classify(p, m);
+         const bool inString = (state == LEX_STRING || state == LEX_ESCAPE);
+         uint64_t escaped = (state == LEX_ESCAPE || state == LEX_BACKSLASH);
+         const uint64_t quote = m.quote & ~findEscaped(m.backslash, escaped);
+         const uint64_t inside = prefixXor(quote) ^ (inString ? ~(uint64_t) 0 : 0);
+         if ((m.slash & ~inside) == 0) {
+            const uint64_t structural = m.structural & ~inside;
+            if (structural != 0) {
+               *complete = p + 64 - __builtin_clzll(structural);
+            }
+            state = (inside >> 63) != 0 ? (escaped ? LEX_ESCAPE : LEX_STRING)
+                                        : (escaped ? LEX_BACKSLASH : 0);
+            continue;
+         }
+      }
+      state = scanCompleteBytes(p, p + 64, state, complete);
+   }
+   return scanCompleteBytes(p, end, state, complete);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PushParser::PushParser(Tree &tree, ParseMode mode)
+   : tree_(tree),
+     mode_((ParseMode) ((mode & ~(ZERO_COPY | STRUCTURAL_INDEX | PARALLEL | ON_DEMAND
+                                  | PACK_NUMBERS)) | DESTRUCTIVE)),
+     state_(0), buffer_(0), capacity_(0), used_(0), parsed_(0), complete_(0), offset_(0),
+     lexState_(0)
+{
+   tree_.reset();
+   state_ = new (tree_.malloc(sizeof(Tree::PushState))) Tree::PushState;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void PushParser::feed(const char *data, size_t length)
+{
+   if (used_ + length > capacity_) {
+      // Move the unparsed rest to a new buffer. Its size grows with the rest, so a long token
+      // fed in small pieces is copied only a few times.
+      const size_t rest = used_ - parsed_;
+      size_t capacity = 2 * (rest + length);
+      capacity = capacity > capacity_ ? capacity : capacity_;
+      capacity = capacity > 4096 ? capacity : 4096;
+      char *buffer = tree_.malloc(capacity + PADDING);
+      if (rest > 0) {
+         memcpy(buffer, buffer_ + parsed_, rest);
+      }
+      offset_ += parsed_;
+      complete_ -= parsed_;
+      used_ = rest;
+      parsed_ = 0;
+      buffer_ = buffer;
+      capacity_ = capacity;
+   }
+   memcpy(buffer_ + used_, data, length);
+   const char *complete = buffer_ + complete_;
+   lexState_ = scanComplete(buffer_ + used_, buffer_ + used_ + length, lexState_, &complete);
+   used_ += length;
+   complete_ = complete - buffer_;
+   if (complete_ > parsed_) {
+      parse(complete_, true);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+const Value& PushParser::finish()
+{
+   if (buffer_ == 0) {
+      feed("", 0);
+   }
+   parse(used_, false);
+   if (tree_.root_ == 0) {
+      throw SyntaxError(offset_ + used_, "empty JSON document");
+   }
+   return *tree_.root_;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Parses the text from «parsed_» to «end». With «more», the text ends with a structural
+/// character and more text follows.
+void PushParser::parse(size_t end, bool more)
+{
+   char *const source = buffer_ + parsed_;
+   char *const stop = buffer_ + end;
+   const char saved = *stop;
+   *stop = 0;
+   const char *errorPosition = 0;
+   const char *errorMessage = 0;
+   ByteScanner scanner(source, stop);
+   TreeBuilder builder(tree_, tree_, mode_, 0);
+   builder.root = tree_.root_;
+   state_->more = more;
+   const bool ok = Parser::parse(source, stop, mode_, scanner, builder, state_, 0, 0,
+                                 &errorPosition, &errorMessage);
+   *stop = saved;
+   if (!ok && errorMessage != 0) {
+      throw SyntaxError(errorPosition - buffer_ + offset_, errorMessage);
+   }
+   tree_.root_ = builder.root;
+   parsed_ = end;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Reader. Each next() runs the parser until the builder has received one token, then suspends it.
+// skip() only counts brackets outside of strings and comments (see skipContainer()) and puts the
+// parser behind the closing bracket, as if it had returned the container's end.
+
+/// Reader state between two tokens. The Reader needs no data per open container.
+struct ReaderFrame {};
+struct Reader::State: Parser::State<ReaderFrame> {};
+
+/// Builder for Reader, stores the token in the Reader and suspends the parser.
+class Json::ReaderBuilder {
+   Reader &reader_;
+
+   void setValue(char *key, size_t keyLength, Type type, const char *value, size_t length)
+   {
+      Value &v = reader_.value_;
+      if (key) {
+         v.name_ = key;
+         v.nameLength_ = keyLength < Value::LONG_NAME ? keyLength : Value::LONG_NAME;
+      } else {
+         v.name_ = ANONYMOUS;
+         v.nameLength_ = 0;
+      }
+      v.type_ = type;
+      v.flags_ = 0;
+      v.value_ = value;
+      v.length_ = length;
+   }
+
+public:
+   typedef ReaderFrame Frame;
+
+   explicit ReaderBuilder(Reader &reader) : reader_(reader) {}
+
+   bool suspend() const
+   {
+      return reader_.token_ != Reader::END;
+   }
+
+   char *defer(Frame *, char *, size_t, char *, const char *, bool)
+   {
+      return 0;
+   }
+
+   char *allocate(size_t size)
+   {
+      reader_.scratchUsed_ = true;
+      return reader_.scratch_.malloc(size);
+   }
+
+   char *key(char *name, size_t length)
+   {
+      if (length >= Value::LONG_NAME) {
+         // Long names must be NUL-terminated.
+         char *copy = allocate(length + 1);
+         memcpy(copy, name, length);
+         copy[length] = 0;
+         return copy;
+      }
+      return name;
+   }
+
+   void string(Frame *, char *key, size_t keyLength, char *value, size_t length)
+   {
+      setValue(key, keyLength, JSTRING, value, length);
+      reader_.token_ = Reader::VALUE;
+   }
+
+   void number(Frame *, char *key, size_t keyLength, const Value &number)
+   {
+      setValue(key, keyLength, JNUMBER, number.value_, number.length_);
+      reader_.value_.flags_ = number.flags_;
+      reader_.value_.uint_ = number.uint_;
+      reader_.token_ = Reader::VALUE;
+   }
+
+   void boolean(Frame *, char *key, size_t keyLength, bool value)
+   {
+      setValue(key, keyLength, JBOOL, value ? BOOL_TRUE : BOOL_FALSE, value ? 4 : 5);
+      reader_.token_ = Reader::VALUE;
+   }
+
+   void null(Frame *, char *key, size_t keyLength)
+   {
+      setValue(key, keyLength, JNULL, NULL_VALUE, 4);
+      reader_.token_ = Reader::VALUE;
+   }
+
+   void open(Frame *, Frame *, char *key, size_t keyLength, bool object)
+   {
+      setValue(key, keyLength, object ? JOBJECT : JARRAY, 0, 0);
+      reader_.token_ = object ? Reader::START_OBJECT : Reader::START_ARRAY;
+   }
+
+   void close(Frame *, bool object)
+   {
+      setValue(0, 0, object ? JOBJECT : JARRAY, 0, 0);
+      reader_.token_ = object ? Reader::END_OBJECT : Reader::END_ARRAY;
+   }
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Reader::Reader(const char *source)
+   : buffer_(0), base_(0), next_(0), end_(0), state_(0), scratchUsed_(false), token_(END)
+{
+   init((char *) source, source + strlen(source));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Reader::Reader(const char *source, size_t length, ParseMode mode)
+   : buffer_(0), base_(0), next_(0), end_(0), state_(0), scratchUsed_(false), token_(END)
+{
+   if ((mode & PADDED) && source[length] == 0) {
+      init((char *) source, source + length);
+   } else {
+      buffer_ = copySource(source, length);
+      init(buffer_, buffer_ + length);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Reader::init(char *source, const char *end)
+{
+   base_ = next_ = source;
+   end_ = end;
+   value_ = CONST_NULL;
+   try {
+      state_ = new State;
+   } catch (...) {
+      ::free(buffer_);
+      throw;
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Reader::~Reader()
+{
+   delete state_;
+   ::free(buffer_);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Reader::Token Reader::next()
+{
+   if (scratchUsed_) {
+      scratch_.reset();
+      scratchUsed_ = false;
+   }
+   token_ = END;
+   ReaderBuilder builder(*this);
+   ByteScanner scanner(next_, end_);
+   const char *errorPosition = 0;
+   const char *errorMessage = 0;
+   if (!Parser::parse(next_, end_, ZERO_COPY, scanner, builder, state_, 0, &next_,
+                      &errorPosition, &errorMessage)) {
+      token_ = END;
+      throw SyntaxError(errorPosition - base_, errorMessage ? errorMessage : "empty JSON document");
+   }
+   return token_;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Reader::skip()
+{
+   if (token_ != START_OBJECT && token_ != START_ARRAY) {
+      return;
+   }
+   char *close = skipContainer(next_, end_);
+   if (close == 0) {
+      throw SyntaxError(end_ - base_, "unmatched opening bracket/brace");
+   }
+   next_ = close;
+   --state_->tos;
+   // Continue like after a closing bracket at the end of a part, see Parser::parse().
+   state_->allowed = state_->tos < 0 ? 0 : Parser::T_CLOSE | Parser::T_COMMA;
+   state_->key = 0;
+   token_ = (token_ == START_OBJECT) ? END_OBJECT : END_ARRAY;
+   value_.name_ = ANONYMOUS;
+   value_.nameLength_ = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int Reader::depth() const
+{
+   return state_->tos + 1;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-// Key used for array elements.
-static char ANONYMOUS_NULL[] = {JNULL,0};
-static char ANONYMOUS_OBJECT[] = {JOBJECT,0};
-static char ANONYMOUS_ARRAY[] = {JARRAY,0};
-static char ANONYMOUS_STRING[] = {JSTRING,0};
-static char ANONYMOUS_NUMBER[] = {JNUMBER,0};
-static char ANONYMOUS_BOOL[] = {JBOOL,0};
+static const TapeEntry TAPE_NULL = {JNULL, TapeEntry::LAST, 0, 0, 4, {0}, {0}};
 
-static char BOOL_TRUE[] = "true";
-static char BOOL_FALSE[] = "false";
-static char NULL_VALUE[] = "null";
-static const Value CONST_NULL = {ANONYMOUS_NULL + 1,0,0};
+/// Counts the entries and string area bytes needed for «v» and its subtree.
+static void measureTape(const Value &v, size_t &nEntries, size_t &nBytes)
+{
+   ++nEntries;
+   if (v.nameLength_ != 0) {
+      nBytes += sizeof(uint32_t) + v.nameLength() + 1;
+   }
+   if (v.type_ == JSTRING || v.type_ == JNUMBER) {
+      nBytes += v.length_ + 1;
+   } else if (v.type_ == JARRAY || v.type_ == JOBJECT) {
+      for (const Value *c = v.children(); c != 0; c = c->next_) {
+         measureTape(*c, nEntries, nBytes);
+      }
+   }
+}
+
+struct TapeWriter {
+   TapeEntry *entries_;
+   size_t nEntries_;
+   char *strings_;
+   size_t nBytes_;
+};
+
+/// Appends «length» bytes and a NUL to the string area, returns the offset.
+static uint32_t appendText(TapeWriter &w, const char *text, size_t length)
+{
+   const uint32_t offset = (uint32_t) w.nBytes_;
+   memcpy(w.strings_ + offset, text, length);
+   w.strings_[offset + length] = 0;
+   w.nBytes_ += length + 1;
+   return offset;
+}
 
-#define FAIL(pos, msg) \
-   *errorPosition = pos; \
-   *errorMessage = msg;\
-   return 0
+/// Appends a member name, preceded by its length, to the string area, returns the offset.
+static uint32_t appendName(TapeWriter &w, const char *name, uint32_t length)
+{
+   memcpy(w.strings_ + w.nBytes_, &length, sizeof(length));
+   w.nBytes_ += sizeof(length);
+   return appendText(w, name, length);
+}
+
+/// Appends «v» and its subtree in pre-order.
+static void writeTape(TapeWriter &w, const Value &v, bool last)
+{
+   const size_t index = w.nEntries_++;
+   TapeEntry &e = w.entries_[index];
+   e.type_ = v.type_;
+   e.flags_ = last ? TapeEntry::LAST : 0;
+   e.reserved_ = 0;
+   e.name_ = 0;
+   if (v.nameLength_ != 0) {
+      e.name_ = appendName(w, v.name_, (uint32_t) v.nameLength());
+   }
+   e.length_ = v.length_;
+   e.text_ = 0;
+   e.uint_ = 0;
+   switch (v.type_) {
+      case JNUMBER:
+         e.flags_ |= v.flags_;
+         e.uint_ = v.uint_;
+         // fall through
+      case JSTRING:
+         e.text_ = appendText(w, v.value_, v.length_);
+         break;
+      case JBOOL:
+         e.uint_ = v.asBool() ? 1 : 0;
+         break;
+      case JARRAY:
+      case JOBJECT:
+         for (const Value *c = v.children(); c != 0; c = c->next_) {
+            writeTape(w, *c, c->next_ == 0);
+         }
+         w.entries_[index].skip_ = (uint32_t) (w.nEntries_ - index);
+         break;
+   }
+}
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-#define MAX_DEPTH 50
+/// Builder for Parser::parse(), appends the entries and strings of a Tape directly instead of
+/// building a Tree first. A container's entry is written when it opens and gets its length, its
+/// size and the LAST flag of its last child when it closes. The arrays grow by doubling.
+class TapeBuilder {
+public:
+   struct Frame {
+      size_t index;             // the container's entry
+      size_t last;              // its last child so far
+   };
 
-#define SKIP_WS() while (IS_SPACE(*s)) { ++s; }
+private:
+   TapeWriter w_;
+   size_t maxEntries_;
+   size_t maxBytes_;
+   std::string buffer_;         // strings with escapes
+   uint32_t name_;              // offset of the name passed to key(), 0 if empty
 
-#define T_CLOSE 0x01            // ']' or '}'
-#define T_COMMA 0x02
-#define T_SIMPLE 0x04
-#define T_OPEN 0x08             // '{' or '{'
-#define T_KEY  0x10
+   TapeBuilder(const TapeBuilder&);     // not implemented
+   void operator=(const TapeBuilder&);  // not implemented
 
-#define EXPECT(x) if (!(allowed & (x))) { FAIL(s,"illegal token (" #x ")"); }
-#define IN_OBJECT() ((Type)stack[tos].obj->name_[-1] == JOBJECT)
+   /// Grows «p» from «capacity» to at least «needed» elements of «size» bytes.
+   static void *grow(void *p, size_t &capacity, size_t needed, size_t size)
+   {
+      if (needed > 0xFFFFFFFF) {
+         throw std::length_error("document too large for Tape");
+      }
+      size_t n = capacity * 2;
+      while (n < needed) {
+         n *= 2;
+      }
+      void *q = ::realloc(p, n * size);
+      if (q == 0) {
+         throw std::runtime_error("OOM");
+      }
+      capacity = n;
+      return q;
+   }
 
-#define SET_KEY_TYPE(t) \
-         if (key) { key[-1] = J##t; object->name_ = key; } \
-         else { object->name_ = ANONYMOUS_##t + 1; }
+   /// Makes room for «n» more bytes in the string area.
+   void reserveBytes(size_t n)
+   {
+      if (w_.nBytes_ + n > maxBytes_) {
+         w_.strings_ = (char *) grow(w_.strings_, maxBytes_, w_.nBytes_ + n, 1);
+      }
+   }
 
-Value *Tree::parseInternal(char *source, const char **errorPosition, const char **errorMessage)
-{
-   StackEntry stack[MAX_DEPTH];
-   int tos = -1;
-   Value* root = 0;
-   char *key = 0;
-   char *s = source;
-   unsigned int allowed = T_OPEN;
-   char *nullpp = 0;
-   char *nullp = 0;
+   /// Appends «length» bytes and a NUL to the string area, returns the offset.
+   uint32_t text(const char *text, size_t length)
+   {
+      reserveBytes(length + 1);
+      return appendText(w_, text, length);
+   }
 
-   while (true) {
-      if (nullp) {
-         *nullp = 0;
+   /// Appends the entry of a value in «parent», or of the root if «parent» is null.
+   TapeEntry &append(Frame *parent, char *key, Type type)
+   {
+      if (w_.nEntries_ == maxEntries_) {
+         w_.entries_ = (TapeEntry *) grow(w_.entries_, maxEntries_, maxEntries_ + 1,
+                                          sizeof(TapeEntry));
       }
-      nullp = nullpp;
-      nullpp = 0;
+      const size_t index = w_.nEntries_++;
+      TapeEntry &e = w_.entries_[index];
+      e.type_ = type;
+      e.flags_ = parent ? 0 : TapeEntry::LAST;
+      e.reserved_ = 0;
+      e.name_ = key ? name_ : 0;
+      e.length_ = 0;
+      e.text_ = 0;
+      e.uint_ = 0;
+      if (parent) {
+         ++w_.entries_[parent->index].length_;
+         parent->last = index;
+      }
+      return e;
+   }
 
-      while (IS_SPACE(*s)) {
-         ++s;
+public:
+   TapeBuilder()
+      : maxEntries_(64), maxBytes_(1024), name_(0)
+   {
+      w_.entries_ = (TapeEntry *) ::malloc(maxEntries_ * sizeof(TapeEntry));
+      w_.nEntries_ = 0;
+      w_.strings_ = (char *) ::malloc(maxBytes_);
+      w_.nBytes_ = 1;           // offset 0 is "" (no name)
+      if (w_.entries_ == 0 || w_.strings_ == 0) {
+         ::free(w_.entries_);
+         ::free(w_.strings_);
+         throw std::runtime_error("OOM");
       }
-      if (*s == 0) break;
+      w_.strings_[0] = 0;
+   }
 
-      Value *object = 0;
+   ~TapeBuilder()
+   {
+      ::free(w_.entries_);
+      ::free(w_.strings_);
+   }
 
-      if (*s == '"') {
-         EXPECT(T_SIMPLE | T_KEY);
-         ++s;
-         char *begin = s;
-         char *wp = s;
-         while (*s) {
-            if ((unsigned char)*s < 0x20) {
-               FAIL(s, "control character in string");
-            } else if (*s == '\\') {
-               switch (s[1]) {
-                  case '"':  *wp = '"'; break;
-                  case '\\': *wp = '\\'; break;
-                  case '/':  *wp = '/'; break;
-                  case 'b':  *wp = '\b'; break;
-                  case 'f':  *wp = '\f'; break;
-                  case 'n':  *wp = '\n'; break;
-                  case 'r':  *wp = '\r'; break;
-                  case 't':  *wp = '\t'; break;
-                  case 'u':
-                             {
-                                unsigned int cp = parseHex4(s+2);
-                                if (cp >= 0xD800 && cp < 0xDC00) {
-                                   // handle surrogates
-                                   s += 6;
-                                   if (*s != '\\' || s[1] != 'u') {
-                                      FAIL(s, "unrecognized escape sequence");
-                                   }
-                                   unsigned cp2 = parseHex4(s+2);
-                                   if (cp2 < 0xDC00 || cp2 >= 0xE000)  {
-                                      FAIL(s, "unrecognized escape sequence");
-                                   }
-                                   cp = ((cp & 0x3FF) << 10) | (cp2 & 0x3FF) | 0x10000;
-                                }
-                                if (cp <= 0x7F) {
-                                   *wp = cp;
-                                } else if (cp <= 0x7FF) {
-                                   *wp++ = 0xC0 | (cp >> 6);
-                                   *wp =   0x80 | (cp & 0x3F);
-                                } else if (cp <= 0xFFFF) {
-                                   *wp++ = 0xE0 |  (cp >> 12);
-                                   *wp++ = 0x80 | ((cp >> 6) & 0x3F);
-                                   *wp =   0x80 |  (cp & 0x3F);
-                                } else if (cp <= 0x1FFFFF) {
-                                   *wp++ = 0xF0 |  (cp >> 18);
-                                   *wp++ = 0x80 | ((cp >> 12) & 0x3F);
-                                   *wp++ = 0x80 | ((cp >>  6) & 0x3F);
-                                   *wp =   0x80 |  (cp & 0x3F);
-                                } else {
-                                   FAIL(s, "unrecognized escape sequence");
-                                }
-                                s += 4;
-                             }
-                             break;
-                  default:
-                             FAIL(s, "unrecognized escape sequence");
-               }
-               ++wp;
-               s += 2;
-            } else if (*s == '"') {
-               *wp = 0;
-               ++s;
-               break;
-            } else {
-               *wp++ = *s++;
-            }
-         }
+   /// Passes the entries and the string area to the caller, which frees them.
+   void release(TapeEntry *&entries, char *&strings, size_t &size)
+   {
+      entries = w_.entries_;
+      strings = w_.strings_;
+      size = w_.nEntries_;
+      w_.entries_ = 0;
+      w_.strings_ = 0;
+   }
 
-         if (allowed & T_KEY) {
-            key = begin;
-            SKIP_WS();
-            if (*s != ':') {
-               FAIL(s, "missing ':'");
-            }
-            ++s;
-            allowed = T_SIMPLE | T_OPEN;
-         } else {
-            object = (Value *)malloc(sizeof(Value));
-            object->value_ = begin;
-            SET_KEY_TYPE(STRING);
-         }
-      } else if (IS_DIGIT(*s) || *s == '-') {
-         EXPECT(T_SIMPLE);
-         object = (Value *)malloc(sizeof(Value));
-         object->value_ = s;
-         SET_KEY_TYPE(NUMBER);
-         if (*s == '-') { ++s; }
-         if (*s == '0' && IS_DIGIT(s[1])) {
-            FAIL(object->value_, "leading 0 in number");
-         }
-         if (!IS_DIGIT(*s) && (*s != '.')) {
-            FAIL(object->value_, "missing digit after '-'");
-         }
-         do {
-            ++s;
-         } while (IS_DIGIT(*s));
-         if (*s == '.') {
-            ++s;
-         }
-         while (IS_DIGIT(*s)) {
-            ++s;
-         }
-         if ((*s == 'e') || (*s == 'E')) {
-            ++s;
-            if ((*s == '+') || (*s == '-')) { ++s; }
-            if (!IS_DIGIT(*s)) {
-               FAIL(object->value_, "missing digit in exponent");
-            }
-            do {
-               ++s;
-            } while (IS_DIGIT(*s));
-         }
-      } else if (s[0] == 'n' && s[1] == 'u' && s[2] == 'l' && s[3] == 'l') {
-         EXPECT(T_SIMPLE);
-         object = (Value *)malloc(sizeof(Value));
-         object->value_ = NULL_VALUE;
-         SET_KEY_TYPE(NULL);
-         s += 4;
-      } else if (s[0] == 't' && s[1] == 'r' && s[2] == 'u' && s[3] == 'e') {
-         EXPECT(T_SIMPLE);
-         object = (Value *)malloc(sizeof(Value));
-         object->value_ = BOOL_TRUE;
-         SET_KEY_TYPE(BOOL);
-         s += 4;
-      } else if (s[0] == 'f' && s[1] == 'a' && s[2] == 'l' && s[3] == 's' && s[4] == 'e') {
-         EXPECT(T_SIMPLE);
-         object = (Value *)malloc(sizeof(Value));
-         object->value_ = BOOL_FALSE;
-         SET_KEY_TYPE(BOOL);
-         s += 5;
-      } else if (*s == '{' || *s == '[') {
-         EXPECT(T_OPEN);
-         if (tos >= MAX_DEPTH - 1) {
-            FAIL(s, "JSON nesting too deep");
-         }
-         Value *object = (Value *)malloc(sizeof(Value));
-         object->value_ = 0;
-         if (*s == '{') {
-            allowed = T_CLOSE | T_KEY;
-            SET_KEY_TYPE(OBJECT);
-         } else {
-            allowed = T_CLOSE | T_OPEN | T_SIMPLE;
-            SET_KEY_TYPE(ARRAY);
-         }
-         ++s;
-         // push on stack and set root
-         if (tos < 0) {
-            PMU(ASSERT(root == 0));
-            root = object;
-         } else {
-            appendValue(stack + tos, object);
-         }
-         ++tos;
-         stack[tos].obj = object;
-         stack[tos].tail = &object->value_;
-         key = 0;
-      } else if (*s == '}' || *s == ']') {
-         EXPECT(T_CLOSE);
-         PMU(ASSERT(tos >= 0));
-         if (stack[tos].obj->type() != ((*s == '}') ? JOBJECT : JARRAY)) {
-            FAIL(s, "bracket/brace mismatch");
-         }
-         ++s;     // skip ']' or '}'
-         --tos;   // pop from stack
+   bool suspend() const
+   {
+      return false;
+   }
 
-         SKIP_WS();
-         if (tos < 0) {
-            if (*s != 0) {
-               FAIL(s, "text after root element");
-            }
-         } else {
-            if (*s == ',') {
-               ++s;
-               allowed = IN_OBJECT() ? T_KEY : T_SIMPLE | T_OPEN;
-            } else {
-               allowed = T_CLOSE;
-            }
-         }
-         key = 0;
-      } else if (*s == '/' && s[1] == '/') {
-         s += 2;
-         while (*s != 0 && *s != '\n') ++s;
-      } else if (*s == '/' && s[1] == '*') {
-         s += 2;
-         while (*s != 0 && (s[0] != '*' || s[1] != '/')) ++s;
-         if (*s == 0) {
-            FAIL(s, "unterminated comment");
-         }
-         s += 2;
-      } else {
-         FAIL(s, "syntax error");
-      }
+   char *defer(Frame *, char *, size_t, char *, const char *, bool)
+   {
+      return 0;
+   }
 
-      if (object != 0) {
-         nullpp = s;
-         appendValue(stack + tos, object);
-         SKIP_WS();
-         if (*s == ',') {
-            ++s;
-            allowed = IN_OBJECT() ? T_KEY : T_SIMPLE | T_OPEN;
-         } else {
-            allowed = T_CLOSE;
-         }
+   char *allocate(size_t size)
+   {
+      buffer_.resize(size);
+      return &buffer_[0];
+   }
+
+   /// Copies the name at once, it may be in «buffer_», which the value can reuse.
+   char *key(char *name, size_t length)
+   {
+      name_ = 0;
+      if (length != 0) {
+         reserveBytes(sizeof(uint32_t) + length + 1);
+         name_ = appendName(w_, name, (uint32_t) length);
       }
+      return name;
+   }
+
+   void string(Frame *parent, char *key, size_t, char *value, size_t length)
+   {
+      const uint32_t offset = text(value, length);
+      TapeEntry &e = append(parent, key, JSTRING);
+      e.length_ = (uint32_t) length;
+      e.text_ = offset;
+   }
+
+   void number(Frame *parent, char *key, size_t, const Value &number)
+   {
+      const uint32_t offset = text(number.value_, number.length_);
+      TapeEntry &e = append(parent, key, JNUMBER);
+      e.flags_ |= number.flags_;
+      e.length_ = number.length_;
+      e.text_ = offset;
+      e.uint_ = number.uint_;
+   }
+
+   void boolean(Frame *parent, char *key, size_t, bool value)
+   {
+      TapeEntry &e = append(parent, key, JBOOL);
+      e.length_ = value ? 4 : 5;
+      e.uint_ = value ? 1 : 0;
+   }
 
+   void null(Frame *parent, char *key, size_t)
+   {
+      append(parent, key, JNULL).length_ = 4;
    }
 
-   if (nullp) {
-      *nullp = 0;
+   void open(Frame *parent, Frame *frame, char *key, size_t, bool isObject)
+   {
+      frame->index = w_.nEntries_;
+      append(parent, key, isObject ? JOBJECT : JARRAY);
    }
 
-   if (tos >= 0) {
-      FAIL(s, "unmatched opening bracket/brace");
+   void close(Frame *frame, bool)
+   {
+      TapeEntry &e = w_.entries_[frame->index];
+      e.skip_ = (uint32_t) (w_.nEntries_ - frame->index);
+      if (e.length_ != 0) {
+         w_.entries_[frame->last].flags_ |= TapeEntry::LAST;
+      }
    }
+};
 
-   return root;
+/// Parses «source» into «builder». Of the options in «mode», only STRUCTURAL_INDEX applies.
+static void parseTape(TapeBuilder &builder, const char *source, const char *end, ParseMode mode)
+{
+   const char *errorPosition = 0;
+   const char *errorMessage = 0;
+   mode = (ParseMode) ((mode & STRUCTURAL_INDEX) | ZERO_COPY);
+   if (!parseWith(builder, (char *) source, end, mode, &errorPosition, &errorMessage)) {
+      throw SyntaxError(errorPosition - source,
+                        errorMessage ? errorMessage : "empty JSON document");
+   }
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-int Value::asInt() const
+Tape::Tape()
+   : entries_(0), strings_(0), size_(0)
 {
-   switch (type()) {
-      case JBOOL:
-         return value_ == BOOL_TRUE ? 1 : 0;
-      case JNUMBER:
-         return atoi(value_);
-      case JOBJECT:
-      case JARRAY:
-      case JSTRING:
-      case JNULL:
-         throw std::invalid_argument("illegal conversion to int");
-   }
-   return 0;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-const char *Value::asString() const
+Tape::Tape(const Value &root)
+   : entries_(0), strings_(0), size_(0)
 {
-   switch (type()) {
-      case JOBJECT:
-         throw std::invalid_argument("illegal conversion of object to string");
-      case JARRAY:
-         throw std::invalid_argument("illegal conversion of array to string");
-      default:
-         break;
-   }
-   return value_;
+   assign(root);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-bool Value::asBool() const
+Tape::~Tape()
 {
-   switch (type()) {
-      case JBOOL:
-         return value_ == BOOL_TRUE;
-      case JNULL:
-         return false;
-      case JNUMBER:
-         for (const char *c = value_; *c && *c != 'e' && *c != 'E'; ++c) {
-            if (IS_DIGIT(*c) && (*c != '0')) {
-               return true;
-            }
-         }
-         return false;
-      case JOBJECT:
-      case JARRAY:
-      case JSTRING:
-         return true;
-   }
-   return false;
+   ::free(entries_);
+   ::free(strings_);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-size_t Value::length() const
+void Tape::parse(const char *source, ParseMode mode)
 {
-   if (value_ == 0) {
-      return 0;
-   }
-   if (((Type)name_[-1] != JARRAY) && ((Type)name_[-1] != JOBJECT)) {
-      return 0;
-   }
-   size_t len = 0;
-   for (Value* x = (Value*) value_; x; x = x->next_) {
-      ++len;
-   }
-   return len;
+   TapeBuilder builder;
+   parseTape(builder, source, 0, mode);
+   ::free(entries_);
+   ::free(strings_);
+   builder.release(entries_, strings_, size_);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-const Value* Value::children() const
+void Tape::parse(const char *source, size_t length, ParseMode mode)
 {
-   if (((Type)name_[-1] != JARRAY) && ((Type)name_[-1] != JOBJECT)) {
-      throw std::invalid_argument("indexed access on simple type");
+   TapeBuilder builder;
+   if ((mode & PADDED) && source[length] == 0) {
+      parseTape(builder, source, source + length, mode);
+   } else {
+      std::string copy(length + PADDING, 0);
+      memcpy(&copy[0], source, length);
+      parseTape(builder, &copy[0], &copy[0] + length, mode);
    }
-   return (const Value*) value_;
+   ::free(entries_);
+   ::free(strings_);
+   builder.release(entries_, strings_, size_);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-const Value& Value::get(int i) const
+void Tape::assign(const Value &root)
 {
-   const Value*x = children();
-   while (i > 0 && x != 0) {
-      --i;
-      x = x->next_;
+   size_t nEntries = 0;
+   size_t nBytes = 1;           // offset 0 is "" (no name)
+   measureTape(root, nEntries, nBytes);
+   if (nEntries > 0xFFFFFFFF || nBytes > 0xFFFFFFFF) {
+      throw std::length_error("document too large for Tape");
    }
-   if ((x == 0) || (i != 0)) {
-      throw std::invalid_argument("array index out of bounds");
+   TapeEntry *entries = (TapeEntry *) ::malloc(nEntries * sizeof(TapeEntry));
+   char *strings = (char *) ::malloc(nBytes);
+   if (entries == 0 || strings == 0) {
+      ::free(entries);
+      ::free(strings);
+      throw std::runtime_error("OOM");
    }
-   return *x;
+   strings[0] = 0;
+   TapeWriter w = { entries, 0, strings, 1 };
+   writeTape(w, root, true);
+
+   ::free(entries_);
+   ::free(strings_);
+   entries_ = entries;
+   strings_ = strings;
+   size_ = nEntries;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-const Value& Value::get(const char *s) const
+TapeValue Tape::root() const
 {
-   if ((Type)name_[-1] != JOBJECT) {
-      throw std::invalid_argument("member access on non-object");
-   }
-   const Value*x = (const Value*) value_;
-   while (x != 0) {
-      if (!strcmp(x->name_,s)) {
-         return *x;
-      }
-      x = x->next_;
+   if (size_ == 0) {
+      throw std::runtime_error("empty JSON document");
    }
-   return CONST_NULL;
+   return TapeValue(entries_, strings_);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void Tree::parseInternal(char *source)
+const char *TapeValue::name() const
 {
-   const char *errorPosition = 0;
-   const char *errorMessage = 0;
+   return strings_ + entry_->name_;
+}
 
-   root_ = parseInternal(source, &errorPosition, &errorMessage);
-   if (root_ == 0) {
-      throw SyntaxError(errorPosition - source, errorMessage);
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t TapeValue::nameLength() const
+{
+   if (entry_->name_ == 0) {
+      return 0;
    }
+   uint32_t length;
+   memcpy(&length, strings_ + entry_->name_ - sizeof(length), sizeof(length));
+   return length;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-char *Tree::malloc(size_t size)
+int TapeValue::asInt() const
 {
-   size = ROUND_UP(size);
-
-   if (head_ == 0 || head_->eofs_ < (char*) head_ + sizeof(Chunk) + size) {
-      // Insufficient free space, allocate a new chunk.
-      const size_t chunkSize = ROUND_UP(std::max(sizeof(Chunk) + size, BLOCK_SIZE));
-      Chunk *chunk = (Chunk*) ::malloc(chunkSize);
-      if (chunk == 0) {
-         throw std::runtime_error("OOM");
-      }
-      chunk->eofs_ = (char*) chunk + chunkSize;
-      chunk->next_ = head_;
-      head_ = chunk;
+   switch (type()) {
+      case JBOOL:
+         return (int) entry_->uint_;
+      case JNUMBER:
+         return numberAsInt(*entry_);
+      default:
+         throw std::invalid_argument("illegal conversion to int");
    }
-
-   // Allocate from current chunk.
-   return head_->eofs_ -= size;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-Tree::~Tree()
+int64_t TapeValue::asInt64() const
 {
-   while (head_) {
-      Chunk *c = head_;
-      head_ = head_->next_;
-      ::free(c);
-   }
+   return entry_->type_ == JNUMBER ? numberAsInt64(*entry_) : asInt();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-Tree::Tree()
-   : head_(0), root_(0)
+uint64_t TapeValue::asUint64() const
 {
+   return entry_->type_ == JNUMBER ? numberAsUint64(*entry_) : asInt();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-Tree::Tree(char *source, ParseMode mode)
-   : head_(0), root_(0)
+double TapeValue::asDouble() const
 {
-   parse(source, mode);
+   if (entry_->type_ != JNUMBER) {
+      return atof(asString());
+   }
+   if (!(entry_->flags_ & Value::NUMBER_INTEGER)) {
+      return entry_->double_;
+   }
+   const double d = (double) entry_->uint_;
+   return (entry_->flags_ & Value::NUMBER_NEGATIVE) ? -d : d;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-Tree::Tree(const char *source )
-   : head_(0), root_(0)
+const char *TapeValue::asString() const
 {
-   parse(source);
+   switch (type()) {
+      case JOBJECT:
+         throw std::invalid_argument("illegal conversion of object to string");
+      case JARRAY:
+         throw std::invalid_argument("illegal conversion of array to string");
+      case JBOOL:
+         return entry_->uint_ ? BOOL_TRUE : BOOL_FALSE;
+      case JNULL:
+         return NULL_VALUE;
+      default:
+         return strings_ + entry_->text_;
+   }
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-Tree::Tree(const std::string &source)
-   : head_(0), root_(0)
+size_t TapeValue::stringLength() const
 {
-   parse(source);
+   asString();
+   return entry_->length_;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void Tree::parse(char *source, ParseMode mode)
+bool TapeValue::asBool() const
 {
-   char *workingBuffer = source;
-   if (mode == NON_DESTRUCTIVE) {
-      const size_t sourceLength = strlen(source) + 1;
-      workingBuffer = malloc(sourceLength);
-      memcpy(workingBuffer, source, sourceLength);
+   switch (type()) {
+      case JBOOL:
+         return entry_->uint_ != 0;
+      case JNULL:
+         return false;
+      case JNUMBER:
+         return !(entry_->flags_ & Value::NUMBER_ZERO);
+      default:
+         return true;
    }
-   parseInternal(workingBuffer);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void Tree::parse(const char *source)
+TapeValue TapeValue::children() const
 {
-   parse((char *)source, NON_DESTRUCTIVE);
+   if ((entry_->type_ != JARRAY) && (entry_->type_ != JOBJECT)) {
+      throw std::invalid_argument("indexed access on simple type");
+   }
+   return TapeValue(entry_->length_ != 0 ? entry_ + 1 : 0, strings_);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void Tree::parse(const std::string& source)
+TapeValue TapeValue::get(int i) const
 {
-   return parse((char*) source.c_str(), NON_DESTRUCTIVE);
+   TapeValue x = children();
+   if (i < 0 || (unsigned) i >= entry_->length_) {
+      throw std::invalid_argument("array index out of bounds");
+   }
+   for (; i > 0; --i) {
+      x = x.next();
+   }
+   return x;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-const Value& Tree::root() const
+TapeValue TapeValue::get(const char *s) const
 {
-   if (root_ == 0) {
-      throw std::runtime_error("empty JSON document");
+   if (entry_->type_ != JOBJECT) {
+      throw std::invalid_argument("member access on non-object");
    }
-   return *root_;
+   const size_t n = strlen(s);
+   for (TapeValue x = children(); x.valid(); x = x.next()) {
+      if (x.nameLength() == n && !memcmp(x.name(), s, n)) {
+         return x;
+      }
+   }
+   return TapeValue(&TAPE_NULL, strings_);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
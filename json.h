@@ -11,8 +11,17 @@
 #define JSON_H
 
 #include <stdexcept>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <string>
+#if __cplusplus >= 201703L
+#include <string_view>
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define JSON_HAVE_PMR 1
+#endif
+#endif
 
 namespace Json {
 
@@ -28,40 +37,270 @@ namespace Json {
       JARRAY
    };
 
+   class Tree;
+   struct MemberIndex;
+   struct PackedNumbers;
+   class IndexScanner;
+   class LineParser;
+   class PushParser;
+   class ReaderBuilder;
+   class ProjectionBuilder;
+   class KeyTable;
+   class KeyDictionary;
+   class ShapeTable;
+   struct Value;
+
+#if __cplusplus >= 201402L
+#define JSON_CONSTEXPR constexpr
+#else
+#define JSON_CONSTEXPR
+#endif
+
+   /////////////////////////////////////////////////////////////////////////////////////////////////
+
+   /// A member name prepared for repeated lookups with Value::get(const Key&): length, hash and
+   /// the first eight bytes are computed once, so most non-matching members are rejected by
+   /// comparing integers. With C++14, a Key made from a string literal is a compile time
+   /// constant:
+   ///
+   ///     static constexpr Json::Key NAME("name");
+   ///
+   /// The Key points to «name», which must stay valid.
+   struct Key {
+      const char *name_;
+      size_t length_;
+      uint32_t hash_;           // FNV-1a, like the member index
+      uint64_t prefix_;         // the first eight bytes in memory order, if length_ >= 8
+
+      JSON_CONSTEXPR Key(const char *name)
+         : name_(name), length_(measure(name)), hash_(hash(name, length_)),
+           prefix_(prefix(name, length_))
+      {
+      }
+
+      JSON_CONSTEXPR Key(const char *name, size_t length)
+         : name_(name), length_(length), hash_(hash(name, length)), prefix_(prefix(name, length))
+      {
+      }
+
+      Key(const std::string &name)
+         : name_(name.c_str()), length_(name.size()), hash_(hash(name_, length_)),
+           prefix_(prefix(name_, length_))
+      {
+      }
+
+   private:
+      static JSON_CONSTEXPR size_t measure(const char *name)
+      {
+         size_t length = 0;
+         while (name[length] != 0) {
+            ++length;
+         }
+         return length;
+      }
+
+      static JSON_CONSTEXPR uint32_t hash(const char *name, size_t length)
+      {
+         uint32_t h = 2166136261u;
+         for (size_t i = 0; i < length; ++i) {
+            h = (h ^ (unsigned char) name[i]) * 16777619u;
+         }
+         return h;
+      }
+
+      static JSON_CONSTEXPR uint64_t prefix(const char *name, size_t length)
+      {
+         uint64_t word = 0;
+         for (size_t i = 0; length >= 8 && i < 8; ++i) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            word |= (uint64_t) (unsigned char) name[i] << (56 - 8 * i);
+#else
+            word |= (uint64_t) (unsigned char) name[i] << (8 * i);
+#endif
+         }
+         return word;
+      }
+   };
+
+   /////////////////////////////////////////////////////////////////////////////////////////////////
+
+   /// The member names of an object parsed with SHAPE_OBJECTS, shared by all objects with the
+   /// same names in the same order. Each name has a slot, its position in the object.
+   class Shape {
+      uint64_t id_;                     // unique within the process, see Field
+      size_t size_;
+      size_t mask_;                     // number of index_ entries - 1
+      const Value *const *names_;       // the members of the first object with this Shape
+      const unsigned *index_;           // slot + 1 by name hash (see Key::hash_), 0 if unused
+      size_t hash_;                     // hash of the interned names, see ShapeTable
+
+      Shape(const Shape&);              // not implemented
+      void operator=(const Shape&);     // not implemented
+      friend class ShapeTable;
+      friend struct Value;
+   public:
+      /// Returns the number of slots.
+      size_t size() const { return size_; }
+
+      /// Returns the name in «slot», which must be less than size().
+      const char *name(size_t slot) const;
+      size_t nameLength(size_t slot) const;
+
+      /// Returns the slot of the first member named «key», or -1 if there is none.
+      int slot(const Key &key) const;
+   };
+
+   /// A Key that remembers the slot of its name in the Shape of the last object it was found
+   /// in. Value::get(const Field&) on an object with the same Shape is an indexed load without
+   /// comparing names, so reading a member of each record in an array costs little more than
+   /// visiting the records:
+   ///
+   ///     static Json::Field PRICE("price");
+   ///     for (const Json::Value *r = items.children(); r != 0; r = r->next_) {
+   ///        sum += r->get(PRICE).asDouble();
+   ///     }
+   ///
+   /// Lookups update the Field, so a Field must not be used by several threads at once.
+   struct Field {
+      Key key_;
+      mutable uint64_t shape_;          // Shape::id_ of the last object, 0 if none
+      mutable size_t slot_;             // the slot of key_ in that Shape
+
+      JSON_CONSTEXPR Field(const char *name) : key_(name), shape_(0), slot_(0) {}
+      JSON_CONSTEXPR Field(const char *name, size_t length)
+         : key_(name, length), shape_(0), slot_(0)
+      {
+      }
+      Field(const std::string &name) : key_(name), shape_(0), slot_(0) {}
+   };
+
+   /// The members of an object with Value::OBJECT_SHAPED, in slot order.
+   struct MemberSlots {
+      const Shape *shape_;
+      const Value *values_[1];          // actually shape_->size() members
+   };
+
+   /// The elements of an array parsed with PACK_NUMBERS, see Value::packed(). The numbers are
+   /// stored once, as int64_t if all are integers in that range, as double otherwise.
+   struct PackedNumbers {
+      Tree *tree_;                      // creates the element Values on first access
+      const char *text_;                // source text of the first element
+      const uint32_t *offsets_;         // position of each element's text relative to text_
+      bool integers_;                   // int64s_ is valid, otherwise doubles_
+      union {
+         const int64_t *int64s_;
+         const double *doubles_;
+      };
+   };
+
    /////////////////////////////////////////////////////////////////////////////////////////////////
 
    /// A JSON value.
    struct Value {
+      /// Value of nameLength_ for names of this length or longer.
+      static const unsigned short LONG_NAME = 0xFFFF;
+
       /// The value's name if it is part of an object, "" otherwise. Never null.
+      /// Not NUL-terminated in ZERO_COPY mode (see nameLength_).
       const char *name_;
 
       /// The value's textual representation for simple values. If this is an object
       /// or array, pointer to the first element.
+      /// Not NUL-terminated in ZERO_COPY mode (see length_).
       const char *value_;
 
       /// The next element for object and array members, or null
       Value *next_;
 
+      /// Length of value_ in bytes for simple values, number of children for arrays and objects.
+      unsigned length_;
+
+      /// Length of name_ in bytes, or LONG_NAME. Long names are always NUL-terminated.
+      unsigned short nameLength_;
+
+      /// The value's type (see Type).
+      unsigned char type_;
+
+      /// Type specific flags, see NUMBER_xxx and OBJECT_xxx.
+      unsigned char flags_;
+
+      /// Numbers are decoded during parsing. With NUMBER_INTEGER, uint_ holds the absolute
+      /// value. Otherwise, double_ holds the value rounded to the nearest double.
+      /// Objects use index_ with OBJECT_INDEXED and slots_ with OBJECT_SHAPED, arrays use
+      /// elements_ with ARRAY_INDEXED and packed_ with ARRAY_PACKED.
+      /// Both use tree_ with OBJECT_LAZY/ARRAY_LAZY and OBJECT_DEFERRED/ARRAY_DEFERRED, and
+      /// uint_ (the error offset) with OBJECT_INVALID/ARRAY_INVALID.
+      union {
+         uint64_t uint_;
+         double double_;
+         const MemberIndex *index_;
+         const Value **elements_;
+         const MemberSlots *slots_;
+         const PackedNumbers *packed_;
+         Tree *tree_;
+      };
+
+      /// Flags for numbers.
+      enum {
+         NUMBER_INTEGER = 0x01,        // no fraction or exponent and fits in 64 bits
+         NUMBER_NEGATIVE = 0x02,       // leading '-'
+         NUMBER_OVERFLOW = 0x04,       // no fraction or exponent, but does not fit in 64 bits
+         NUMBER_ZERO = 0x08            // all digits before the exponent are '0'
+      };
+
+      /// Flags for objects and arrays.
+      enum {
+         OBJECT_INDEXED = 0x01,        // index_ is the member hash index
+         OBJECT_LAZY = 0x02,           // build the index on first lookup, using tree_
+         ARRAY_INDEXED = 0x01,         // elements_ is the element table
+         ARRAY_LAZY = 0x02,            // build the element table on first get(int), using tree_
+         OBJECT_DEFERRED = 0x04,       // ON_DEMAND: not parsed yet, value_ and length_ are the
+         ARRAY_DEFERRED = 0x04,        // source text including the brackets
+         OBJECT_INVALID = 0x08,        // with OBJECT_DEFERRED: parsing failed, value_ is the
+         ARRAY_INVALID = 0x08,         // error message
+         OBJECT_SHAPED = 0x10,         // slots_ holds the members and their Shape
+         ARRAY_PACKED = 0x20           // packed_ holds the elements, value_ is null until
+                                       // children() has created their Values
+      };
+
       /// Returns the type of this value.
       Type type() const
       {
-         return (Type) name_[-1];
+         return (Type) type_;
       }
 
-      /// Interprets the value as an integer.
-      /// Throws if this is not a number or boolean.
+      /// Interprets the value as an integer. Fractions are truncated, out of range values are
+      /// clamped. Throws if this is not a number or boolean.
       int asInt() const;
 
+      /// Like asInt(), but throws std::out_of_range if the value is outside the range of the
+      /// result type.
+      int64_t asInt64() const;
+      uint64_t asUint64() const;
+
       /// Interprets the value as a floating point value.
       double asDouble() const
       {
-         return atof(value_);
+         if (type_ != JNUMBER) {
+            return atof(value_);
+         }
+         if (!(flags_ & NUMBER_INTEGER)) {
+            return double_;
+         }
+         return (flags_ & NUMBER_NEGATIVE) ? -(double) uint_ : (double) uint_;
       }
 
       /// Returns the value's string representation.
       /// Throws if this is an array or object.
       const char *asString() const;
 
+      /// Returns the length of asString() in bytes.
+      /// Throws if this is an array or object.
+      size_t stringLength() const;
+
+      /// Returns the length of the value's name in bytes.
+      size_t nameLength() const;
+
       /// Returns the boolean interpretation of the value.
       /// false, null and zero numbers (integer or float) are falsy.
       /// All other values are thruthy.
@@ -69,73 +308,763 @@ namespace Json {
 
       /// Returns the number of array of object members.
       /// Returns 0 for simple types.
-      size_t length() const;
+      size_t length() const
+      {
+         if (type_ != JARRAY && type_ != JOBJECT) {
+            return 0;
+         }
+         if (flags_ & OBJECT_DEFERRED) {
+            children();
+         }
+         return length_;
+      }
 
       /// Returns the first child or NULL if the array/object is empty.
       /// Throws if this is not an array or object.
       const Value* children() const;
 
-      /// Array element access.
+      /// Array element access. O(1) for arrays with element table (see INDEX_ARRAYS) and packed
+      /// arrays (see PACK_NUMBERS). For objects, returns the «i»th member, in O(1) if the object
+      /// has a Shape (see SHAPE_OBJECTS).
       const Value& get(int i) const;
       const Value& operator[](int i) const { return get(i); }
 
-      /// Object member access.
+      /// Object member access. Returns the first member with the given name.
       const Value& get(const char *name) const;
       const Value& get(const std::string &key) const { return get(key.c_str()); };
       const Value& operator[](const char *key) const { return get(key); }
       const Value& operator[](const std::string &key) const { return get(key.c_str()); }
 
+      /// Like get(const char*), but faster for repeated lookups of the same name.
+      const Value& get(const Key &key) const;
+      const Value& operator[](const Key &key) const { return get(key); }
+
+      /// Like get(const Key&), but an indexed load if «field» was last found in an object with
+      /// the same Shape (see SHAPE_OBJECTS).
+      const Value& get(const Field &field) const
+      {
+         if (type_ == JOBJECT && (flags_ & OBJECT_SHAPED) && slots_->shape_->id_ == field.shape_) {
+            return *slots_->values_[field.slot_];
+         }
+         return lookup(field);
+      }
+      const Value& operator[](const Field &field) const { return get(field); }
+
+      /// The part of get(const Field&) that finds the slot and updates «field».
+      const Value& lookup(const Field &field) const;
+
+      /// Returns the Shape of this object, null if it has none or is not an object.
+      const Shape *shape() const;
+
+      /// Returns the packed elements of this array, null if it has none or is not an array (see
+      /// PACK_NUMBERS).
+      const PackedNumbers *packed() const;
+
+      /// Copies the first «n» elements of this array, at most length(), to «out», converted like
+      /// asDouble() or asInt64(), and returns their number. A packed array is copied without
+      /// creating its element Values. Throws std::invalid_argument if this is not an array or an
+      /// element is not a number, std::out_of_range like asInt64().
+      size_t copyTo(double *out, size_t n) const;
+      size_t copyTo(int64_t *out, size_t n) const;
+
    };
 
    /////////////////////////////////////////////////////////////////////////////////////////////////
 
+   /// Parser mode: NON_DESTRUCTIVE or DESTRUCTIVE, optionally combined with option flags.
    enum ParseMode {
-      NON_DESTRUCTIVE,  // copy the source before parsig
-      DESTRUCTIVE       // don't copy, ovewrite source buffer
+      NON_DESTRUCTIVE = 0x00,       // copy the source before parsig
+      DESTRUCTIVE = 0x01,           // don't copy, ovewrite source buffer
+
+      /// Don't copy and don't modify the source. Names and values point into the source and are
+      /// not NUL-terminated, use nameLength() and stringLength(). Only strings with escape
+      /// sequences are copied. The source must stay unchanged during the Tree's lifetime.
+      ZERO_COPY = 0x02,
+
+      /// Option: build a structural index in a separate, vectorized (SSE2/AVX2) pass and use it
+      /// to skip white space and strings without escapes. Produces the same tree as the default
+      /// byte by byte scan. Pays off for documents with much white space or long strings.
+      STRUCTURAL_INDEX = 0x100,
+
+      /// Option for length delimited sources: the caller guarantees that PADDING bytes after
+      /// the end of the source belong to the same buffer. With DESTRUCTIVE, they may be
+      /// overwritten, which avoids copying the source.
+      PADDED = 0x200,
+
+      /// Option: build a hash index for each object with many members during parsing, making
+      /// member lookup O(1) instead of O(length).
+      INDEX_OBJECTS = 0x400,
+
+      /// Option: like INDEX_OBJECTS and INDEX_ARRAYS, but build the index on the first lookup.
+      /// Lookups modify the tree, so concurrent get() calls on the same Tree are not safe with
+      /// this option.
+      LAZY_INDEX = 0x800,
+
+      /// Option: build an element table for each array during parsing, making get(int) O(1).
+      INDEX_ARRAYS = 0x1000,
+
+      /// Option: split large documents at the elements of the root container and parse the
+      /// parts on several threads, see Tree::setThreads(). Produces the same tree and the same
+      /// errors as a serial parse. Documents with comments are parsed serially.
+      PARALLEL = 0x2000,
+
+      /// Option for Tree::parse(): parse only the root container. Nested arrays and objects are
+      /// located by counting brackets and parsed when they are first accessed, one level at a
+      /// time, so untouched parts of the document cost a fast scan and no memory. Syntax errors
+      /// in them are thrown on access (by children(), length() and get()), see also
+      /// Tree::validate(). Like LAZY_INDEX, access modifies the tree. STRUCTURAL_INDEX and
+      /// PARALLEL have no effect.
+      ON_DEMAND = 0x4000,
+
+      /// Option: store each distinct member name once. All members with the same name share one
+      /// NUL-terminated copy in the Tree, or in the KeyDictionary set by setKeyDictionary(), so
+      /// lookups with a Key from that dictionary find a member by comparing pointers. With
+      /// PARALLEL and no dictionary, each thread has its own table. Names of LONG_NAME bytes
+      /// or more are not interned.
+      INTERN_KEYS = 0x8000,
+
+      /// Option: give objects with the same member names in the same order a shared Shape, and a
+      /// table of their members in slot order. Implies INTERN_KEYS. Lookups with a Key find the
+      /// member through the Shape's index in O(1), lookups with a Field usually by an indexed
+      /// load, see Value::get(const Field&). Costs a pointer per member and one Shape for each
+      /// distinct sequence of names. Empty objects and objects with names of LONG_NAME bytes or
+      /// more get no Shape; INDEX_OBJECTS and LAZY_INDEX apply to them as usual.
+      SHAPE_OBJECTS = 0x10000,
+
+      /// Option: store arrays of numbers as one contiguous buffer of int64_t or double, plus the
+      /// offset of each element's text, instead of a Value per element: 12 instead of 40 bytes
+      /// per element. Value::copyTo() and Value::packed() read the buffer directly; children()
+      /// and get() create the element Values on first access, so like LAZY_INDEX, access
+      /// modifies the tree. Arrays with integers that fit neither type exactly, and with PARALLEL
+      /// the root array, are stored as usual. INDEX_ARRAYS and LAZY_INDEX do not apply to packed
+      /// arrays, get(int) is O(1) on them. Ignored by PushParser.
+      PACK_NUMBERS = 0x20000
    };
 
+   /// Number of bytes after the source that must be accessible with PADDED.
+   static const size_t PADDING = 64;
+
+   /// Default minimum number of source bytes per thread with PARALLEL.
+   static const size_t MIN_SEGMENT_SIZE = 1 << 20;
+
+   inline ParseMode operator|(ParseMode a, ParseMode b)
+   {
+      return (ParseMode) ((int) a | (int) b);
+   }
+
+   /// Source of the memory chunks of a Tree. The default is ::malloc() / ::free().
+   class Allocator
+   {
+   public:
+      virtual ~Allocator() {}
+
+      /// Returns «size» bytes aligned to 8, or throws. Returning null is treated as OOM.
+      virtual void *allocate(size_t size) = 0;
+
+      /// Releases memory returned by allocate(«size»).
+      virtual void deallocate(void *p, size_t size) = 0;
+   };
+
+#if JSON_HAVE_PMR
+   /// Allocator using a std::pmr::memory_resource.
+   class MemoryResourceAllocator: public Allocator
+   {
+      std::pmr::memory_resource *resource_;
+   public:
+      explicit MemoryResourceAllocator(std::pmr::memory_resource *resource)
+         : resource_(resource)
+      {
+      }
+      void *allocate(size_t size) { return resource_->allocate(size, 8); }
+      void deallocate(void *p, size_t size) { resource_->deallocate(p, size, 8); }
+   };
+#endif
+
+   /////////////////////////////////////////////////////////////////////////////////////////////////
+
+   /// A set of paths that selects the parts of a document to keep, see Tree::parse(). A path is
+   /// a sequence of member names and array indexes, e.g. "children[*].name", "meta.id" or
+   /// "items[3]". "*" selects all members or elements, "" the whole document. Member names
+   /// cannot contain '.', ',', '[' or ']'. A selected value is kept with its whole subtree, its
+   /// ancestors only with the selected children. Unselected array elements before a selected
+   /// one become null, so the indexes stay the same. Containers that a path leads through are
+   /// kept even if nothing in them matches, e.g. "*.name" keeps every object member as {} or [].
+   /// Paths are compiled by add(). A Projection can then be shared by any number of threads.
+   class Projection
+   {
+      struct Node;
+      struct Paths;
+      Node *root_;
+      Paths *paths_;
+
+      Projection(const Projection&);    // not implemented
+      void operator=(const Projection&);        // not implemented
+
+      friend class ProjectionBuilder;
+   public:
+      Projection();
+
+      /// Compiles one path or several, separated by ','. Throws std::invalid_argument.
+      explicit Projection(const char *paths);
+      ~Projection();
+
+      /// Adds one path or several, separated by ','. Throws std::invalid_argument.
+      void add(const char *paths);
+   };
+
+   /////////////////////////////////////////////////////////////////////////////////////////////////
+
    class Tree
    {
    private:
       struct Chunk {
          char *eofs_;   // end of free space
          Chunk *next_;  // next chunk
+         size_t size_;  // size including this header
       };
 
       Chunk *head_;
+      Chunk *spare_;            // empty chunks retained by reset(), largest first
       Value* root_;
-      Value *parseInternal(char *source, const char **error_pos, const char **error_desc);
-      void parseInternal(char *source);
+      size_t chunkSize_;        // size of the next chunk
+      Allocator *allocator_;    // null: ::malloc()
+      Chunk *inline_;           // caller supplied buffer, never freed
+      unsigned threads_;        // for PARALLEL, 0: one per CPU
+      size_t minSegment_;       // minimum source bytes per thread
+      const char *source_;      // for ON_DEMAND: start of the source, for error offsets
+      ParseMode mode_;          // for ON_DEMAND
+      const Projection *projection_;    // during parse() with a Projection
+      struct Mapping;
+      Mapping *mappings_;       // files mapped by parseFile(), unmapped by reset()
+      KeyTable *keys_;          // INTERN_KEYS: names interned so far, in this Tree's memory
+      KeyDictionary *dictionary_;       // INTERN_KEYS: shared names, null if none
+      ShapeTable *shapes_;      // SHAPE_OBJECTS: Shapes created so far, in this Tree's memory
+      struct Segment;
+      struct PushState;
+      Chunk *newChunk(size_t size);
+      void freeChunks(Chunk *c);
+      void useBuffer(void *buffer, size_t size);
+      Chunk *takeSpare(size_t size);
+      void reserveSource(size_t length, ParseMode mode);
+      void parseInternal(char *source, const char *end, ParseMode mode);
+      char *parseNext(char *source, const char *end, ParseMode mode, IndexScanner *scanner,
+                      size_t offset);
+      bool parseParallel(char *source, const char *end, ParseMode mode);
+      void parseSegment(Segment *segment, const char *end, ParseMode mode);
+      void parseDeferred(Value *container);
+      void unmapFiles();
 
       Tree(const Tree&);                // not implemented
       void operator=(const Tree&);      // not implemented
+      friend class DocumentStream;
+      friend class KeyTable;
+      friend class LineParser;
+      friend class PushParser;
+      friend class ShapeTable;
+      friend struct Value;
    public:
       Tree();
       Tree(char *source, ParseMode mode = NON_DESTRUCTIVE);
       Tree(const char *source);
       Tree(const std::string &source);
+
+      /// Uses «allocator» for all memory. The allocator must outlive the Tree.
+      explicit Tree(Allocator &allocator);
+
+      /// Uses «buffer» as first chunk, so small documents need no heap allocation. More
+      /// memory comes from ::malloc() or «allocator». The buffer must outlive the Tree.
+      Tree(void *buffer, size_t size);
+      Tree(void *buffer, size_t size, Allocator &allocator);
       ~Tree();
 
+      /// Allocates memory that lives as long as the Tree. Chunks are allocated with
+      /// geometrically growing size.
       char *malloc(size_t size);
 
+      /// Makes sure that the next «size» bytes of small allocations need no system allocation.
+      /// Use as a hint if the size of the tree is known in advance. Parsing a length-delimited
+      /// source in place reserves the source length, a copied source is already in the arena.
+      /// Later chunks have their usual size.
+      void reserve(size_t size);
+
+      /// Destroys the document and frees all memory. The Tree can be reused.
+      void clear();
+
+      /// Destroys the document but keeps the largest chunks, up to «maxRetained» bytes, for
+      /// reuse by the next parse. A Tree that is reset and reused for documents of similar
+      /// size needs no system allocations in steady state. The inline buffer is always kept.
+      void reset(size_t maxRetained = (size_t) -1);
+
+      /// Returns the total size of the allocated chunks, in use or retained.
+      size_t capacity() const;
+
+      /// Sets the maximum number of threads used with PARALLEL (0: one per CPU) and the minimum
+      /// number of source bytes per thread. Smaller documents are parsed on the calling thread.
+      void setThreads(unsigned threads, size_t minSegmentSize = MIN_SEGMENT_SIZE)
+      {
+         threads_ = threads;
+         minSegment_ = minSegmentSize;
+      }
+
+      /// Makes INTERN_KEYS use «dictionary» instead of a table of this Tree, so member names are
+      /// shared by all Trees with the same dictionary. The dictionary must outlive the Tree.
+      void setKeyDictionary(KeyDictionary *dictionary)
+      {
+         dictionary_ = dictionary;
+         keys_ = 0;
+      }
+
       void parse(char *source, ParseMode mode = NON_DESTRUCTIVE);
       void parse(const char *source);
+      void parse(const char *source, ParseMode mode);
       void parse(const std::string &source);
 
+      /// Parses exactly «length» bytes, the source need not be NUL-terminated. A NUL character
+      /// within the source is a syntax error. The source is copied unless «mode» includes both
+      /// DESTRUCTIVE and PADDED, or ZERO_COPY and PADDED with source[length] being NUL. A source
+      /// parsed in place pre-sizes the arena to «length» with reserve().
+      void parse(const char *source, size_t length, ParseMode mode = NON_DESTRUCTIVE);
+      void parse(char *source, size_t length, ParseMode mode);
+
+      /// Parses the whole document, but builds only the parts selected by «projection»; the
+      /// rest is validated and dropped without allocating memory. ON_DEMAND and PARALLEL have
+      /// no effect.
+      void parse(const char *source, const Projection &projection,
+                 ParseMode mode = NON_DESTRUCTIVE);
+      void parse(const char *source, size_t length, const Projection &projection,
+                 ParseMode mode = NON_DESTRUCTIVE);
+
+      /// Parses the file «path» without reading it into a buffer first. The file is mapped into
+      /// memory privately; the mapping lives until reset(), clear() or destruction. With
+      /// ZERO_COPY it is read-only, otherwise the parse is DESTRUCTIVE on copy-on-write pages,
+      /// so only the pages with escaped or terminated strings are copied and the file is never
+      /// changed. Small files, and all files on systems without mmap(), are read into the Tree's
+      /// memory instead. Throws std::runtime_error if the file cannot be read.
+      void parseFile(const char *path, ParseMode mode = NON_DESTRUCTIVE);
+#if __cplusplus >= 201703L
+      void parse(std::string_view source, ParseMode mode = NON_DESTRUCTIVE)
+      {
+         parse(source.data(), source.size(), mode);
+      }
+#endif
+
       const Value& root() const;
 
+      /// With ON_DEMAND: checks the parts of the document that have not been parsed yet, without
+      /// building them. Throws SyntaxError for the first error.
+      void validate() const;
+
       /// Convenience methods for transparent root access.
       size_t length() const { return root_->length(); }
       Type type() const { return root_->type(); }
       const Value& get(int i) const { return root_->get(i); }
       const Value& get(const char *name) const { return root_->get(name); }
       int asInt() const { return root_->asInt(); }
+      int64_t asInt64() const { return root_->asInt64(); }
+      uint64_t asUint64() const { return root_->asUint64(); }
       double asDouble() const { return root_->asDouble(); }
       const char *asString() const { return root_->asString(); }
       bool asBool() const { return root_->asBool(); }
       const Value& operator[](int i) const { return root_->get(i); }
       const Value& operator[](const char *key) const { return root_->get(key); }
       const Value& operator[](const std::string &key) const { return root_->get(key); }
+      const Value& get(const Key &key) const { return root_->get(key); }
+      const Value& operator[](const Key &key) const { return root_->get(key); }
+   };
+
+   /////////////////////////////////////////////////////////////////////////////////////////////////
+
+   /// Member names shared by several Trees with INTERN_KEYS, see Tree::setKeyDictionary(). Each
+   /// name is stored once; names are never removed. Thread-safe.
+   class KeyDictionary
+   {
+      struct Lock;
+      Tree storage_;
+      KeyTable *table_;
+      Lock *lock_;
+
+      const char *intern(const char *name, size_t length, size_t hash);
+
+      KeyDictionary(const KeyDictionary&);      // not implemented
+      void operator=(const KeyDictionary&);     // not implemented
+      friend class KeyTable;
+   public:
+      KeyDictionary();
+      ~KeyDictionary();
+
+      /// Returns a Key for «name» that points to the dictionary's copy. Members of Trees using
+      /// the dictionary are found by comparing pointers.
+      Key key(const char *name);
+      Key key(const char *name, size_t length);
+
+      /// Number of names in the dictionary.
+      size_t size() const;
+   };
+
+   /////////////////////////////////////////////////////////////////////////////////////////////////
+
+   /// The type of a column, see Columns::add().
+   enum ColumnType {
+      COLUMN_DOUBLE,            // numbers, converted like Value::asDouble()
+      COLUMN_INT64,             // numbers, converted like Value::asInt64()
+      COLUMN_BOOL,              // booleans
+      COLUMN_STRING             // strings, pointer and length like asString() and stringLength()
+   };
+
+   /// Members of the objects in an array, copied into one contiguous typed buffer per member
+   /// name in a single pass over the array, see extract(). Row i holds the members of element i.
+   /// A null or missing member, or an element that is not an object, sets the row's bit in the
+   /// null bitmap and stores 0, false or "" with length 0. Buffers are aligned to 64 bytes and
+   /// padded with such rows to a multiple of 64 rows, so SIMD loops need no remainder. Members
+   /// are found with a Field, so with SHAPE_OBJECTS each cell costs an indexed load. Strings
+   /// point into the Tree and live as long as it does.
+   class Columns
+   {
+      struct Column;
+      struct Data;
+      Data *data_;
+
+      const Column &column(size_t column, ColumnType type) const;
+
+      Columns(const Columns&);          // not implemented
+      void operator=(const Columns&);   // not implemented
+   public:
+      Columns();
+      ~Columns();
+
+      /// Adds a column for the member «name» and returns its number, starting at 0. Sets
+      /// rows() to 0 until the next extract().
+      size_t add(const char *name, ColumnType type);
+
+      /// Replaces the rows of all columns with the elements of «array», reusing the buffers if
+      /// they are large enough. Throws std::invalid_argument if «array» is not an array or a
+      /// member does not match the type of its column, and std::out_of_range for COLUMN_INT64
+      /// numbers outside the int64 range.
+      void extract(const Value &array);
+
+      /// Returns the number of rows filled by the last extract().
+      size_t rows() const;
+
+      /// Return the buffer of «column». Throw std::invalid_argument if the column has a
+      /// different type, std::out_of_range if there is no such column.
+      const double *doubles(size_t column) const;
+      const int64_t *int64s(size_t column) const;
+      const bool *bools(size_t column) const;
+      const char *const *strings(size_t column) const;
+      const size_t *stringLengths(size_t column) const;
+
+      /// Returns the null bitmap of «column»: bit (row % 64) of word row / 64 is set if the row
+      /// is null. Throws std::out_of_range if there is no such column.
+      const uint64_t *nulls(size_t column) const;
+      bool isNull(size_t column, size_t row) const
+      {
+         return (nulls(column)[row / 64] >> (row % 64)) & 1;
+      }
+   };
+
+   /////////////////////////////////////////////////////////////////////////////////////////////////
+
+   /// A sequence of JSON documents in one buffer, such as JSON Lines / NDJSON. The documents
+   /// may be separated by white space and comments; each root must be an object or an array.
+   /// The source is copied or used in place according to the ParseMode, like Tree::parse().
+   class DocumentStream
+   {
+      char *buffer_;            // copy of the source, null if used in place
+      char *base_;
+      char *next_;              // where the next document starts, null at the end
+      const char *end_;         // null if NUL-terminated
+      ParseMode mode_;
+      IndexScanner *scanner_;   // STRUCTURAL_INDEX, shared by all documents
+      size_t offset_;
+      size_t length_;
+
+      void init(char *source, const char *end, ParseMode mode);
+
+      DocumentStream(const DocumentStream&);    // not implemented
+      void operator=(const DocumentStream&);    // not implemented
+   public:
+      DocumentStream(const char *source, ParseMode mode = NON_DESTRUCTIVE);
+      DocumentStream(char *source, ParseMode mode);
+      DocumentStream(const char *source, size_t length, ParseMode mode = NON_DESTRUCTIVE);
+      DocumentStream(char *source, size_t length, ParseMode mode);
+      ~DocumentStream();
+
+      /// Parses the next document into «tree» and returns true, or returns false at the end of
+      /// the source. Calls tree.reset() first, so the previous document is invalidated and its
+      /// memory reused; with «reset» false, previous documents stay valid as long as the Tree.
+      /// Throws SyntaxError with the offset in the source, the stream cannot continue then.
+      bool next(Tree &tree, bool reset = true);
+
+      /// Position and length of the last document in the source.
+      size_t offset() const { return offset_; }
+      size_t length() const { return length_; }
+   };
+
+   /// Receives the documents of parseLines().
+   class DocumentHandler
+   {
+   public:
+      virtual ~DocumentHandler() {}
+
+      /// Called for each document. «root» is valid during the call only, «offset» is its
+      /// position in the source. With «ordered» parsing, the calls come one at a time in source
+      /// order and «index» counts the documents. Otherwise they come concurrently from several
+      /// threads and «index» is (size_t) -1.
+      virtual void document(const Value &root, size_t offset, size_t index) = 0;
+   };
+
+   /// Parses JSON Lines (one or more documents per line, no line breaks within a document) on
+   /// «threads» threads, 0: one per CPU. The source is cut into blocks of lines. Each thread
+   /// parses its share of the blocks into its own Tree and steals blocks from other threads
+   /// when done, so a few very long lines do not hold up the others. Throws the first error in
+   /// source order; without «ordered», later documents may have been delivered already.
+   /// Blocks are always copied, ZERO_COPY, STRUCTURAL_INDEX and PARALLEL are ignored.
+   void parseLines(const char *source, size_t length, DocumentHandler &handler,
+                   ParseMode mode = NON_DESTRUCTIVE, unsigned threads = 0, bool ordered = false);
+
+   /////////////////////////////////////////////////////////////////////////////////////////////////
+
+   /// Parses a document that arrives in pieces of any size, e.g. from a socket. The text is
+   /// copied into the Tree and parsed as far as it goes with each feed(), so parsing overlaps
+   /// I/O and syntax errors are detected early. Only the last incomplete token is kept back.
+   /// ZERO_COPY, DESTRUCTIVE, PADDED, STRUCTURAL_INDEX and PARALLEL have no effect.
+   class PushParser
+   {
+      Tree &tree_;
+      ParseMode mode_;
+      Tree::PushState *state_;  // parser state at «parsed_», in the Tree's memory
+      char *buffer_;            // the text from «offset_» on
+      size_t capacity_;
+      size_t used_;
+      size_t parsed_;           // the parser has stopped here
+      size_t complete_;         // end of the text that is known to contain complete tokens
+      size_t offset_;           // source offset of «buffer_»
+      unsigned lexState_;       // string or comment state at «used_»
+
+      void parse(size_t end, bool more);
+
+      PushParser(const PushParser&);    // not implemented
+      void operator=(const PushParser&);        // not implemented
+   public:
+      /// Calls tree.reset(). The document is built in «tree».
+      explicit PushParser(Tree &tree, ParseMode mode = NON_DESTRUCTIVE);
+
+      /// Appends «length» bytes to the document. Throws SyntaxError with the offset in the
+      /// whole source, the parser cannot continue then.
+      void feed(const char *data, size_t length);
+
+      /// Parses the rest of the document and returns its root, which is also the Tree's root.
+      const Value& finish();
+
+      /// The document as far as it has been parsed, null if nothing has been parsed yet. Open
+      /// containers hold the elements parsed so far and are not indexed yet.
+      const Value *root() const { return tree_.root_; }
+   };
+
+   /////////////////////////////////////////////////////////////////////////////////////////////////
+
+   /// Pull parser: returns the tokens of a document one at a time and builds no tree. Validates
+   /// like Tree::parse(). The source is neither copied nor modified, names and strings point
+   /// into it and are not NUL-terminated (like ZERO_COPY). Strings with escape sequences are
+   /// unescaped into a buffer that is valid until the next call of next().
+   class Reader
+   {
+   public:
+      enum Token {
+         END,                   // after the root element
+         VALUE,                 // string, number, boolean or null
+         START_OBJECT,
+         END_OBJECT,
+         START_ARRAY,
+         END_ARRAY
+      };
+
+   private:
+      struct State;
+
+      char *buffer_;            // copy of the source, null if used in place
+      char *base_;
+      char *next_;              // the parser continues here
+      const char *end_;
+      State *state_;
+      Tree scratch_;            // unescaped strings of the current token
+      bool scratchUsed_;
+      Token token_;
+      Value value_;
+
+      void init(char *source, const char *end);
+
+      Reader(const Reader&);    // not implemented
+      void operator=(const Reader&);    // not implemented
+
+      friend class ReaderBuilder;
+   public:
+      /// Reads a NUL-terminated source, which must stay unchanged while the Reader is used.
+      explicit Reader(const char *source);
+
+      /// Reads «length» bytes. The source is copied unless «mode» includes PADDED and
+      /// source[length] is NUL.
+      Reader(const char *source, size_t length, ParseMode mode = NON_DESTRUCTIVE);
+      ~Reader();
+
+      /// Reads the next token. Returns END after the root element and at each call thereafter.
+      /// Throws SyntaxError with the offset in the source, the Reader cannot continue then.
+      Token next();
+
+      /// After START_OBJECT or START_ARRAY: skips the rest of the container, including its end,
+      /// so the next token is the one after it. token() becomes END_OBJECT or END_ARRAY. The
+      /// skipped text is only scanned for brackets, it is not validated. Does nothing after
+      /// other tokens.
+      void skip();
+
+      /// The last token returned by next().
+      Token token() const { return token_; }
+
+      /// After VALUE: the value. After START_OBJECT and START_ARRAY: an empty JOBJECT or JARRAY.
+      /// In both cases, name() is the member name, or "" for array elements.
+      const Value &value() const { return value_; }
+
+      /// Member name of the last token, not NUL-terminated, see nameLength().
+      const char *name() const { return value_.name_; }
+      size_t nameLength() const { return value_.nameLength(); }
+
+      /// Number of open containers.
+      int depth() const;
+   };
+
+   /////////////////////////////////////////////////////////////////////////////////////////////////
+
+   /// An entry of a Tape. Entries are stored in document order (pre-order): a container is
+   /// followed by its children, each followed by its own subtree.
+   struct TapeEntry {
+      /// The value's type (see Type).
+      unsigned char type_;
+
+      /// Value::NUMBER_xxx for numbers, plus LAST for the last child of a container.
+      unsigned char flags_;
+
+      unsigned short reserved_;
+
+      /// Offset of the name in the string area for object members, 0 otherwise. Names are
+      /// NUL-terminated and preceded by their length (4 bytes, native byte order).
+      uint32_t name_;
+
+      /// Length of the text for simple values, number of children for arrays and objects.
+      uint32_t length_;
+
+      union {
+         /// Strings and numbers: offset of the NUL-terminated text in the string area.
+         uint32_t text_;
+
+         /// Arrays and objects: number of entries in the subtree, including this one.
+         uint32_t skip_;
+      };
+
+      /// Numbers as in Value, 1 or 0 for booleans.
+      union {
+         uint64_t uint_;
+         double double_;
+      };
+
+      /// Flag: last child of its parent (or the root).
+      static const unsigned char LAST = 0x80;
+   };
+
+   /// Handle for a value in a Tape, the equivalent of «const Value&». Valid as long as the Tape.
+   class TapeValue
+   {
+      const TapeEntry *entry_;
+      const char *strings_;
+   public:
+      TapeValue(const TapeEntry *entry, const char *strings)
+         : entry_(entry), strings_(strings)
+      {
+      }
+
+      /// False for the end marker returned by children() and next().
+      bool valid() const { return entry_ != 0; }
+
+      /// The underlying tape entry.
+      const TapeEntry *entry() const { return entry_; }
+
+      Type type() const { return (Type) entry_->type_; }
+      const char *name() const;
+      size_t nameLength() const;
+      int asInt() const;
+      int64_t asInt64() const;
+      uint64_t asUint64() const;
+      double asDouble() const;
+      const char *asString() const;
+      size_t stringLength() const;
+      bool asBool() const;
+
+      /// Returns the number of array of object members, 0 for simple types.
+      size_t length() const
+      {
+         return (entry_->type_ == JARRAY || entry_->type_ == JOBJECT) ? entry_->length_ : 0;
+      }
+
+      /// Returns the first child or an invalid handle if the array/object is empty.
+      /// Throws if this is not an array or object.
+      TapeValue children() const;
+
+      /// Returns the next sibling or an invalid handle. Skips the subtree in O(1).
+      TapeValue next() const
+      {
+         if (entry_->flags_ & TapeEntry::LAST) {
+            return TapeValue(0, strings_);
+         }
+         const bool container = entry_->type_ == JARRAY || entry_->type_ == JOBJECT;
+         return TapeValue(entry_ + (container ? entry_->skip_ : 1), strings_);
+      }
+
+      /// Array element access.
+      TapeValue get(int i) const;
+      TapeValue operator[](int i) const { return get(i); }
+
+      /// Object member access. Returns the first member with the given name.
+      TapeValue get(const char *name) const;
+      TapeValue get(const std::string &key) const { return get(key.c_str()); }
+      TapeValue operator[](const char *key) const { return get(key); }
+      TapeValue operator[](const std::string &key) const { return get(key.c_str()); }
+   };
+
+   /// A JSON document stored as one flat array of TapeEntry plus a string area, as an
+   /// alternative to the linked Values of a Tree. Traversal reads memory sequentially and
+   /// subtrees can be skipped in O(1). The tape does not reference the source after parsing.
+   class Tape
+   {
+      TapeEntry *entries_;
+      char *strings_;
+      size_t size_;
+
+      Tape(const Tape&);                // not implemented
+      void operator=(const Tape&);      // not implemented
+   public:
+      Tape();
+      explicit Tape(const Value &root);
+      ~Tape();
+
+      /// Parses the source directly into the tape, without a Tree. The source is only read. The
+      /// length delimited form copies it unless «mode» includes PADDED and source[length] is NUL.
+      /// Of the options, only STRUCTURAL_INDEX applies. Throws SyntaxError.
+      void parse(const char *source, ParseMode mode = ZERO_COPY);
+      void parse(const char *source, size_t length, ParseMode mode = ZERO_COPY);
+
+      /// Replaces the contents with a copy of «root» and its subtree.
+      void assign(const Value &root);
+
+      /// Returns the number of entries.
+      size_t size() const { return size_; }
+
+      TapeValue root() const;
+
+      /// Convenience methods for transparent root access.
+      TapeValue get(int i) const { return root().get(i); }
+      TapeValue get(const char *name) const { return root().get(name); }
+      TapeValue operator[](int i) const { return root().get(i); }
+      TapeValue operator[](const char *key) const { return root().get(key); }
+      TapeValue operator[](const std::string &key) const { return root().get(key); }
    };
 
    /////////////////////////////////////////////////////////////////////////////////////////////////
@@ -153,6 +1082,36 @@ namespace Json {
 
    /////////////////////////////////////////////////////////////////////////////////////////////////
 
+   /// Base class for the handlers of parseEvents(). The parser calls the handler's methods by
+   /// name, so a handler defines the events it needs and inherits empty ones for the others.
+   /// Names and strings are not NUL-terminated and valid during the call only.
+   struct EventHandler {
+      void startObject() {}
+      void endObject() {}
+      void startArray() {}
+      void endArray() {}
+      void key(const char *, size_t) {}
+      void string(const char *, size_t) {}
+      void number(const Value &) {}             // a JNUMBER, use asInt(), asDouble(), ...
+      void boolean(bool) {}
+      void null() {}
+   };
+
+   /// Parses «source» like Tree::parse() and reports the tokens to «handler» instead of building
+   /// a tree. The source is neither copied nor modified. The only allocation is one buffer, reused
+   /// for the strings and names with escapes, which grows to the longest of them. Throws
+   /// SyntaxError.
+   template <class Handler>
+   void parseEvents(const char *source, Handler &handler);
+
+   /// Parses exactly «length» bytes. Unless «mode» includes PADDED and source[length] is NUL, the
+   /// source is first copied into a std::string of «length» + 1 bytes.
+   template <class Handler>
+   void parseEvents(const char *source, size_t length, Handler &handler,
+                    ParseMode mode = NON_DESTRUCTIVE);
+
+   /////////////////////////////////////////////////////////////////////////////////////////////////
+
    /// Simple, non-validating JSON formatter.
    /// Formats the JSON document in «source» and outputs formatted document via «emit()». «usr» is
    /// passed in the first argument to «emit()». Formatting is done with an indentation of 2 spaces.
@@ -164,6 +1123,581 @@ namespace Json {
    
    /// Formats and appends to the given string.
    void prettyPrint(char const *source, std::string &buffer);
+
+   /////////////////////////////////////////////////////////////////////////////////////////////////
+   // Implementation. The parser's state machine is shared by Tree, PushParser and parseEvents().
+   // It reports the document to a builder. Tree's builder in json.cc creates the Values, the
+   // one of parseEvents() calls the handler. All calls are resolved at compile time.
+
+   class Parser
+   {
+   public:
+      /// Maximum nesting depth of arrays and objects.
+      static const int MAX_DEPTH = 50;
+
+      /// Tokens that may come next.
+      enum {
+         T_CLOSE = 0x01,                // ']' or '}'
+         T_COMMA = 0x02,                // after a closing bracket at the end of a part
+         T_SIMPLE = 0x04,
+         T_OPEN = 0x08,                 // '{' or '['
+         T_KEY = 0x10
+      };
+
+      /// Parser state between two parts of the text. «Frame» is the builder's data for an open
+      /// container.
+      template <class Frame>
+      struct State {
+         Frame stack[MAX_DEPTH];
+         int tos;                       // innermost open container, -1 if none
+         uint64_t objects;              // bit i: stack[i] is an object
+         unsigned allowed;              // 0 after the root element
+         char *key;                     // name of the next object member
+         size_t keyLength;
+         bool more;                     // more text follows, see parse()
+
+         State() : tos(-1), objects(0), allowed(T_OPEN), key(0), keyLength(0), more(false) {}
+      };
+
+      /// Scanner for parseEvents(). Tree uses its own scanners, which are inlined. The source
+      /// ends at «end» or, if that is null, at the terminating NUL.
+      struct DefaultScanner {
+         const char *const limit_;
+
+         DefaultScanner(const char *source, const char *end)
+            : limit_(end ? end : source + strlen(source))
+         {
+         }
+
+         char *skipSpace(char *s)
+         {
+            while (*s == ' ' || *s == '\n' || *s == '\r' || *s == '\t') {
+               ++s;
+            }
+            return s;
+         }
+         char *stringEnd(char *) { return 0; }
+         char *stringSpecial(char *s) { return findStringSpecial(s, limit_); }
+      };
+
+      template <class Scanner, class Builder>
+      static bool parse(char *source, const char *end, ParseMode mode, Scanner &scanner,
+                        Builder &builder, State<typename Builder::Frame> *state, const char *stop,
+                        char **rest, const char **errorPosition, const char **errorMessage);
+
+      static char *findStringSpecial(char *s, const char *limit);
+      static char *unescape(char *s, char **wp, bool zeroCopy, const char **errorPosition,
+                            const char **errorMessage);
+      static double decodeDouble(const char *text, uint64_t mantissa, int exponent,
+                                 unsigned flags);
+      static bool eightDigits(const char *s, uint64_t *value);
+      static char *scanNumber(char *s, Value &number, const char **errorMessage);
+   };
+
+#define JSON_FAIL(pos, msg) \
+   *errorPosition = pos; \
+   *errorMessage = msg; \
+   return false
+#define JSON_EXPECT(x) if (!(allowed & (x))) { JSON_FAIL(s, "illegal token (" #x ")"); }
+#define JSON_IN_OBJECT() (((objects >> tos) & 1) != 0)
+#define JSON_IS_DIGIT(c) ((c) >= '0' && (c) <= '9')
+#define JSON_SKIP_SPACE() s = scanner.skipSpace(s)
+// A NUL before «end» is an error. «end» is null if the source is NUL-terminated.
+#define JSON_CHECK_NUL() if (s < end) { JSON_FAIL(s, "NUL character in input"); }
+
+   /// If the eight bytes at «s» are all digits, stores their value in «*value» and returns true.
+   /// The bytes are checked one by one, so nothing after the number is read, and then converted
+   /// as one word.
+   inline bool Parser::eightDigits(const char *s, uint64_t *value)
+   {
+      for (int i = 0; i < 8; ++i) {
+         if (!JSON_IS_DIGIT(s[i])) {
+            return false;
+         }
+      }
+      uint64_t word;
+      memcpy(&word, s, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+      word = __builtin_bswap64(word);
+#endif
+      // Combine pairs of digits, then pairs of pairs, then the two halves.
+      word -= 0x3030303030303030ull;
+      word = (word * 10 + (word >> 8)) & 0x00FF00FF00FF00FFull;
+      word = (word * 100 + (word >> 16)) & 0x0000FFFF0000FFFFull;
+      *value = (word * 10000 + (word >> 32)) & 0xFFFFFFFFull;
+      return true;
+   }
+
+   /// Scans the number at «s» into «number» (all but the name) and returns the text after it.
+   /// Returns null and sets «*errorMessage» if the number is malformed; the error is at its start.
+   inline char *Parser::scanNumber(char *s, Value &number, const char **errorMessage)
+   {
+      number.type_ = JNUMBER;
+      number.value_ = s;
+      unsigned flags = 0;
+      if (*s == '-') {
+         flags = Value::NUMBER_NEGATIVE;
+         ++s;
+      }
+      if (*s == '0' && JSON_IS_DIGIT(s[1])) {
+         *errorMessage = "leading 0 in number";
+         return 0;
+      }
+      if (!JSON_IS_DIGIT(*s) && (*s != '.')) {
+         *errorMessage = "missing digit after '-'";
+         return 0;
+      }
+
+      // Accumulate the digits while scanning, eight at a time while the mantissa is far from
+      // overflowing. "exact" is cleared if the mantissa does not fit in 64 bits (or in the odd
+      // "-.5" form that the grammar above lets through).
+      const uint64_t CHUNK_LIMIT = (~(uint64_t) 0 - 99999999) / 100000000;
+      uint64_t mantissa = 0;
+      uint64_t chunk;
+      bool exact = JSON_IS_DIGIT(*s);
+      bool nonzero = false;
+      do {
+         if (exact && mantissa <= CHUNK_LIMIT && eightDigits(s, &chunk)) {
+            mantissa = mantissa * 100000000 + chunk;
+            nonzero = nonzero || chunk != 0;
+            s += 8;
+            continue;
+         }
+         exact = exact && !__builtin_mul_overflow(mantissa, (uint64_t) 10, &mantissa)
+            && !__builtin_add_overflow(mantissa, (uint64_t) (*s - '0'), &mantissa);
+         nonzero = nonzero || (JSON_IS_DIGIT(*s) && *s != '0');
+         ++s;
+      } while (JSON_IS_DIGIT(*s));
+      if (*s == '.' || *s == 'e' || *s == 'E') {
+         int exponent = 0;
+         if (*s == '.') {
+            char *fraction = ++s;
+            while (JSON_IS_DIGIT(*s)) {
+               if (exact && mantissa <= CHUNK_LIMIT && eightDigits(s, &chunk)) {
+                  mantissa = mantissa * 100000000 + chunk;
+                  nonzero = nonzero || chunk != 0;
+                  s += 8;
+                  continue;
+               }
+               exact = exact && !__builtin_mul_overflow(mantissa, (uint64_t) 10, &mantissa)
+                  && !__builtin_add_overflow(mantissa, (uint64_t) (*s - '0'), &mantissa);
+               nonzero = nonzero || (*s != '0');
+               ++s;
+            }
+            exponent = -(int) (s - fraction);
+         }
+         if ((*s == 'e') || (*s == 'E')) {
+            ++s;
+            const bool negativeExponent = (*s == '-');
+            if ((*s == '+') || (*s == '-')) { ++s; }
+            if (!JSON_IS_DIGIT(*s)) {
+               *errorMessage = "missing digit in exponent";
+               return 0;
+            }
+            int e = 0;
+            do {
+               if (e < 100000) {
+                  e = e * 10 + (*s - '0');
+               }
+               ++s;
+            } while (JSON_IS_DIGIT(*s));
+            exponent += negativeExponent ? -e : e;
+         }
+         number.double_ = exact ? decodeDouble(number.value_, mantissa, exponent, flags)
+                                : strtod(number.value_, 0);
+      } else if (exact) {
+         flags |= Value::NUMBER_INTEGER;
+         number.uint_ = mantissa;
+      } else {
+         flags |= Value::NUMBER_OVERFLOW;
+         number.double_ = strtod(number.value_, 0);
+      }
+      if (!nonzero) {
+         flags |= Value::NUMBER_ZERO;
+      }
+      number.flags_ = flags;
+      number.length_ = s - number.value_;
+      return s;
+   }
+
+   /// Parses a document and reports it to «builder». Returns false on error or, with the error
+   /// message null, if there is no document but only comments.
+   /// With «state», parsing starts in «state» and the final state is stored there. If
+   /// «state->more» is set, parsing stops at «end», where the text must follow a structural
+   /// character. With «stop», parsing ends at this comma after an element of «stack[0]». With
+   /// «rest», parsing stops after the root element and «*rest» is set to the following text.
+   /// If builder.suspend() returns true after a token, parsing stops there and «*rest» is set
+   /// likewise; this requires «state», «rest» and ZERO_COPY. builder.defer() may take a nested
+   /// container as a whole and return the text after it, which is then treated like a simple
+   /// value; if it returns null, the container is parsed.
+   template <class Scanner, class Builder>
+   bool Parser::parse(char *source, const char *end, ParseMode mode, Scanner &scanner,
+                      Builder &builder, State<typename Builder::Frame> *state, const char *stop,
+                      char **rest, const char **errorPosition, const char **errorMessage)
+   {
+      typedef typename Builder::Frame Frame;
+      const bool zeroCopy = (mode & ZERO_COPY) != 0;
+      Frame stack[MAX_DEPTH];
+      int tos = -1;
+      uint64_t objects = 0;
+      unsigned allowed = T_OPEN;
+      char *key = 0;
+      size_t keyLength = 0;
+      char *s = source;
+      char *nullpp = 0;
+      char *nullp = 0;
+      bool suspended = false;
+
+      if (state) {
+         tos = state->tos;
+         for (int i = 0; i <= tos; ++i) {
+            stack[i] = state->stack[i];
+         }
+         objects = state->objects;
+         allowed = state->allowed;
+         key = state->key;
+         keyLength = state->keyLength;
+         JSON_SKIP_SPACE();
+         if (allowed == 0 && *s != 0) {
+            JSON_FAIL(s, "text after root element");
+         }
+         if (allowed & T_COMMA) {
+            // The previous part ended with a closing bracket, a comma may follow.
+            if (*s == ',') {
+               ++s;
+               allowed = JSON_IN_OBJECT() ? T_KEY : T_SIMPLE | T_OPEN;
+            } else if (*s != 0) {
+               allowed = T_CLOSE;
+            }
+         }
+      }
+
+      while (true) {
+         if (nullp) {
+            *nullp = 0;
+         }
+         nullp = nullpp;
+         nullpp = 0;
+
+         JSON_SKIP_SPACE();
+         if (*s == 0) {
+            JSON_CHECK_NUL();
+            break;
+         }
+
+         bool simple = false;
+
+         if (*s == '"') {
+            JSON_EXPECT(T_SIMPLE | T_KEY);
+            char *begin = s + 1;
+            size_t length;
+            char *close = scanner.stringEnd(s);
+            if (close != 0) {
+               if (!zeroCopy) {
+                  *close = 0;
+               }
+               length = close - begin;
+               s = close + 1;
+            } else {
+               s = scanner.stringSpecial(s + 1);
+               if (*s == '"') {
+                  if (!zeroCopy) {
+                     *s = 0;
+                  }
+                  length = s - begin;
+                  ++s;
+               } else {
+                  // Unescape in place from the first backslash on.
+                  char *wp = s;
+                  if (zeroCopy && *s == '\\') {
+                     // Unescape into a copy, the source must not be modified.
+                     const char *q = s;
+                     while (*q != 0 && *q != '"') {
+                        q += (q[0] == '\\' && q[1] != 0) ? 2 : 1;
+                     }
+                     char *copy = builder.allocate(q - begin + 1);
+                     memcpy(copy, begin, s - begin);
+                     wp = copy + (s - begin);
+                     begin = copy;
+                  }
+                  s = unescape(s, &wp, zeroCopy, errorPosition, errorMessage);
+                  if (s == 0) {
+                     return false;
+                  }
+                  length = wp - begin;
+               }
+               if (*s == 0) {
+                  JSON_CHECK_NUL();
+               }
+            }
+
+            if (allowed & T_KEY) {
+               key = builder.key(begin, length);
+               keyLength = length;
+               JSON_SKIP_SPACE();
+               if (*s != ':') {
+                  JSON_FAIL(s, "missing ':'");
+               }
+               ++s;
+               allowed = T_SIMPLE | T_OPEN;
+            } else {
+               builder.string(stack + tos, key, keyLength, begin, length);
+               simple = true;
+            }
+         } else if (JSON_IS_DIGIT(*s) || *s == '-') {
+            JSON_EXPECT(T_SIMPLE);
+            Value number;
+            number.name_ = "";
+            number.nameLength_ = 0;
+            const char *message;
+            s = scanNumber(s, number, &message);
+            if (s == 0) {
+               JSON_FAIL(number.value_, message);
+            }
+            builder.number(stack + tos, key, keyLength, number);
+            simple = true;
+         } else if (s[0] == 'n' && s[1] == 'u' && s[2] == 'l' && s[3] == 'l') {
+            JSON_EXPECT(T_SIMPLE);
+            builder.null(stack + tos, key, keyLength);
+            s += 4;
+            simple = true;
+         } else if (s[0] == 't' && s[1] == 'r' && s[2] == 'u' && s[3] == 'e') {
+            JSON_EXPECT(T_SIMPLE);
+            builder.boolean(stack + tos, key, keyLength, true);
+            s += 4;
+            simple = true;
+         } else if (s[0] == 'f' && s[1] == 'a' && s[2] == 'l' && s[3] == 's' && s[4] == 'e') {
+            JSON_EXPECT(T_SIMPLE);
+            builder.boolean(stack + tos, key, keyLength, false);
+            s += 5;
+            simple = true;
+         } else if (*s == '{' || *s == '[') {
+            JSON_EXPECT(T_OPEN);
+            const bool object = (*s == '{');
+            char *close = tos < 0 ? 0 : builder.defer(stack + tos, key, keyLength, s, end, object);
+            if (close != 0) {
+               // The builder has taken the container as a whole, to be parsed later.
+               s = close;
+               simple = true;
+            } else {
+               if (tos >= MAX_DEPTH - 1) {
+                  JSON_FAIL(s, "JSON nesting too deep");
+               }
+               allowed = object ? T_CLOSE | T_KEY : T_CLOSE | T_OPEN | T_SIMPLE;
+               ++s;
+               builder.open(tos < 0 ? 0 : stack + tos, stack + tos + 1, key, keyLength, object);
+               ++tos;
+               if (object) {
+                  objects |= (uint64_t) 1 << tos;
+               } else {
+                  objects &= ~((uint64_t) 1 << tos);
+               }
+               key = 0;
+            }
+         } else if (*s == '}' || *s == ']') {
+            JSON_EXPECT(T_CLOSE);
+            const bool object = (*s == '}');
+            if (JSON_IN_OBJECT() != object) {
+               JSON_FAIL(s, "bracket/brace mismatch");
+            }
+            ++s;     // skip ']' or '}'
+            builder.close(stack + tos, object);
+            --tos;   // pop from stack
+            if (tos < 0 && rest) {
+               *rest = s;
+               allowed = 0;
+               break;
+            }
+
+            JSON_SKIP_SPACE();
+            if (tos < 0) {
+               if (*s != 0) {
+                  JSON_FAIL(s, "text after root element");
+               }
+               JSON_CHECK_NUL();
+               allowed = 0;
+            } else {
+               if (*s == ',') {
+                  if (s == stop) {
+                     break;
+                  }
+                  ++s;
+                  allowed = JSON_IN_OBJECT() ? T_KEY : T_SIMPLE | T_OPEN;
+               } else {
+                  allowed = T_CLOSE;
+               }
+            }
+            key = 0;
+         } else if (*s == '/' && s[1] == '/') {
+            s += 2;
+            while (*s != 0 && *s != '\n') ++s;
+         } else if (*s == '/' && s[1] == '*') {
+            s += 2;
+            while (*s != 0 && (s[0] != '*' || s[1] != '/')) ++s;
+            if (*s == 0) {
+               JSON_CHECK_NUL();
+               JSON_FAIL(s, "unterminated comment");
+            }
+            s += 2;
+         } else {
+            JSON_FAIL(s, "syntax error");
+         }
+
+         if (simple) {
+            if (!zeroCopy) {
+               nullpp = s;
+            }
+            JSON_SKIP_SPACE();
+            if (*s == ',') {
+               if (s == stop) {
+                  break;
+               }
+               ++s;
+               allowed = JSON_IN_OBJECT() ? T_KEY : T_SIMPLE | T_OPEN;
+            } else {
+               allowed = T_CLOSE;
+            }
+         }
+
+         if (builder.suspend()) {
+            *rest = s;
+            suspended = true;
+            break;
+         }
+      }
+
+      if (nullp) {
+         *nullp = 0;
+      }
+
+      if (suspended) {
+         // The builder continues later at «*rest».
+      } else if (stop) {
+         // Stopped at the split point, which follows an element of the root container.
+         if (nullpp) {
+            *nullpp = 0;
+         }
+         if (s != stop) {
+            JSON_FAIL(s, "syntax error");
+         }
+      } else if (state && state->more) {
+         // Suspended at the end of the text so far, which follows a structural character.
+         if (allowed == T_CLOSE) {
+            allowed = T_CLOSE | T_COMMA;
+         }
+      } else {
+         if (tos >= 0) {
+            JSON_FAIL(s, "unmatched opening bracket/brace");
+         }
+         if (allowed == T_OPEN) {
+            *errorPosition = s;
+            *errorMessage = 0;
+            return false;
+         }
+      }
+
+      if (state) {
+         for (int i = 0; i <= tos; ++i) {
+            state->stack[i] = stack[i];
+         }
+         state->tos = tos;
+         state->objects = objects;
+         state->allowed = allowed;
+         state->key = key;
+         state->keyLength = keyLength;
+      }
+      return true;
+   }
+
+#undef JSON_FAIL
+#undef JSON_EXPECT
+#undef JSON_IN_OBJECT
+#undef JSON_IS_DIGIT
+#undef JSON_SKIP_SPACE
+#undef JSON_CHECK_NUL
+
+   /// Builder for parseEvents(), passes the tokens to the handler.
+   template <class Handler>
+   class EventBuilder
+   {
+      Handler &handler_;
+      std::string buffer_;      // strings with escapes
+
+   public:
+      struct Frame {};
+
+      explicit EventBuilder(Handler &handler) : handler_(handler) {}
+
+      bool suspend() const { return false; }
+      char *defer(Frame *, char *, size_t, char *, const char *, bool) { return 0; }
+
+      char *allocate(size_t size)
+      {
+         buffer_.resize(size);
+         return &buffer_[0];
+      }
+      char *key(char *name, size_t length)
+      {
+         handler_.key(name, length);
+         return name;
+      }
+      void string(Frame *, char *, size_t, char *value, size_t length)
+      {
+         handler_.string(value, length);
+      }
+      void number(Frame *, char *, size_t, const Value &number) { handler_.number(number); }
+      void boolean(Frame *, char *, size_t, bool value) { handler_.boolean(value); }
+      void null(Frame *, char *, size_t) { handler_.null(); }
+      void open(Frame *, Frame *, char *, size_t, bool object)
+      {
+         if (object) {
+            handler_.startObject();
+         } else {
+            handler_.startArray();
+         }
+      }
+      void close(Frame *, bool object)
+      {
+         if (object) {
+            handler_.endObject();
+         } else {
+            handler_.endArray();
+         }
+      }
+   };
+
+   template <class Handler>
+   void parseEvents(const char *source, Handler &handler)
+   {
+      EventBuilder<Handler> builder(handler);
+      Parser::DefaultScanner scanner(source, 0);
+      const char *errorPosition = 0;
+      const char *errorMessage = 0;
+      if (!Parser::parse((char *) source, 0, ZERO_COPY, scanner, builder, 0, 0, 0,
+                         &errorPosition, &errorMessage)) {
+         throw SyntaxError(errorPosition - source,
+                           errorMessage ? errorMessage : "empty JSON document");
+      }
+   }
+
+   template <class Handler>
+   void parseEvents(const char *source, size_t length, Handler &handler, ParseMode mode)
+   {
+      std::string copy;
+      if (!(mode & PADDED) || source[length] != 0) {
+         copy.assign(source, length);
+         source = copy.c_str();
+      }
+      EventBuilder<Handler> builder(handler);
+      Parser::DefaultScanner scanner(source, source + length);
+      const char *errorPosition = 0;
+      const char *errorMessage = 0;
+      if (!Parser::parse((char *) source, source + length, ZERO_COPY, scanner, builder, 0, 0, 0,
+                         &errorPosition, &errorMessage)) {
+         throw SyntaxError(errorPosition - source,
+                           errorMessage ? errorMessage : "empty JSON document");
+      }
+   }
 }
 
 #endif
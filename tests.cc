@@ -10,13 +10,16 @@
 #include "_pmu.h"
 #include "_test.h"
 #include "json.h"
+#include <algorithm>
 #include <errno.h>
 #include <fcntl.h>
 #include <float.h>
+#include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <vector>
@@ -59,6 +62,14 @@ static bool isNear(double a, double b, double epsilon)
    return (1 - epsilon) < (double)(a / b) && (double)(a / b) < (1 + epsilon);
 }
 
+/// std::to_string() for C++98.
+static std::string toString(long long n)
+{
+   char buffer[24];
+   snprintf(buffer, sizeof(buffer), "%lld", n);
+   return buffer;
+}
+
 static void assertInt(const Source& where, const Value& e, int value, const char *expr)
 {
    if (e.type() != JNUMBER) {fail(where, "%s: type is not NUMBER but %d", expr, e.type()); }
@@ -167,23 +178,68 @@ void print(Value *v, int indent = 0)
    fflush(stdout);
 }
 
-static void assertParserError(const Test::Source &where, const char *source, size_t errorOffset)
+static void assertParserError(const Test::Source &where, const char *source, size_t errorOffset,
+                              ParseMode mode)
 {
+   std::vector<char> buffer(source, source + strlen(source) + 1);
    try {
       Tree tree;
-      tree.parse(source);
-      fail(where, "Invalid JSON successfully parsed: %s", source);
+      tree.parse(&buffer[0], mode);
+      fail(where, "Invalid JSON successfully parsed (mode %x): %s", mode, source);
    }
    catch (const SyntaxError& e) {
       if ((errorOffset != (size_t) -1) && (e.offset_ != errorOffset)) {
-         fail(where, "Offset %u, expected %u. Message:\"%s\"\n",
+         fail(where, "Offset %u, expected %u (mode %x). Message:\"%s\"\n",
               (unsigned)e.offset_,
               (unsigned)errorOffset,
+              mode,
               e.what());
       }
    }
 }
 
+static void assertParserError(const Test::Source &where, const char *source, size_t errorOffset)
+{
+   assertParserError(where, source, errorOffset, NON_DESTRUCTIVE);
+   assertParserError(where, source, errorOffset, DESTRUCTIVE);
+   assertParserError(where, source, errorOffset, DESTRUCTIVE | STRUCTURAL_INDEX);
+   assertParserError(where, source, errorOffset, ZERO_COPY);
+}
+
+static void assertSameTree(const Test::Source &where, const Value &a, const Value &b)
+{
+   if (a.type() != b.type()) {
+      fail(where, "type mismatch: %d vs. %d", a.type(), b.type());
+   }
+   if (a.nameLength() != b.nameLength() || memcmp(a.name_, b.name_, a.nameLength())) {
+      fail(where, "key mismatch: \"%.*s\" vs. \"%.*s\"",
+           (int) a.nameLength(), a.name_, (int) b.nameLength(), b.name_);
+   }
+   if (a.type() == JOBJECT || a.type() == JARRAY) {
+      const Value *x = a.children();
+      const Value *y = b.children();
+      for (; x && y; x = x->next_, y = y->next_) {
+         assertSameTree(where, *x, *y);
+      }
+      if (x || y) {
+         fail(where, "length mismatch for \"%s\"", a.name_);
+      }
+   } else if (a.stringLength() != b.stringLength()
+              || memcmp(a.asString(), b.asString(), a.stringLength())) {
+      fail(where, "value mismatch: \"%.*s\" vs. \"%.*s\"",
+           (int) a.stringLength(), a.asString(), (int) b.stringLength(), b.asString());
+   }
+}
+
+/// Parses «source» with and without «mode» and compares the results.
+static void assertSameTree(const Test::Source &where, const char *source, ParseMode mode)
+{
+   Tree expected(source);
+   std::vector<char> buffer(source, source + strlen(source) + 1);
+   Tree actual(&buffer[0], mode);
+   assertSameTree(where, expected.root(), actual.root());
+}
+
 TEST(Api)
 {
    const char SRC[] = "[1,{\"a\":true},3]";
@@ -211,6 +267,7 @@ TEST(Api)
 }
 
 #define ASSERT_PARSER_ERROR(source,errorOffset) assertParserError(HERE,source,errorOffset);
+#define ASSERT_SAME_TREE(source,mode) assertSameTree(HERE,source,mode)
 
 TEST(BadRoot_String)
 {
@@ -452,6 +509,29 @@ TEST(BadString_LineBreak2)
    ASSERT_PARSER_ERROR("[\"escaped line\\\nbreak\"]",14);
 }
 
+static void assertParserError(const Test::Source &where, const std::string &source, size_t errorOffset)
+{
+   try {
+      Tree tree;
+      tree.parse(source.data(), source.size());
+      fail(where, "Invalid JSON successfully parsed");
+   }
+   catch (const SyntaxError& e) {
+      if (e.offset_ != errorOffset) {
+         fail(where, "Offset %u, expected %u. Message:\"%s\"\n",
+              (unsigned)e.offset_, (unsigned)errorOffset, e.what());
+      }
+   }
+}
+
+TEST(EmbeddedNul)
+{
+   ASSERT_PARSER_ERROR(std::string("[1,\0 2]", 7), 3);
+   ASSERT_PARSER_ERROR(std::string("[\"a\0b\"]", 7), 3);
+   ASSERT_PARSER_ERROR(std::string("[] \0", 4), 3);
+   ASSERT_PARSER_ERROR(std::string("[/*\0*/]", 8), 3);
+}
+
 //TEST(DuplicateAttribute)    { ASSERT_PARSER_ERROR("{\"A\":0,\"A\":0}",7); }
 
 TEST(EmptyObject)
@@ -523,6 +603,81 @@ TEST(Floats)
    ASSERT_FLOAT(doc.get(4),-1.5e-5);
 }
 
+TEST(Int64)
+{
+   Tree doc("[9223372036854775807,-9223372036854775808,18446744073709551615,"
+            "9223372036854775808,-9223372036854775809,18446744073709551616,-0,1.5e3,-1e300]");
+   ASSERT(doc.get(0).asInt64() == 9223372036854775807LL);
+   ASSERT(doc.get(1).asInt64() == -9223372036854775807LL - 1);
+   ASSERT(doc.get(2).asUint64() == 18446744073709551615ULL);
+   ASSERT_THROWS(doc.get(2).asInt64(), std::out_of_range);
+   ASSERT(doc.get(3).asUint64() == 9223372036854775808ULL);
+   ASSERT_THROWS(doc.get(3).asInt64(), std::out_of_range);
+   ASSERT_THROWS(doc.get(4).asInt64(), std::out_of_range);
+   ASSERT_THROWS(doc.get(4).asUint64(), std::out_of_range);
+   ASSERT_THROWS(doc.get(5).asUint64(), std::out_of_range);
+   ASSERT(doc.get(5).asDouble() == 18446744073709551616.0);
+   ASSERT(doc.get(6).asInt64() == 0 && doc.get(6).asUint64() == 0);
+   ASSERT(doc.get(7).asInt64() == 1500);
+   ASSERT_THROWS(doc.get(8).asInt64(), std::out_of_range);
+   ASSERT(doc.get(0).asInt() == 2147483647);
+   ASSERT(doc.get(1).asInt() == -2147483647 - 1);
+   ASSERT(doc.get(7).asInt() == 1500);
+}
+
+TEST(FloatsAreCorrectlyRounded)
+{
+   static const char *const numbers[] = {
+      "0.1", "0.3", "-2.5e-3", "1e22", "1e23", "9007199254740993", "9007199254740993.0",
+      "123456789012345678901234567890", "2.2250738585072011e-308", "4.9e-324", "1e-400",
+      "1.7976931348623157e308", "1e309", "0.000001234567890123456789", "3.14159265358979323846",
+      "-0.0", "-0", "89255.0e-22", "8.98846567431158e307"
+   };
+   for (size_t i = 0; i < sizeof(numbers) / sizeof(numbers[0]); ++i) {
+      Tree doc((std::string("[") + numbers[i] + "]").c_str());
+      const double expected = strtod(numbers[i], 0);
+      const double actual = doc.get(0).asDouble();
+      if (memcmp(&actual, &expected, sizeof(double)) != 0) {
+         fail(HERE, "%s: %.17g != %.17g", numbers[i], actual, expected);
+      }
+   }
+   Tree tiny("[1e-400]");
+   ASSERT(tiny.get(0).asBool() == true);
+}
+
+TEST(LongDigitSequences)
+{
+   // Digits are accumulated eight at a time; check the chunk boundaries and the 64-bit limit.
+   static const char *const integers[] = {
+      "12345678", "123456789", "1234567890123456", "12345678901234567", "100000000",
+      "9999999999999999", "18446744073709551615", "-9223372036854775808", "00000000"
+   };
+   for (size_t i = 0; i < sizeof(integers) / sizeof(integers[0]); ++i) {
+      const std::string source = std::string("[") + integers[i] + "," + integers[i] + "]";
+      if (integers[i][0] == '0') {
+         ASSERT_THROWS(Tree(source.c_str()), SyntaxError);
+         continue;
+      }
+      Tree doc(source.c_str());
+      const char *digits = integers[i] + (integers[i][0] == '-');
+      ASSERT(doc.get(0).uint_ == strtoull(digits, 0, 10));
+      ASSERT(doc.get(0).flags_ & Value::NUMBER_INTEGER);
+   }
+   static const char *const numbers[] = {
+      "18446744073709551616", "184467440737095516150", "0.00000000", "0.000000001",
+      "1.2345678901234567", "12345678.12345678e-3", "99999999999999999999.5", "-0.0000000000000000"
+   };
+   for (size_t i = 0; i < sizeof(numbers) / sizeof(numbers[0]); ++i) {
+      Tree doc((std::string("[") + numbers[i] + "]").c_str());
+      const double expected = strtod(numbers[i], 0);
+      const double actual = doc.get(0).asDouble();
+      if (memcmp(&actual, &expected, sizeof(double)) != 0) {
+         fail(HERE, "%s: %.17g != %.17g", numbers[i], actual, expected);
+      }
+      ASSERT(doc.get(0).asBool() == (expected != 0));
+   }
+}
+
 TEST(Boolean)
 {
    Tree doc("[true,false]");
@@ -639,6 +794,55 @@ TEST(Strings)
    ASSERT_STRING(doc.get(4),"embedded quotes:\"");
 }
 
+TEST(LongStrings)
+{
+   Tree doc(
+      "[\"0123456789012345678901234567890123456789\","
+      "\"0123456789012345678901234567890123456789\\n\","
+      "\"0123456789012345678901234567890123456789\\t0123456789012345678901234567890123456789\"]");
+   ASSERT_STRING(doc.get(0), "0123456789012345678901234567890123456789");
+   ASSERT_STRING(doc.get(1), "0123456789012345678901234567890123456789\n");
+   ASSERT_STRING(doc.get(2),
+                 "0123456789012345678901234567890123456789\t0123456789012345678901234567890123456789");
+   ASSERT_PARSER_ERROR("[\"0123456789012345678901234567890123456789\t\"]", 42);
+   ASSERT_PARSER_ERROR("[\"0123456789012345678901234567890123456789", 42);
+}
+
+/// Copies «doc» so that its terminating NUL is the last byte of the first of «pages».
+static char *atPageEnd(char *pages, size_t page, const char *doc)
+{
+   const size_t length = strlen(doc);
+   return (char *) memcpy(pages + page - length - 1, doc, length + 1);
+}
+
+TEST(SourceAtPageEnd)
+{
+   // The page after the source is inaccessible, the scanners must not read past the NUL.
+   const size_t page = sysconf(_SC_PAGESIZE);
+   char *pages = (char *) mmap(0, 2 * page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON,
+                               -1, 0);
+   ASSERT(pages != MAP_FAILED);
+   ASSERT(mprotect(pages + page, page, PROT_NONE) == 0);
+   static const char *const docs[] = {
+      "[\"0123456789012345678901234567890123456789\"]",
+      "{\"a\":\"0123456789012345678901234567890123456789\\n\",\"b\":12345678901234567}",
+   };
+   const ParseMode modes[] = {
+      DESTRUCTIVE, DESTRUCTIVE | STRUCTURAL_INDEX, ZERO_COPY, ZERO_COPY | STRUCTURAL_INDEX
+   };
+   for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+      for (size_t d = 0; d < sizeof(docs) / sizeof(docs[0]); ++d) {
+         Tree expected(docs[d]);
+         Tree actual(atPageEnd(pages, page, docs[d]), modes[m]);
+         assertSameTree(HERE, expected.root(), actual.root());
+      }
+      Tree tree;
+      ASSERT_THROWS(tree.parse(atPageEnd(pages, page, "[\"0123456789012345678901234567890123"),
+                               modes[m]), SyntaxError);
+   }
+   munmap(pages, 2 * page);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 TEST(Null)
@@ -799,6 +1003,1441 @@ TEST(MultiLineComments)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
+TEST(LengthDelimited)
+{
+   const char source[] = "[1,\"two\"]garbage";
+   Tree doc;
+   doc.parse(source, 9);
+   ASSERT_ARRAY(doc.root(), 2);
+   ASSERT_STRING(doc.get(1), "two");
+   ASSERT_PARSER_ERROR(std::string(source, 8), 8);
+}
+
+TEST(LengthDelimitedPadded)
+{
+   char buffer[9 + PADDING];
+   memcpy(buffer, "[1,\"two\"]", 9);
+   memset(buffer + 9, 'x', PADDING);
+   Tree doc;
+   doc.parse(buffer, 9, DESTRUCTIVE | PADDED);
+   ASSERT_STRING(doc.get(1), "two");
+   ASSERT(doc.get(1).asString() == buffer + 4);
+}
+
+#if __cplusplus >= 201703L
+TEST(StringView)
+{
+   std::string_view source("[1,2,3]...", 7);
+   Tree doc;
+   doc.parse(source);
+   ASSERT_ARRAY(doc.root(), 3);
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST(ZeroCopy)
+{
+   const char source[] =
+      "{\"a\":\"plain\", \"b\\n\":\"esc\\taped\", \"n\":-12.5e1, \"t\":true, \"l\":[1,\"x\"]}";
+   const std::string copy(source);
+   Tree doc;
+   doc.parse(source, ZERO_COPY);
+   ASSERT(copy == source);
+
+   const Value &a = doc["a"];
+   ASSERT(a.asString() == source + 6);
+   ASSERT(a.stringLength() == 5);
+   ASSERT(a.nameLength() == 1);
+   const Value &b = doc["b\n"];
+   ASSERT(b.stringLength() == 8);
+   ASSERT_EQ(b.asString(), "esc\taped");
+   ASSERT(doc["n"].stringLength() == 7);
+   ASSERT_FLOAT(doc["n"], -125);
+   ASSERT_BOOL(doc["t"], true);
+   ASSERT_INT(doc["l"][0], 1);
+   ASSERT(doc["l"][1].stringLength() == 1);
+   ASSERT_NULL(doc["plain"]);
+
+   ASSERT_SAME_TREE(source, ZERO_COPY);
+   ASSERT_SAME_TREE(source, ZERO_COPY | STRUCTURAL_INDEX);
+}
+
+TEST(ZeroCopyLengthDelimited)
+{
+   const std::string source = "[\"abc\", 1]";
+   Tree doc;
+   doc.parse(source.c_str(), source.size(), ZERO_COPY | PADDED);
+   ASSERT(doc[0].asString() == source.c_str() + 2);
+   Tree doc2;
+   doc2.parse(source.c_str(), source.size(), ZERO_COPY);    // not padded: copies
+   ASSERT(doc2[0].asString() != source.c_str() + 2);
+   ASSERT_PARSER_ERROR(std::string(source.c_str(), 5), 5);
+}
+
+TEST(LongNames)
+{
+   std::string name(70000, 'n');
+   std::string source = "{\"" + name + "\":1,\"" + name + "x\":2}";
+   for (int i = 0; i < 2; ++i) {
+      Tree doc;
+      doc.parse(source.c_str(), i == 0 ? NON_DESTRUCTIVE : ZERO_COPY);
+      ASSERT_INT(doc[name], 1);
+      ASSERT_INT(doc[name + "x"], 2);
+      ASSERT(doc[name].nameLength() == 70000);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST(ObjectIndex)
+{
+   // Duplicate names: the first member wins, as without index.
+   std::string source = "{\"k3\":\"first\",";
+   for (int i = 0; i < 100; ++i) {
+      source += "\"k" + toString(i) + "\":" + toString(i) + ",";
+   }
+   source += "\"" + std::string(70000, 'n') + "\":-1,\"sub\":{\"a\":1,\"b\":2},\"k3\":3}";
+   const ParseMode modes[] = { INDEX_OBJECTS, LAZY_INDEX, ZERO_COPY | INDEX_OBJECTS };
+   for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+      Tree doc;
+      doc.parse(source.c_str(), modes[m]);
+      ASSERT(doc.root().flags_ == ((modes[m] & LAZY_INDEX) ? Value::OBJECT_LAZY
+                                                            : Value::OBJECT_INDEXED));
+      ASSERT(std::string(doc["k3"].asString(), doc["k3"].stringLength()) == "first");
+      ASSERT(doc.root().flags_ == Value::OBJECT_INDEXED);
+      for (int i = 0; i < 100; ++i) {
+         if (i != 3) {
+            ASSERT_INT(doc["k" + toString(i)], i);
+         }
+      }
+      ASSERT_INT(doc[std::string(70000, 'n')], -1);
+      ASSERT(doc["k100"].type() == JNULL);
+      ASSERT(doc["k"].type() == JNULL);
+      ASSERT_INT(doc["sub"]["b"], 2);
+      ASSERT(doc["sub"].flags_ == 0);     // too small for an index
+   }
+}
+
+TEST(Keys)
+{
+#if __cplusplus >= 201402L
+   static constexpr Key NAME("name");
+   static_assert(NAME.length_ == 4, "constexpr Key");
+#else
+   static const Key NAME("name");
+#endif
+   std::string source = "{\"name\":1,\"\":2,\"abcdefgh\":3,\"abcdefgh1\":4,\"abcdefgh2\":5,"
+      "\"a\\u0062\":6,\"" + std::string(70000, 'n') + "\":7,";
+   for (int i = 0; i < 20; ++i) {
+      source += "\"k" + toString(i) + "\":" + toString(i) + ",";
+   }
+   source += "\"name\":8}";
+   static const char *const names[] = {
+      "name", "", "abcdefgh", "abcdefgh1", "abcdefgh2", "ab", "abcdefg", "abcdefgh3", "k7", "x"
+   };
+   const ParseMode modes[] = { NON_DESTRUCTIVE, ZERO_COPY, INDEX_OBJECTS, LAZY_INDEX, ON_DEMAND };
+   for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+      Tree doc;
+      doc.parse(source.c_str(), modes[m]);
+      ASSERT_INT(doc[NAME], 1);
+      for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+         ASSERT(&doc[Key(names[i])] == &doc[names[i]]);
+      }
+      const std::string longName(70000, 'n');
+      ASSERT_INT(doc.get(Key(longName)), 7);
+      ASSERT(doc[Key(longName + "n")].type() == JNULL);
+      ASSERT(doc[Key(longName.c_str(), 69999)].type() == JNULL);
+      ASSERT_INT(doc[Key("abcdefgh1xyz", 9)], 4);
+   }
+   Tree array("[1]");
+   ASSERT_THROWS(array[NAME], std::invalid_argument);
+}
+
+TEST(InternKeys)
+{
+   const char *source = "[{\"a\":1,\"bb\":2},{\"a\":3,\"ab\":4},{\"a\\u0062\":5,\"a\":{\"a\":6}}]";
+   const ParseMode modes[] = {
+      NON_DESTRUCTIVE, DESTRUCTIVE, ZERO_COPY, STRUCTURAL_INDEX, INDEX_OBJECTS, ON_DEMAND
+   };
+   for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+      ASSERT_SAME_TREE(source, modes[m] | INTERN_KEYS);
+      Tree doc;
+      std::string copy(source);
+      doc.parse(&copy[0], modes[m] | INTERN_KEYS);
+      ASSERT(doc[0]["a"].name_ == doc[1]["a"].name_);
+      ASSERT(doc[0]["a"].name_ == doc[2]["a"]["a"].name_);
+      ASSERT(doc[1]["ab"].name_ == doc[2]["ab"].name_);
+      ASSERT(strcmp(doc[2]["ab"].name_, "ab") == 0);        // also with ZERO_COPY
+      ASSERT_INT(doc[2][Key("ab")], 5);
+   }
+
+   // Trees with the same dictionary share the names.
+   KeyDictionary dictionary;
+   const Key a = dictionary.key("a");
+   Tree t1;
+   Tree t2;
+   t1.setKeyDictionary(&dictionary);
+   t2.setKeyDictionary(&dictionary);
+   t1.parse(source, INTERN_KEYS);
+   t2.parse("{\"ab\":7,\"a\":8}", ZERO_COPY | INTERN_KEYS);
+   ASSERT(t1[0]["a"].name_ == a.name_ && t2["a"].name_ == a.name_);
+   ASSERT(t1[1]["ab"].name_ == t2["ab"].name_);
+   ASSERT(dictionary.size() == 3);
+   ASSERT_INT(t2[a], 8);
+   ASSERT_INT(t2[dictionary.key("ab")], 7);
+   ASSERT(t2[dictionary.key("b")].type() == JNULL);
+   ASSERT(dictionary.size() == 4);
+
+   // Also with PARALLEL, where each thread interns into the dictionary.
+   std::string big = "[";
+   for (int i = 0; i < 2000; ++i) {
+      big += "{\"a\":1,\"x" + toString(i % 10) + "\":2},";
+   }
+   big += "{}]";
+   Tree parallel;
+   parallel.setKeyDictionary(&dictionary);
+   parallel.setThreads(4, 1000);
+   parallel.parse(big.c_str(), PARALLEL | INTERN_KEYS);
+   ASSERT_SAME_TREE(big.c_str(), PARALLEL | INTERN_KEYS);
+   for (size_t i = 0; i < 2000; ++i) {
+      ASSERT(parallel[i]["a"].name_ == a.name_);
+   }
+   ASSERT(dictionary.size() == 14);
+
+   // Long names are not interned.
+   const std::string longName(70000, 'n');
+   Tree doc;
+   doc.parse(("[{\"" + longName + "\":1},{\"" + longName + "\":2}]").c_str(), INTERN_KEYS);
+   ASSERT_INT(doc[1][longName], 2);
+   ASSERT_INT(doc[1][Key(longName)], 2);
+}
+
+TEST(Shapes)
+{
+   const char *source = "[{\"a\":1,\"b\":\"x\"},{\"a\":2,\"b\":[3]},{\"b\":3,\"a\":4},{},"
+      "{\"a\":5,\"b\":6,\"a\":7},{\"a\":8,\"b\":{\"a\":9,\"b\":10}}]";
+   const ParseMode modes[] = {
+      NON_DESTRUCTIVE, DESTRUCTIVE, ZERO_COPY, STRUCTURAL_INDEX, INDEX_OBJECTS, LAZY_INDEX,
+      ON_DEMAND, INTERN_KEYS
+   };
+   for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+      ASSERT_SAME_TREE(source, modes[m] | SHAPE_OBJECTS);
+      Tree doc;
+      std::string copy(source);
+      doc.parse(&copy[0], modes[m] | SHAPE_OBJECTS);
+      const Shape *ab = doc[0].shape();
+      ASSERT(ab != 0 && ab->size() == 2);
+      ASSERT(strcmp(ab->name(0), "a") == 0 && ab->nameLength(1) == 1);
+      ASSERT(ab->slot("b") == 1 && ab->slot("c") == -1);
+      ASSERT(doc[1].shape() == ab && doc[5].shape() == ab && doc[5]["b"].shape() == ab);
+      ASSERT(doc[2].shape() != 0 && doc[2].shape() != ab && doc[2].shape()->slot("a") == 1);
+      ASSERT(doc[3].shape() == 0 && doc.root().shape() == 0 && doc[0]["a"].shape() == 0);
+      ASSERT(doc[4].shape()->size() == 3 && doc[4].shape()->slot("a") == 0);
+      ASSERT_INT(doc[2][1], 4);
+      ASSERT_INT(doc[4]["a"], 5);
+      ASSERT_INT(doc[4][Key("a")], 5);
+
+      Field a("a");
+      Field c("c");
+      const int expected[] = {1, 2, 4, 0, 5, 8};
+      for (int i = 0; i < 6; ++i) {
+         ASSERT(i == 3 ? doc[i][a].type() == JNULL : doc[i][a].asInt() == expected[i]);
+         ASSERT(doc[i][c].type() == JNULL);
+      }
+      ASSERT_INT(doc[5]["b"][a], 9);
+      ASSERT_THROWS(doc[0]["a"][a], std::invalid_argument);
+   }
+
+   // A Field is not confused by a new Shape at the address of an old one.
+   Tree doc;
+   Field b("b");
+   doc.parse("[{\"a\":1,\"b\":2}]", SHAPE_OBJECTS);
+   ASSERT_INT(doc[0][b], 2);
+   doc.parse("[{\"b\":3,\"a\":4}]", SHAPE_OBJECTS);
+   ASSERT_INT(doc[0][b], 3);
+
+   // With PARALLEL, each thread has its own Shapes.
+   std::string big = "[";
+   for (int i = 0; i < 2000; ++i) {
+      big += "{\"a\":" + toString(i) + ",\"x" + toString(i % 3) + "\":2},";
+   }
+   big += "{}]";
+   Tree parallel;
+   parallel.setThreads(4, 1000);
+   parallel.parse(big.c_str(), PARALLEL | SHAPE_OBJECTS);
+   ASSERT_SAME_TREE(big.c_str(), PARALLEL | SHAPE_OBJECTS);
+   Field a("a");
+   for (int i = 0; i < 2000; ++i) {
+      ASSERT(parallel[i].shape() != 0 && parallel[i][a].asInt() == i);
+   }
+
+   // Objects with long names have no Shape.
+   const std::string longName(70000, 'n');
+   doc.parse(("[{\"" + longName + "\":1,\"a\":2}]").c_str(), SHAPE_OBJECTS);
+   ASSERT(doc[0].shape() == 0);
+   ASSERT_INT(doc[0][longName], 1);
+   ASSERT_INT(doc[0][a], 2);
+}
+
+TEST(Columns)
+{
+   const char *source = "[{\"id\":1,\"price\":2.5,\"ok\":true,\"tag\":\"a\\u0062\"},"
+      "{\"tag\":\"xyz\",\"id\":-2,\"price\":3,\"ok\":false},"
+      "{\"id\":null,\"price\":null,\"ok\":null,\"tag\":null},"
+      "7,{},{\"id\":9007199254740993,\"price\":-1e300,\"ok\":true,\"tag\":\"\",\"x\":[]}]";
+   const ParseMode modes[] = {
+      NON_DESTRUCTIVE, ZERO_COPY, INDEX_OBJECTS, ON_DEMAND, SHAPE_OBJECTS, ZERO_COPY | SHAPE_OBJECTS
+   };
+   for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+      Tree doc;
+      doc.parse(source, modes[m]);
+      Columns columns;
+      ASSERT(columns.add("id", COLUMN_INT64) == 0);
+      ASSERT(columns.add("price", COLUMN_DOUBLE) == 1);
+      ASSERT(columns.add("ok", COLUMN_BOOL) == 2);
+      ASSERT(columns.add("tag", COLUMN_STRING) == 3);
+      ASSERT(columns.add("missing", COLUMN_DOUBLE) == 4);
+      columns.extract(doc.root());
+      ASSERT(columns.rows() == 6);
+
+      const int64_t *id = columns.int64s(0);
+      const double *price = columns.doubles(1);
+      const bool *ok = columns.bools(2);
+      const char *const *tag = columns.strings(3);
+      const size_t *tagLength = columns.stringLengths(3);
+      ASSERT(id[0] == 1 && id[1] == -2 && id[2] == 0 && id[3] == 0 && id[5] == 9007199254740993);
+      ASSERT(price[0] == 2.5 && price[1] == 3.0 && price[2] == 0.0 && price[5] == -1e300);
+      ASSERT(ok[0] && !ok[1] && !ok[2] && !ok[4] && ok[5]);
+      ASSERT(tagLength[0] == 2 && !memcmp(tag[0], "ab", 2));
+      ASSERT(tagLength[1] == 3 && !memcmp(tag[1], "xyz", 3));
+      ASSERT(tagLength[2] == 0 && tag[2][0] == 0 && tagLength[5] == 0);
+      for (size_t c = 0; c < 4; ++c) {
+         ASSERT(columns.nulls(c)[0] == 0x1C);   // rows 2 (null), 3 (not an object) and 4 (missing)
+      }
+      ASSERT(columns.nulls(4)[0] == 0x3F);
+      ASSERT(columns.isNull(0, 3) && !columns.isNull(0, 5));
+
+      // Aligned and padded with zero rows.
+      ASSERT((uintptr_t) id % 64 == 0 && (uintptr_t) price % 64 == 0 && (uintptr_t) ok % 64 == 0);
+      ASSERT((uintptr_t) tag % 64 == 0 && (uintptr_t) tagLength % 64 == 0);
+      ASSERT((uintptr_t) columns.nulls(2) % 64 == 0);
+      for (size_t row = 6; row < 64; ++row) {
+         ASSERT(id[row] == 0 && price[row] == 0.0 && !ok[row] && tagLength[row] == 0);
+      }
+
+      ASSERT_THROWS(columns.doubles(0), std::invalid_argument);
+      ASSERT_THROWS(columns.int64s(5), std::out_of_range);
+      ASSERT_THROWS(columns.nulls(5), std::out_of_range);
+      ASSERT_THROWS(columns.extract(doc[0]), std::invalid_argument);
+   }
+
+   // Type mismatches and int64 overflow throw.
+   Tree doc("[{\"a\":1,\"b\":\"1\",\"c\":1e30}]");
+   Columns strings;
+   strings.add("b", COLUMN_STRING);
+   strings.extract(doc.root());
+   ASSERT(strings.rows() == 1 && strings.stringLengths(0)[0] == 1);
+   Columns wrongType;
+   wrongType.add("b", COLUMN_DOUBLE);
+   ASSERT_THROWS(wrongType.extract(doc.root()), std::invalid_argument);
+   ASSERT(wrongType.rows() == 0);
+   Columns overflow;
+   overflow.add("c", COLUMN_INT64);
+   ASSERT_THROWS(overflow.extract(doc.root()), std::out_of_range);
+
+   // The buffers grow and are reused.
+   std::string big = "[";
+   for (int i = 0; i < 1000; ++i) {
+      big += (i ? ",{\"a\":" : "{\"a\":") + toString(i) + "}";
+   }
+   big += "]";
+   Tree bigDoc(big);
+   Columns reused;
+   reused.add("a", COLUMN_INT64);
+   reused.extract(bigDoc.root());
+   ASSERT(reused.rows() == 1000 && reused.int64s(0)[999] == 999 && reused.int64s(0)[1000] == 0);
+   reused.extract(doc.root());
+   ASSERT(reused.rows() == 1 && reused.int64s(0)[0] == 1 && reused.int64s(0)[1] == 0);
+   reused.add("c", COLUMN_DOUBLE);
+   ASSERT(reused.rows() == 0);
+   reused.extract(doc.root());
+   ASSERT(reused.doubles(1)[0] == 1e30);
+}
+
+TEST(PackedNumbers)
+{
+   const char *source = "[[1,-2,3],[1.5,2,-0],[9007199254740993,1.5],[1,\"a\",2],[],"
+      "[-9223372036854775808,9223372036854775807],[[1,2],3],{\"a\":[4, 5 ]},[0.5,1e300],"
+      "[1,123456789012345678901234567890]]";
+   const ParseMode modes[] = {
+      NON_DESTRUCTIVE, ZERO_COPY, ON_DEMAND, LAZY_INDEX, INDEX_ARRAYS, SHAPE_OBJECTS, PARALLEL
+   };
+   for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+      Tree doc;
+      doc.setThreads(2, 16);
+      doc.parse(source, modes[m] | PACK_NUMBERS);
+      ASSERT(doc.root().packed() == 0);
+
+      const PackedNumbers *ints = doc[0].packed();
+      ASSERT(ints != 0 && ints->integers_ && doc[0].length() == 3);
+      ASSERT(ints->int64s_[0] == 1 && ints->int64s_[1] == -2 && ints->int64s_[2] == 3);
+      const PackedNumbers *doubles = doc[1].packed();
+      ASSERT(doubles != 0 && !doubles->integers_);
+      ASSERT(doubles->doubles_[0] == 1.5 && doubles->doubles_[1] == 2.0);
+      ASSERT(doubles->doubles_[2] == 0.0 && signbit(doubles->doubles_[2]));
+      ASSERT(doc[2].packed() == 0);       // 9007199254740993 is not exact as double
+      ASSERT(doc[3].packed() == 0 && doc[4].packed() == 0);
+      const PackedNumbers *limits = doc[5].packed();
+      ASSERT(limits != 0 && limits->integers_);
+      ASSERT(limits->int64s_[0] == -9223372036854775807LL - 1);
+      ASSERT(limits->int64s_[1] == 9223372036854775807LL);
+      ASSERT(doc[6].packed() == 0 && doc[6][0].packed() != 0);
+      ASSERT(doc[7]["a"].packed() != 0);
+      ASSERT(doc[9].packed() == 0);       // too large for both types
+
+      double d[4];
+      int64_t n[4];
+      ASSERT(doc[0].copyTo(d, 4) == 3 && d[0] == 1.0 && d[1] == -2.0 && d[2] == 3.0);
+      ASSERT(doc[1].copyTo(n, 2) == 2 && n[0] == 1 && n[1] == 2);
+      ASSERT(doc[2].copyTo(d, 4) == 2 && d[0] == 9007199254740992.0 && d[1] == 1.5);
+      ASSERT(doc[2].copyTo(n, 4) == 2 && n[0] == 9007199254740993LL && n[1] == 1);
+      ASSERT(doc[4].copyTo(d, 4) == 0);
+      ASSERT(doc[5].copyTo(n, 4) == 2 && n[0] == limits->int64s_[0]);
+      ASSERT(doc[7]["a"].copyTo(n, 4) == 2 && n[0] == 4 && n[1] == 5);
+      ASSERT_THROWS(doc[3].copyTo(d, 4), std::invalid_argument);
+      ASSERT(doc[3].copyTo(d, 1) == 1);
+      ASSERT_THROWS(doc[8].copyTo(n, 4), std::out_of_range);
+      ASSERT_THROWS(doc[7].copyTo(d, 4), std::invalid_argument);
+
+      // The element Values are created on access and are the same as without packing.
+      ASSERT(doc[1].get(2).stringLength() == 2 && !memcmp(doc[1].get(2).asString(), "-0", 2));
+      ASSERT(doc[0][1].asInt() == -2 && doc[0].children()->next_ == &doc[0][1]);
+      ASSERT(doc[7]["a"][1].stringLength() == 1);
+      ASSERT_THROWS(doc[0][3], std::invalid_argument);
+      Tree plain(source);
+      assertSameTree(HERE, plain.root(), doc.root());
+      ASSERT(doc[0].packed() == ints);
+   }
+
+   // PushParser builds the elements as usual.
+   Tree pushed;
+   PushParser parser(pushed, PACK_NUMBERS);
+   parser.feed("[[1,2],", 7);
+   parser.feed("[3]]", 4);
+   parser.finish();
+   ASSERT(pushed[0].packed() == 0 && pushed[1][0].asInt() == 3);
+}
+
+TEST(Reserve)
+{
+   Tree tree;
+   tree.reserve(1 << 20);
+   char *last = tree.malloc(8);
+   for (int i = 0; i < 100000; ++i) {
+      char *p = tree.malloc(8);
+      ASSERT(p == last - 8);
+      last = p;
+   }
+   // A large block gets its own chunk, small blocks continue in the current one.
+   tree.malloc(10 << 20);
+   ASSERT(tree.malloc(8) == last - 8);
+
+   // The chunks after the reserved one have their usual size.
+   char *p = tree.malloc(64);
+   while (p == last - 64) {
+      last = p;
+      p = tree.malloc(64);
+   }
+   int n = 1;
+   for (last = p; (p = tree.malloc(64)) == last - 64; last = p) {
+      ++n;
+   }
+   ASSERT(n < (1 << 20) / 64);
+}
+
+TEST(Reset)
+{
+   std::string source = "[";
+   for (int i = 0; i < 10000; ++i) {
+      source += "{\"a\":\"xyz\",\"b\":[1,2,3]},";
+   }
+   source += "0]";
+
+   Tree tree;
+   tree.parse(source);
+   const Value *root = &tree.root();
+   const size_t capacity = tree.capacity();
+   for (int i = 0; i < 3; ++i) {
+      tree.reset();
+      ASSERT_THROWS(tree.root(), std::runtime_error);
+      ASSERT(tree.capacity() == capacity);
+      tree.parse(source);
+      ASSERT(&tree.root() == root);           // same memory, no new chunks
+      ASSERT(tree.capacity() == capacity);
+      ASSERT_ARRAY(tree.root(), 10001);
+   }
+
+   tree.reset(capacity / 2);
+   ASSERT(tree.capacity() <= capacity / 2);
+   tree.parse(source);
+   ASSERT_ARRAY(tree.root(), 10001);
+
+   tree.clear();
+   ASSERT(tree.capacity() == 0);
+   tree.parse(source);
+   ASSERT_ARRAY(tree.root(), 10001);
+}
+
+/// Counts allocations and checks deallocations.
+class CountingAllocator: public Allocator
+{
+public:
+   int nAllocations_;
+   size_t inUse_;
+   CountingAllocator() : nAllocations_(0), inUse_(0) {}
+   void *allocate(size_t size) { ++nAllocations_; inUse_ += size; return ::malloc(size); }
+   void deallocate(void *p, size_t size) { inUse_ -= size; ::free(p); }
+};
+
+TEST(Allocator)
+{
+   CountingAllocator allocator;
+   {
+      Tree tree(allocator);
+      tree.parse("{\"a\":[1,2,3]}");
+      ASSERT(allocator.nAllocations_ > 0);
+      tree.reset(0);
+      ASSERT(allocator.inUse_ == 0);
+      tree.parse("{\"a\":[1,2,3]}");
+   }
+   ASSERT(allocator.inUse_ == 0);
+
+   // Small documents fit in the inline buffer.
+   char buffer[2048];
+   allocator.nAllocations_ = 0;
+   {
+      Tree tree(buffer + 1, sizeof(buffer) - 1, allocator);
+      tree.parse("{\"a\":[1,2,3],\"b\":\"text\"}");
+      ASSERT_INT(tree["a"][2], 3);
+      ASSERT(allocator.nAllocations_ == 0);
+      tree.clear();
+      std::string large(5000, ' ');
+      large += "[1]";
+      tree.parse(large);
+      ASSERT(allocator.nAllocations_ > 0);
+      ASSERT_INT(tree[0], 1);
+      tree.clear();
+      ASSERT(allocator.inUse_ == 0);
+      tree.parse("[1,2]");
+      ASSERT(allocator.inUse_ == 0);        // back in the inline buffer
+   }
+   ASSERT(allocator.inUse_ == 0);
+
+#if JSON_HAVE_PMR
+   char pool[4096];
+   std::pmr::monotonic_buffer_resource resource(pool, sizeof(pool));
+   MemoryResourceAllocator pmr(&resource);
+   Tree tree(pmr);
+   tree.parse("[1,2,3]");
+   ASSERT_INT(tree[1], 2);
+#endif
+}
+
+TEST(ArrayIndex)
+{
+   std::string source = "[[1,2],";
+   for (int i = 0; i < 1000; ++i) {
+      source += toString(i * 3) + ",";
+   }
+   source += "{\"a\":1,\"b\":[]}]";
+   const ParseMode modes[] = { NON_DESTRUCTIVE, INDEX_ARRAYS, LAZY_INDEX, INDEX_OBJECTS };
+   for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+      Tree doc;
+      doc.parse(source.c_str(), modes[m]);
+      ASSERT_ARRAY(doc.root(), 1002);
+      ASSERT_ARRAY(doc[0], 2);
+      ASSERT_OBJECT(doc[1001], 2);
+      ASSERT_ARRAY(doc[1001]["b"], 0);
+      // Binary search for 2997 = 3 * 999.
+      int lo = 1, hi = 1001;
+      while (hi - lo > 1) {
+         const int mid = (lo + hi) / 2;
+         (doc[mid].asInt() <= 2997 ? lo : hi) = mid;
+      }
+      ASSERT(lo == 1000);
+      for (int i = 1; i <= 1000; ++i) {
+         ASSERT_INT(doc[i], (i - 1) * 3);
+      }
+      const bool indexed = (modes[m] & (INDEX_ARRAYS | LAZY_INDEX)) != 0;
+      ASSERT(doc.root().flags_ == (indexed ? Value::ARRAY_INDEXED : 0));
+      ASSERT_INT(doc[0][1], 2);
+      ASSERT(doc[0].flags_ == 0);
+      ASSERT_THROWS(doc.get(1002), std::invalid_argument);
+      ASSERT_THROWS(doc.get(-1), std::invalid_argument);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST(OnDemand)
+{
+   static const char *const documents[] = {
+      "[1,{\"a\":[true,{\"b\":\"]}\\\"[\"}],\"c\":null},[[],[[\"x\\u0041\"]]],{}]",
+      " { \"a\" : { \"b\" : [ 1 , 2 , /* ] */ 3 ] } , \"c\" : [ ] } ",
+      "[[1,2],[3,{\"x\":[4,[5,[6]]]}]]"
+   };
+   const ParseMode modes[] = {
+      NON_DESTRUCTIVE, DESTRUCTIVE, ZERO_COPY, INDEX_OBJECTS | INDEX_ARRAYS, LAZY_INDEX,
+      DESTRUCTIVE | STRUCTURAL_INDEX
+   };
+   for (size_t i = 0; i < sizeof(documents) / sizeof(documents[0]); ++i) {
+      for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+         ASSERT_SAME_TREE(documents[i], modes[m] | ON_DEMAND);
+         Tree doc;
+         doc.parse(documents[i], modes[m] | ON_DEMAND);
+         doc.validate();
+      }
+   }
+
+   // Only the containers on the access path are parsed.
+   Tree doc;
+   doc.parse("{\"a\":{\"b\":[1,2,3]},\"c\":[4],\"d\":{\"e\":[5]}}", ON_DEMAND);
+   ASSERT(doc["c"].flags_ == Value::ARRAY_DEFERRED);
+   ASSERT(doc["a"].flags_ == Value::OBJECT_DEFERRED);
+   ASSERT_INT(doc["a"]["b"][2], 3);
+   ASSERT(doc["a"].flags_ == 0 && doc["a"]["b"].flags_ == 0);
+   ASSERT(doc["c"].flags_ == Value::ARRAY_DEFERRED);
+   ASSERT(doc["d"].length() == 1);
+   ASSERT(doc["d"]["e"].flags_ == Value::ARRAY_DEFERRED);
+
+   // Errors in nested containers are reported on access, with the offset of a full parse.
+   const char *invalid = "[1,{\"a\":[2,01]},[3]]";
+   ASSERT_PARSER_ERROR(invalid, 11);
+   Tree bad;
+   bad.parse(invalid, ON_DEMAND);
+   ASSERT_INT(bad[2][0], 3);
+   ASSERT_THROWS(bad.validate(), SyntaxError);
+   ASSERT(bad[1]["a"].type() == JARRAY);
+   try {
+      bad[1]["a"][0];
+      fail(HERE, "no error");
+   } catch (const SyntaxError &e) {
+      ASSERT(e.offset_ == 11);
+   }
+   try {
+      bad[1]["a"].length();
+      fail(HERE, "no error");
+   } catch (const SyntaxError &e) {
+      ASSERT(e.offset_ == 11);
+   }
+   try {
+      bad.validate();
+      fail(HERE, "no error");
+   } catch (const SyntaxError &e) {
+      ASSERT(e.offset_ == 11);
+   }
+
+   // Unmatched brackets and errors in the root container are found right away.
+   Tree tree;
+   ASSERT_THROWS(tree.parse("[1,{\"a\":[2]}", ON_DEMAND), SyntaxError);
+   ASSERT_THROWS(tree.parse("[1,{\"a\":[2]]", ON_DEMAND), SyntaxError);
+   ASSERT_THROWS(tree.parse("[1,{\"a\":[2]}} ", ON_DEMAND), SyntaxError);
+   ASSERT_THROWS(tree.parse("[{}{}]", ON_DEMAND), SyntaxError);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Parses «source» with «paths» and compares the result with «expected».
+static void assertProjection(const Test::Source &where, const char *source, const char *paths,
+                             const char *expected, ParseMode mode = NON_DESTRUCTIVE)
+{
+   Tree want(expected);
+   Tree actual;
+   actual.parse(source, Projection(paths), mode);
+   assertSameTree(where, want.root(), actual.root());
+}
+
+#define ASSERT_PROJECTION(source,paths,expected) assertProjection(HERE,source,paths,expected)
+
+TEST(Projection)
+{
+   const char *source = "{\"meta\":{\"id\":7,\"x\":[1,2]},"
+      "\"children\":[{\"name\":\"a\",\"age\":1},{\"name\":\"b\",\"kids\":[{\"name\":\"c\"}]}],"
+      "\"items\":[10,11,12,13,14],\"other\":{\"name\":\"z\"}}";
+   ASSERT_PROJECTION(source, "children[*].name,meta.id,items[3]",
+                     "{\"meta\":{\"id\":7},\"children\":[{\"name\":\"a\"},{\"name\":\"b\"}],"
+                     "\"items\":[null,null,null,13]}");
+   ASSERT_PROJECTION(source, "", source);
+   ASSERT_PROJECTION(source, "meta , meta.id", "{\"meta\":{\"id\":7,\"x\":[1,2]}}");
+   ASSERT_PROJECTION(source, "*.name",
+                     "{\"meta\":{},\"children\":[],\"items\":[],\"other\":{\"name\":\"z\"}}");
+   ASSERT_PROJECTION(source, "children[*].name,children[1].kids",
+                     "{\"children\":[{\"name\":\"a\"},"
+                     "{\"name\":\"b\",\"kids\":[{\"name\":\"c\"}]}]}");
+   ASSERT_PROJECTION(source, "nothing", "{}");
+   ASSERT_PROJECTION("[[1,2],[3,4],[5]]", "[*][1]", "[[null,2],[null,4],[]]");
+   ASSERT_PROJECTION("[[1,2],[3,4],[5]]", "[2]", "[null,null,[5]]");
+
+   // The same projection can be used for several trees and all parse modes.
+   Projection projection("items[1]");
+   projection.add("meta.x[0]");
+   const ParseMode modes[] = {
+      NON_DESTRUCTIVE, ZERO_COPY, INDEX_OBJECTS | INDEX_ARRAYS, STRUCTURAL_INDEX, ON_DEMAND,
+      PARALLEL, INTERN_KEYS, SHAPE_OBJECTS | ZERO_COPY
+   };
+   for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+      Tree want("{\"meta\":{\"x\":[1]},\"items\":[null,11]}");
+      Tree actual;
+      actual.parse(source, projection, modes[m]);
+      assertSameTree(HERE, want.root(), actual.root());
+      ASSERT_INT(actual["items"][1], 11);
+   }
+
+   // Only the names of kept members are interned.
+   KeyDictionary dictionary;
+   Tree interned;
+   interned.setKeyDictionary(&dictionary);
+   interned.parse(source, projection, INTERN_KEYS);
+   ASSERT(dictionary.size() == 3);
+   ASSERT(interned["meta"].name_ == dictionary.key("meta").name_);
+
+   // Parts that are not selected are still checked.
+   Tree tree;
+   ASSERT_THROWS(tree.parse("{\"a\":1,\"b\":[1,01]}", projection), SyntaxError);
+   ASSERT_THROWS(tree.parse("{\"a\":1,\"b\":{\"c\" 1}}", projection), SyntaxError);
+   ASSERT_THROWS(tree.parse("{\"items\":[1,2]", projection), SyntaxError);
+
+   ASSERT_THROWS(Projection("a..b"), std::invalid_argument);
+   ASSERT_THROWS(Projection("a[x]"), std::invalid_argument);
+   ASSERT_THROWS(Projection("a[1"), std::invalid_argument);
+   ASSERT_THROWS(Projection("a,,b"), std::invalid_argument);
+   ASSERT_THROWS(Projection("a,"), std::invalid_argument);
+   ASSERT_THROWS(projection.add("]"), std::invalid_argument);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Writes «contents» to the file «fn».
+char *readFile(const char *fn);
+
+static void writeFile(const char *fn, const std::string &contents)
+{
+   FILE *f = fopen(fn, "wb");
+   if (f == 0 || fwrite(contents.data(), 1, contents.size(), f) != contents.size()) {
+      fail(HERE, "Cannot write %s: %s", fn, strerror(errno));
+   }
+   fclose(f);
+}
+
+TEST(ParseFile)
+{
+   static const char *const fn = "tests_parsefile.json";
+
+   // Small files are read, larger ones mapped. A file of whole pages has no NUL after the end.
+   std::string big = "[";
+   for (int i = 0; big.size() < 200000; ++i) {
+      char buf[100];
+      sprintf(buf, "{\"s\":\"a\\n%d\",\"n\":%d,\"b\":true},", i, i);
+      big += buf;
+   }
+   big[big.size() - 1] = ']';
+   std::string pages = "[\"" + std::string(65536 - 4, 'x') + "\"]";
+   const std::string documents[] = { "{\"a\":[1,\"x\\ty\",null]}", big, pages };
+   const ParseMode modes[] = {
+      NON_DESTRUCTIVE, DESTRUCTIVE, ZERO_COPY, STRUCTURAL_INDEX, ON_DEMAND, PARALLEL
+   };
+   for (size_t i = 0; i < sizeof(documents) / sizeof(documents[0]); ++i) {
+      writeFile(fn, documents[i]);
+      Tree expected(documents[i]);
+      for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+         Tree tree;
+         tree.parseFile(fn, modes[m]);
+         assertSameTree(HERE, expected.root(), tree.root());
+      }
+   }
+
+   // The file is not changed by a destructive parse.
+   writeFile(fn, big);
+   Tree tree;
+   tree.parseFile(fn, DESTRUCTIVE);
+   ASSERT(strcmp(tree[1]["s"].asString(), "a\n1") == 0);
+   char *contents = readFile(fn);
+   ASSERT(contents == big);
+   free(contents);
+
+   try {
+      writeFile(fn, big.substr(0, 100000));
+      tree.parseFile(fn);
+      fail(HERE, "no error");
+   } catch (const SyntaxError &e) {
+      ASSERT(e.offset_ == 100000);
+   }
+   writeFile(fn, "");
+   ASSERT_THROWS(tree.parseFile(fn), SyntaxError);
+   unlink(fn);
+   ASSERT_THROWS(tree.parseFile(fn), std::runtime_error);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void assertSameTape(const Test::Source &where, const Value &a, TapeValue b)
+{
+   if (a.type() != b.type()) {
+      fail(where, "type mismatch: %d vs. %d", a.type(), b.type());
+   }
+   if (a.nameLength() != b.nameLength() || memcmp(a.name_, b.name(), a.nameLength())) {
+      fail(where, "key mismatch: \"%.*s\" vs. \"%.*s\"",
+           (int) a.nameLength(), a.name_, (int) b.nameLength(), b.name());
+   }
+   if (a.type() == JOBJECT || a.type() == JARRAY) {
+      if (a.length() != b.length()) {
+         fail(where, "length mismatch for \"%s\"", a.name_);
+      }
+      const Value *x = a.children();
+      TapeValue y = b.children();
+      for (; x && y.valid(); x = x->next_, y = y.next()) {
+         assertSameTape(where, *x, y);
+      }
+      if (x || y.valid()) {
+         fail(where, "child count mismatch for \"%s\"", a.name_);
+      }
+   } else {
+      if (a.stringLength() != b.stringLength()
+          || memcmp(a.asString(), b.asString(), a.stringLength())) {
+         fail(where, "value mismatch: \"%.*s\" vs. \"%.*s\"",
+              (int) a.stringLength(), a.asString(), (int) b.stringLength(), b.asString());
+      }
+      if (a.asBool() != b.asBool() || (a.type() == JNUMBER && a.asDouble() != b.asDouble())) {
+         fail(where, "value mismatch: \"%.*s\"", (int) a.stringLength(), a.asString());
+      }
+   }
+}
+
+TEST(Tape)
+{
+   const char *source =
+      "{\"a\" : [ 1 , -2.5e3 ,true,\tfalse , null, 18446744073709551615 ] ,"
+      " \"b\":\"x y\\\"z\\u0000\", \"\":{}, \"c\":[[],[[{\"d\":\"e\"}]]], \"a\":2}";
+   Tree tree(source);
+   Tape tape;
+   tape.parse(source);
+   assertSameTape(HERE, tree.root(), tape.root());
+   ASSERT(tape.size() == 17);
+   ASSERT(tape["a"].length() == 6);
+   ASSERT(tape["a"].next().name()[0] == 'b');          // skips the subtree
+   ASSERT(tape["a"][4].type() == JNULL);
+   ASSERT(tape["a"][5].asUint64() == 18446744073709551615ULL);
+   ASSERT(tape["a"][1].asDouble() == -2500);
+   ASSERT(tape["b"].stringLength() == 6);
+   ASSERT_EQ(tape["c"][1][0][0]["d"].asString(), "e");
+   ASSERT(tape["c"].next().asInt() == 2);
+   ASSERT(!tape["c"].next().next().valid());
+   ASSERT(tape["missing"].type() == JNULL);
+   ASSERT_THROWS(tape["a"][6], std::invalid_argument);
+   ASSERT_THROWS(tape["b"]["x"], std::invalid_argument);
+
+   Tape copy(tree["c"]);
+   ASSERT(copy.size() == 6);
+   assertSameTape(HERE, tree["c"], copy.root());
+
+   // Escaped and long names, growth of both arrays, length delimited and indexed sources.
+   std::string big = "[";
+   for (int i = 0; i < 1000; ++i) {
+      big += "{\"k\\u0041\":\"v\\n" + toString(i) + "\",\"" + std::string(300, 'n') + "\":["
+         + toString(i) + ",-0.5,true,null,{}]},";
+   }
+   big += "[]]";
+   Tree bigTree(big.c_str());
+   static const ParseMode modes[] = {ZERO_COPY, STRUCTURAL_INDEX, NON_DESTRUCTIVE};
+   for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+      tape.parse(big.data(), big.size(), modes[m]);
+      assertSameTape(HERE, bigTree.root(), tape.root());
+      ASSERT(tape.size() == 8002);
+      ASSERT(tape[999]["kA"].stringLength() == 5);
+   }
+   std::vector<char> padded(big.begin(), big.end());
+   padded.resize(big.size() + PADDING);
+   tape.parse(&padded[0], big.size(), PADDED);
+   assertSameTape(HERE, bigTree.root(), tape.root());
+   tape.parse("[1]x", 3);
+   ASSERT(tape.size() == 2);
+   ASSERT_THROWS(tape.parse("[1,2"), SyntaxError);
+   ASSERT_THROWS(tape.parse(" /* */ "), SyntaxError);
+   ASSERT(tape.size() == 2);
+
+   Tape empty;
+   ASSERT_THROWS(empty.root(), std::runtime_error);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Parses «source» serially and with PARALLEL, splitting it as often as possible, and compares
+/// the trees or the errors.
+static void assertSameParallel(const Test::Source &where, const char *source, ParseMode mode)
+{
+   std::string expectedError = "none";
+   std::vector<char> buffer(source, source + strlen(source) + 1);
+   Tree expected;
+   try {
+      expected.parse(&buffer[0], mode);
+   } catch (const SyntaxError &e) {
+      expectedError = e.what();
+   }
+   for (unsigned threads = 2; threads <= 16; threads *= 2) {
+      std::string error = "none";
+      std::vector<char> buffer(source, source + strlen(source) + 1);
+      Tree actual;
+      actual.setThreads(threads, 1);
+      try {
+         actual.parse(&buffer[0], mode | PARALLEL);
+      } catch (const SyntaxError &e) {
+         error = e.what();
+      }
+      if (error != expectedError) {
+         fail(where, "%u threads, mode %x: \"%s\" instead of \"%s\" for %s", threads, mode,
+              error.c_str(), expectedError.c_str(), source);
+      }
+      if (error == "none") {
+         assertSameTree(where, expected.root(), actual.root());
+         ASSERT(actual.length() == expected.length());
+      }
+   }
+}
+
+TEST(Parallel)
+{
+   static const char *const documents[] = {
+      "[1,\"a,b\",{\"x\":[1,2,{\"y\":\"]\"}]},[],\"\\\"\",true,null,-2.5e3,[[3],4],\"\\\\\"]",
+      " { \"a\" : 1 , \"b\":\"x,y\",\"c\":{\"d\":[1,2]},\"e\":[],\"f\":\"\\u0041,\",\"a\":2 } ",
+      "[1, /* , */ 2, // ,\n 3]",
+      "[[]]",
+      "[\"x\"]",
+      "[1,2,,3]",
+      "{\"a\":1,\"b\",\"c\":2}",
+      "{\"a\":,\"b\":1}",
+      "[1,2]x",
+      "[1,[2,3],4",
+      "[1, 2 3, 4]",
+      "[1,2,]",
+      "{\"a\":1,}",
+      "[1,{\"a\":2,3},4]",
+      "[1,2,\"x]",
+      "[1,2,3]]",
+      "[1,2}",
+      "[1,tru,2]",
+      "[1,\"\\x\",2]",
+      "[1,\"a\tb\",2]",
+   };
+   for (size_t i = 0; i < sizeof(documents) / sizeof(documents[0]); ++i) {
+      assertSameParallel(HERE, documents[i], NON_DESTRUCTIVE);
+      assertSameParallel(HERE, documents[i], DESTRUCTIVE);
+      assertSameParallel(HERE, documents[i], DESTRUCTIVE | STRUCTURAL_INDEX);
+      assertSameParallel(HERE, documents[i], ZERO_COPY);
+   }
+
+   // Indexes, including lazy ones, belong to the parsing Tree.
+   std::string source = "{";
+   for (int i = 0; i < 100; ++i) {
+      char member[100];
+      sprintf(member, "%s\"m%d\":{\"n\":%d,\"a\":[0,1,2,3,4,5,6,7,8,%d]}",
+              i ? "," : "", i, i, i);
+      source += member;
+   }
+   source += "}";
+   static const ParseMode modes[] = {INDEX_OBJECTS | INDEX_ARRAYS, LAZY_INDEX};
+   for (int m = 0; m < 2; ++m) {
+      assertSameParallel(HERE, source.c_str(), modes[m]);
+      Tree tree;
+      tree.setThreads(4, 64);
+      tree.parse(source.c_str(), modes[m] | PARALLEL);
+      ASSERT(tree.length() == 100);
+      ASSERT(tree["m57"]["n"].asInt() == 57);
+      ASSERT(tree["m99"]["a"][9].asInt() == 99);
+      ASSERT(tree["m0"]["a"][3].asInt() == 3);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST(DocumentStream)
+{
+   const char *source =
+      "{\"id\":1,\"tags\":[\"a\",\"b\"]}\n"
+      "\n"
+      "  [1, 2, 3]  \r\n"
+      "// comment\n"
+      "{\"id\":3,\"s\":\"x\\ny\"}{\"id\":4}\n";
+   static const ParseMode modes[] = {
+      NON_DESTRUCTIVE, DESTRUCTIVE, DESTRUCTIVE | STRUCTURAL_INDEX, ZERO_COPY,
+      INDEX_OBJECTS | INDEX_ARRAYS
+   };
+   for (int m = 0; m < 5; ++m) {
+      std::vector<char> buffer(source, source + strlen(source) + 1);
+      DocumentStream stream(&buffer[0], modes[m]);
+      Tree tree;
+      ASSERT(stream.next(tree));
+      ASSERT(stream.offset() == 0 && stream.length() == 25);
+      ASSERT(tree["id"].asInt() == 1 && tree["tags"].length() == 2);
+      ASSERT(stream.next(tree));
+      ASSERT(stream.offset() == 29 && stream.length() == 9);
+      ASSERT(tree.length() == 3 && tree[2].asInt() == 3);
+      ASSERT(stream.next(tree));
+      ASSERT(tree["id"].asInt() == 3);
+      ASSERT(std::string(tree["s"].asString(), tree["s"].stringLength()) == "x\ny");
+      ASSERT(stream.next(tree));
+      ASSERT(stream.offset() == 72 && stream.length() == 8);
+      ASSERT(tree["id"].asInt() == 4);
+      ASSERT(!stream.next(tree));
+      ASSERT(!stream.next(tree));
+   }
+
+   // Length delimited, errors
+   const std::string lines = "{\"a\":1}\n{\"a\":2}\n{\"a\":3,}\n{\"a\":4}";
+   DocumentStream stream(lines.data(), 16);
+   Tree tree;
+   ASSERT(stream.next(tree) && stream.next(tree) && tree["a"].asInt() == 2);
+   ASSERT(!stream.next(tree));
+   DocumentStream broken(lines.data(), lines.size());
+   ASSERT(broken.next(tree) && broken.next(tree));
+   try {
+      broken.next(tree);
+      fail(HERE, "SyntaxError expected");
+   } catch (const SyntaxError &e) {
+      ASSERT(e.offset_ == 23);
+   }
+   ASSERT(!broken.next(tree));
+   DocumentStream scalar("{} 1");
+   ASSERT(scalar.next(tree));
+   ASSERT_THROWS(scalar.next(tree), SyntaxError);
+
+   // Keeping previous documents
+   DocumentStream all(lines.data(), 16);
+   ASSERT(all.next(tree));
+   const Value &first = tree.root();
+   ASSERT(all.next(tree, false));
+   ASSERT(first["a"].asInt() == 1 && tree["a"].asInt() == 2);
+
+   // Shared structural index across many documents
+   std::string many;
+   for (int i = 0; i < 2000; ++i) {
+      char line[100];
+      sprintf(line, "{\"n\" : %d ,  \"s\":\"%*s\"}\n", i, i % 50, "");
+      many += line;
+   }
+   DocumentStream indexed(many.c_str(), STRUCTURAL_INDEX);
+   int n = 0;
+   while (indexed.next(tree)) {
+      ASSERT(tree["n"].asInt() == n);
+      ASSERT(tree["s"].stringLength() == (size_t) (n % 50));
+      ++n;
+   }
+   ASSERT(n == 2000);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Records the documents delivered by parseLines(). Document "n" is stored at position n, so
+/// concurrent calls write to different elements.
+class LineRecorder: public DocumentHandler
+{
+public:
+   std::vector<size_t> offsets_;
+   std::vector<size_t> indexes_;
+
+   explicit LineRecorder(size_t n) : offsets_(n, (size_t) -1), indexes_(n, 0) {}
+
+   void document(const Value &root, size_t offset, size_t index)
+   {
+      const size_t n = root.get("n").asInt();
+      offsets_[n] = offset;
+      indexes_[n] = index;
+   }
+};
+
+TEST(ParseLines)
+{
+   // Small lines, a few very long ones, blank lines, CRLF and two documents on one line.
+   std::string source;
+   std::vector<size_t> offsets;
+   const size_t n = 3000;
+   for (size_t i = 0; i < n; ++i) {
+      char line[100];
+      sprintf(line, "{\"n\":%u,\"x\":[", (unsigned) i);
+      offsets.push_back(source.size());
+      source += line;
+      for (size_t k = (i % 500 == 7) ? 20000 : 3; k > 0; --k) {
+         source += k > 1 ? "1," : "1";
+      }
+      source += (i % 10 == 3) ? "]}\r\n\n" : (i % 10 == 5) ? "]} " : "]}\n";
+   }
+   source.erase(source.size() - 1);
+
+   for (unsigned threads = 1; threads <= 8; threads *= 2) {
+      for (int ordered = 0; ordered < 2; ++ordered) {
+         LineRecorder recorder(n);
+         parseLines(source.data(), source.size(), recorder, NON_DESTRUCTIVE, threads, ordered);
+         for (size_t i = 0; i < n; ++i) {
+            ASSERT(recorder.offsets_[i] == offsets[i]);
+            ASSERT(recorder.indexes_[i] == (ordered ? i : (size_t) -1));
+         }
+      }
+   }
+
+   // The first error in source order is reported, with «ordered» after all documents before it.
+   std::string broken = source;
+   broken.insert(offsets[1700] + 5, ",");
+   broken.insert(offsets[2900] + 5, ",");
+   for (unsigned threads = 1; threads <= 8; threads *= 2) {
+      for (int ordered = 0; ordered < 2; ++ordered) {
+         LineRecorder recorder(n);
+         try {
+            parseLines(broken.data(), broken.size(), recorder, NON_DESTRUCTIVE, threads, ordered);
+            fail(HERE, "SyntaxError expected");
+         } catch (const SyntaxError &e) {
+            ASSERT(e.offset_ == offsets[1700] + 5);
+         }
+         if (ordered) {
+            for (size_t i = 0; i < n; ++i) {
+               ASSERT((recorder.indexes_[i] == i) == (i < 1700));
+            }
+         }
+      }
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Feeds «source» to a PushParser in pieces of «step» bytes and compares the result with
+/// Tree::parse(), including the error.
+static void assertSamePush(const Test::Source &where, const std::string &source, size_t step,
+                           ParseMode mode)
+{
+   std::string expectedError = "none";
+   Tree expected;
+   try {
+      expected.parse(source.data(), source.size(), mode);
+   } catch (const SyntaxError &e) {
+      expectedError = e.what();
+   }
+   std::string error = "none";
+   Tree actual;
+   try {
+      PushParser parser(actual, mode);
+      for (size_t i = 0; i < source.size(); i += step) {
+         parser.feed(source.data() + i, std::min(step, source.size() - i));
+      }
+      parser.finish();
+   } catch (const SyntaxError &e) {
+      error = e.what();
+   }
+   if (error != expectedError) {
+      fail(where, "step %u: \"%s\" instead of \"%s\" for %s", (unsigned) step, error.c_str(),
+           expectedError.c_str(), source.c_str());
+   }
+   if (error == "none") {
+      assertSameTree(where, expected.root(), actual.root());
+   }
+}
+
+TEST(PushParser)
+{
+   static const char *const documents[] = {
+      "{\"a\":[1,-2.5e3,true,false,null],\"b\":\"x y\\\"z\\\\\",\"c\":{\"d\":{}}}",
+      " [ \"\\u00e4\\ud83d\\ude00\" , [ ] , { \"x\" : [ [ 1 ] , 2 ] } ] \n",
+      "[1, /* \"comment\" ] */ 2, // \"x ,\n 3]",
+      "[1,2,,3]",
+      "{\"a\":1,\"b\",\"c\":2}",
+      "[1,2] x",
+      "[[1],[2]",
+      "[\"abc",
+      "[1 , ]",
+   };
+   for (size_t i = 0; i < sizeof(documents) / sizeof(documents[0]); ++i) {
+      for (size_t step = 1; step <= 8; ++step) {
+         assertSamePush(HERE, documents[i], step, NON_DESTRUCTIVE);
+      }
+      assertSamePush(HERE, documents[i], 1000, INDEX_OBJECTS | INDEX_ARRAYS);
+   }
+
+   // Long strings and many buffers.
+   std::string source = "{";
+   for (int i = 0; i < 2000; ++i) {
+      char member[100];
+      sprintf(member, "%s\"m%d\":[%d,\"%s\"]", i ? "," : "", i, i, (i % 100 == 0) ? "\\n" : "s");
+      source += member;
+      if (i == 1000) {
+         source += ",\"long\":\"" + std::string(100000, 'x') + "\"";
+      }
+   }
+   source += "}";
+   assertSamePush(HERE, source, 1, NON_DESTRUCTIVE);
+   assertSamePush(HERE, source, 4093, INDEX_OBJECTS);
+
+   // The tree is built while the text arrives, errors are detected early.
+   Tree tree;
+   PushParser parser(tree);
+   ASSERT(parser.root() == 0);
+   parser.feed("{\"a\":1,\"b\":[2,3", 15);
+   ASSERT(parser.root() != 0 && parser.root()->get("a").asInt() == 1);
+   ASSERT(parser.root()->get("b").length() == 1);
+   parser.feed(",4]}", 4);
+   ASSERT(&parser.finish() == &tree.root());
+   ASSERT(tree["b"].length() == 3 && tree["b"][2].asInt() == 4);
+
+   PushParser broken(tree);
+   broken.feed("[1,2,", 5);
+   ASSERT_THROWS(broken.feed(" ]", 2), SyntaxError);
+
+   PushParser empty(tree);
+   empty.feed(" ", 1);
+   ASSERT_THROWS(empty.finish(), SyntaxError);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Writes the events of parseEvents() in a compact notation.
+struct EventRecorder: public EventHandler
+{
+   std::string events;
+
+   void startObject() { events += "{"; }
+   void endObject() { events += "}"; }
+   void startArray() { events += "["; }
+   void endArray() { events += "]"; }
+   void key(const char *name, size_t length) { events += "K" + std::string(name, length); }
+   void string(const char *s, size_t length) { events += "S" + std::string(s, length) + ";"; }
+   void number(const Value &number)
+   {
+      char buffer[50];
+      sprintf(buffer, "N%g;", number.asDouble());
+      events += buffer;
+   }
+   void boolean(bool value) { events += value ? "T" : "F"; }
+   void null() { events += "0"; }
+};
+
+/// Counts the members named "x" and sums their values. Ignores the other events.
+struct Summer: public EventHandler
+{
+   bool isX;
+   size_t count;
+   double sum;
+
+   Summer() : isX(false), count(0), sum(0) {}
+
+   void key(const char *name, size_t length) { isX = (length == 1 && *name == 'x'); }
+   void number(const Value &number)
+   {
+      if (isX) {
+         ++count;
+         sum += number.asDouble();
+      }
+   }
+};
+
+TEST(ParseEvents)
+{
+   const char *source =
+      "{\"a\":[1,-2.5e3,true,false,null],\"b\":\"x\\\"y\",\"c\\u0041\":{\"d\":{}} /* c */}";
+   const std::string copy = source;
+   EventRecorder recorder;
+   parseEvents(source, recorder);
+   ASSERT(recorder.events == "{Ka[N1;N-2500;TF0]KbSx\"y;KcA{Kd{}}}");
+   ASSERT(copy == source);
+
+   EventRecorder recorder2;
+   parseEvents("[1,\"a\"]xyz", 7, recorder2);
+   parseEvents("[1,\"a\"]", 7, recorder2, PADDED);
+   ASSERT(recorder2.events == "[N1;Sa;][N1;Sa;]");
+   EventRecorder recorder3;
+   ASSERT_THROWS(parseEvents(source, 10, recorder3), SyntaxError);
+   ASSERT(recorder3.events == "{Ka[N1;N-2;");
+
+   Summer summer;
+   parseEvents("[{\"x\":1,\"y\":2},{\"y\":{\"x\":3}},{\"x\":4.5}]", summer);
+   ASSERT(summer.count == 3 && summer.sum == 8.5);
+
+   // Same errors as Tree::parse().
+   static const char *const errors[] = {
+      "[1,2,,3]", "{\"a\":1,\"b\",\"c\":2}", "[1,2] x", "[[1],[2]", "[\"abc", "[1 , ]", "[\"\\q\"]",
+      "{\"a\" 1}", "[01]", "[1}", "  "
+   };
+   for (size_t i = 0; i < sizeof(errors) / sizeof(errors[0]); ++i) {
+      size_t expected = (size_t) -1;
+      try {
+         Tree tree(errors[i]);
+      } catch (const SyntaxError &e) {
+         expected = e.offset_;
+      }
+      EventRecorder recorder;
+      try {
+         parseEvents(errors[i], recorder);
+         fail(HERE, "no error for %s", errors[i]);
+      } catch (const SyntaxError &e) {
+         if (strcmp(errors[i], "  ") != 0 && e.offset_ != expected) {
+            fail(HERE, "offset %u instead of %u for %s", (unsigned) e.offset_,
+                 (unsigned) expected, errors[i]);
+         }
+      }
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Reads «source» with a Reader and records the tokens like EventRecorder. Skips all objects
+/// with «skipObjects».
+static std::string readTokens(Reader &reader, bool skipObjects = false)
+{
+   EventRecorder recorder;
+   for (Reader::Token t = reader.next(); t != Reader::END; t = reader.next()) {
+      if (reader.nameLength() > 0) {
+         recorder.key(reader.name(), reader.nameLength());
+      }
+      const Value &v = reader.value();
+      switch (t) {
+         case Reader::START_OBJECT:
+            if (skipObjects) {
+               reader.skip();
+               ASSERT(reader.token() == Reader::END_OBJECT);
+               recorder.events += "{..}";
+            } else {
+               recorder.startObject();
+            }
+            break;
+         case Reader::END_OBJECT: recorder.endObject(); break;
+         case Reader::START_ARRAY: recorder.startArray(); break;
+         case Reader::END_ARRAY: recorder.endArray(); break;
+         default:
+            switch (v.type()) {
+               case JSTRING: recorder.string(v.asString(), v.stringLength()); break;
+               case JNUMBER: recorder.number(v); break;
+               case JBOOL: recorder.boolean(v.asBool()); break;
+               default: recorder.null(); break;
+            }
+      }
+   }
+   return recorder.events;
+}
+
+TEST(Reader)
+{
+   const char *source =
+      "{\"a\":[1,-2.5e3,true,false,null],\"b\":\"x\\\"y\",\"c\\u0041\":{\"d\":{}} /* c */}";
+   Reader reader(source);
+   ASSERT(readTokens(reader) == "{Ka[N1;N-2500;TF0]KbSx\"y;KcA{Kd{}}}");
+   ASSERT(reader.next() == Reader::END && reader.depth() == 0);
+
+   Reader reader2("[1,\"a\"]xyz", 7);
+   ASSERT(readTokens(reader2) == "[N1;Sa;]");
+
+   // Member names and nesting
+   Reader reader4("{\"a\":{\"b\":[7]}}");
+   ASSERT(reader4.next() == Reader::START_OBJECT && reader4.depth() == 1);
+   ASSERT(reader4.next() == Reader::START_OBJECT && reader4.depth() == 2);
+   ASSERT(std::string(reader4.name(), reader4.nameLength()) == "a");
+   ASSERT(reader4.value().type() == JOBJECT && reader4.value().length() == 0);
+   ASSERT(reader4.next() == Reader::START_ARRAY && reader4.depth() == 3);
+   ASSERT(std::string(reader4.name(), reader4.nameLength()) == "b");
+   ASSERT(reader4.next() == Reader::VALUE && reader4.nameLength() == 0);
+   ASSERT(reader4.value().asInt() == 7);
+
+   // skip() ignores brackets in strings and comments.
+   const char *skipped = "[{\"a\":\"]}\\\"[\",/*]*/\"b\":[1,{}]} , 2,{\"c\":\"\\\\\"},[{}]]";
+   Reader reader5(skipped);
+   ASSERT(readTokens(reader5, true) == "[{..}N2;{..}[{..}]]");
+   Reader reader6(skipped);
+   ASSERT(reader6.next() == Reader::START_ARRAY);
+   reader6.skip();
+   ASSERT(reader6.token() == Reader::END_ARRAY && reader6.depth() == 0);
+   ASSERT(reader6.next() == Reader::END);
+
+   // Long containers are skipped block by block.
+   std::string wide = "{\"x\":[";
+   for (int i = 0; i < 500; ++i) {
+      wide += (i % 3 == 0) ? "{\"s\":\"[[{\\\\\\\"\"}," : (i % 3 == 1) ? "[[1, 2], []]," : "\"]]\",";
+   }
+   wide += "0],\"y\":/* ] */ 5}";
+   Reader reader7(wide.c_str());
+   ASSERT(reader7.next() == Reader::START_OBJECT);
+   ASSERT(reader7.next() == Reader::START_ARRAY);
+   reader7.skip();
+   ASSERT(reader7.next() == Reader::VALUE && reader7.value().asInt() == 5);
+   ASSERT(std::string(reader7.name(), reader7.nameLength()) == "y");
+   ASSERT(reader7.next() == Reader::END_OBJECT);
+   Reader reader8(wide.c_str());
+   ASSERT(readTokens(reader8).size() > wide.size() / 2);
+
+   Reader reader9("[[1,2]");
+   ASSERT(reader9.next() == Reader::START_ARRAY);
+   ASSERT(reader9.next() == Reader::START_ARRAY);
+   reader9.skip();
+   ASSERT_THROWS(reader9.next(), SyntaxError);
+   Reader reader10("[[1,2");
+   reader10.next();
+   reader10.next();
+   ASSERT_THROWS(reader10.skip(), SyntaxError);
+   Reader reader11("[1] 2");
+   reader11.next();
+   reader11.skip();
+   ASSERT_THROWS(reader11.next(), SyntaxError);
+
+   // Same errors as Tree::parse().
+   static const char *const errors[] = {
+      "[1,2,,3]", "{\"a\":1,\"b\",\"c\":2}", "[1,2] x", "[[1],[2]", "[\"abc", "[1 , ]", "[\"\\q\"]",
+      "{\"a\" 1}", "[01]", "[1}", "  ", "1"
+   };
+   for (size_t i = 0; i < sizeof(errors) / sizeof(errors[0]); ++i) {
+      size_t expected = (size_t) -1;
+      try {
+         Tree tree(errors[i]);
+      } catch (const SyntaxError &e) {
+         expected = e.offset_;
+      }
+      Reader reader(errors[i]);
+      try {
+         readTokens(reader);
+         fail(HERE, "no error for %s", errors[i]);
+      } catch (const SyntaxError &e) {
+         if (strcmp(errors[i], "  ") != 0 && e.offset_ != expected) {
+            fail(HERE, "offset %u instead of %u for %s", (unsigned) e.offset_,
+                 (unsigned) expected, errors[i]);
+         }
+      }
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST(StructuralIndex)
+{
+   ASSERT_SAME_TREE("{\"a\" : [ 1 , -2.5e3 ,true,\tfalse , null ] ,\n\"b\":\"x y\\\"z\\\\\"}",
+                    DESTRUCTIVE | STRUCTURAL_INDEX);
+   ASSERT_SAME_TREE("  [ \"\\u0041\" , \"\" , { } , [ ] ]  ", DESTRUCTIVE | STRUCTURAL_INDEX);
+   ASSERT_SAME_TREE("[1, /* \"comment\" */ 2, // \"x\n 3]", DESTRUCTIVE | STRUCTURAL_INDEX);
+   ASSERT_SAME_TREE("[1, 2, 3]", NON_DESTRUCTIVE | STRUCTURAL_INDEX);
+}
+
+TEST(StructuralIndexLongDocument)
+{
+   // Strings and white space crossing block and window boundaries.
+   std::string source = "[";
+   for (int i = 0; i < 5000; ++i) {
+      source += (i == 0) ? "\n" : ",\n";
+      source.append(i % 97, ' ');
+      source += "{\"key\":\"";
+      source.append((i % 131) & ~1, (i % 7 == 0) ? '\\' : 'x');
+      source += "\" , \"n\" :  ";
+      char tmp[20];
+      snprintf(tmp, sizeof(tmp), "%d}", i);
+      source += tmp;
+   }
+   source += "\n]";
+   ASSERT_SAME_TREE(source.c_str(), DESTRUCTIVE | STRUCTURAL_INDEX);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
 TEST(FormatterEmptyObj)
 {
    char json[] =
@@ -897,7 +2536,7 @@ char *readFile(const char *fn)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-static void performanceTest(const char *fn)
+static void performanceTest(const char *fn, ParseMode mode, const char *label)
 {
    const char * const data = readFile(fn);
    const unsigned long nBytes = strlen(data);
@@ -906,11 +2545,697 @@ static void performanceTest(const char *fn)
       char *c = (char*) malloc(nBytes + 1);
       memcpy(c,data,nBytes + 1);
       unsigned long t = Test::microTime();
-      Tree doc(c,DESTRUCTIVE);
+      Tree doc(c,mode);
       t = Test::microTime() - t;
-      printf("%-20s: %10ldBytes, %10.6fs, %7.1fMB/s\n", fn, nBytes,t/1e6,nBytes * 1.0 / t);
+      printf("%-20s %-8s: %10ldBytes, %10.6fs, %7.1fMB/s\n",
+             fn, label, nBytes,t/1e6,nBytes * 1.0 / t);
       free(c);
    }
+   free((void*) data);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static double sumNumbers(const Value &v)
+{
+   if (v.type() == JNUMBER) {
+      return v.asDouble();
+   }
+   double sum = 0;
+   if (v.type() == JARRAY || v.type() == JOBJECT) {
+      for (const Value *c = v.children(); c != 0; c = c->next_) {
+         sum += sumNumbers(*c);
+      }
+   }
+   return sum;
+}
+
+static double sumNumbers(TapeValue v)
+{
+   if (v.type() == JNUMBER) {
+      return v.asDouble();
+   }
+   double sum = 0;
+   if (v.type() == JARRAY || v.type() == JOBJECT) {
+      for (TapeValue c = v.children(); c.valid(); c = c.next()) {
+         sum += sumNumbers(c);
+      }
+   }
+   return sum;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Parses many small documents as JSON Lines and, for comparison, as one array.
+static void streamTest()
+{
+   const char *line =
+      "{\"id\":12345,\"user\":\"alice\",\"roles\":[\"admin\",\"dev\"],"
+      "\"active\":true,\"quota\":{\"used\":1.5,\"limit\":10}}";
+   const int n = 500000;
+   std::string lines;
+   std::string array = "[";
+   for (int k = 0; k < n; ++k) {
+      lines += line;
+      lines += "\n";
+      array += k ? "," : "";
+      array += line;
+   }
+   array += "]";
+
+   for (int i = 0; i < 3; ++i) {
+      Tree tree;
+      unsigned long t = Test::microTime();
+      DocumentStream stream(lines.data(), lines.size(), ZERO_COPY);
+      int count = 0;
+      while (stream.next(tree)) {
+         ++count;
+      }
+      const unsigned long t1 = Test::microTime() - t;
+      t = Test::microTime();
+      tree.reset();
+      tree.parse(array.data(), array.size(), ZERO_COPY);
+      const unsigned long t2 = Test::microTime() - t;
+      printf("JSON Lines (%d documents): stream %7.1fMB/s, one array %7.1fMB/s\n",
+             count, lines.size() * 1.0 / t1, array.size() * 1.0 / t2);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Accepts every document. parseLines() may call it concurrently, so it keeps no state.
+class NullHandler: public DocumentHandler
+{
+public:
+   void document(const Value &, size_t, size_t) {}
+};
+
+/// Parses JSON Lines with parseLines() on 1, 2, 4, ... threads, unordered and ordered.
+static void linesTest()
+{
+   std::string lines;
+   char line[200];
+   for (int k = 0; k < 500000; ++k) {
+      sprintf(line, "{\"id\":%d,\"user\":\"u%d\",\"roles\":[\"admin\",\"dev\"],"
+              "\"active\":true,\"quota\":{\"used\":%d.5,\"limit\":10}}\n", k, k % 977, k % 10);
+      lines += line;
+   }
+
+   NullHandler handler;
+   for (unsigned threads = 1; threads <= 16; threads *= 2) {
+      for (int ordered = 0; ordered <= 1; ++ordered) {
+         unsigned long best = 0;
+         for (int i = 0; i < 3; ++i) {
+            unsigned long t = Test::microTime();
+            parseLines(lines.data(), lines.size(), handler, NON_DESTRUCTIVE, threads, ordered != 0);
+            t = Test::microTime() - t;
+            best = (i == 0 || t < best) ? t : best;
+         }
+         printf("parseLines %2u threads%s: %10luBytes, %10.6fs, %7.1fMB/s\n", threads,
+                ordered ? " (ordered)" : "          ", (unsigned long) lines.size(), best / 1e6,
+                lines.size() * 1.0 / best);
+      }
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Sums all numbers.
+struct NumberSummer: public EventHandler {
+   double sum;
+   NumberSummer() : sum(0) {}
+   void number(const Value &number) { sum += number.asDouble(); }
+};
+
+/// Sums all numbers of «fn», with a Tree and with parseEvents().
+static void eventsTest(const char *fn)
+{
+   const char * const data = readFile(fn);
+   const size_t nBytes = strlen(data);
+   Tree doc;
+   unsigned long bestDom = 0;
+   unsigned long bestSax = 0;
+   double domSum = 0;
+   double saxSum = 0;
+   for (int i = 0; i < 5; ++i) {
+      doc.reset();
+      unsigned long t = Test::microTime();
+      doc.parse(data, ZERO_COPY);
+      domSum = sumNumbers(doc.root());
+      t = Test::microTime() - t;
+      bestDom = (i == 0 || t < bestDom) ? t : bestDom;
+
+      t = Test::microTime();
+      NumberSummer summer;
+      parseEvents(data, summer);
+      saxSum = summer.sum;
+      t = Test::microTime() - t;
+      bestSax = (i == 0 || t < bestSax) ? t : bestSax;
+   }
+   if (domSum != saxSum) {
+      printf("different sums: %g %g\n", domSum, saxSum);
+   }
+   printf("%-20s DOM: %7.1fMB/s, SAX: %7.1fMB/s\n", fn, nBytes * 1.0 / bestDom,
+          nBytes * 1.0 / bestSax);
+   free((void*) data);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Sums all numbers of «fn» with a Reader, and skips the elements of the root container.
+static void readerTest(const char *fn)
+{
+   const char * const data = readFile(fn);
+   const size_t nBytes = strlen(data);
+   unsigned long bestRead = 0;
+   unsigned long bestSkip = 0;
+   double sum = 0;
+   for (int i = 0; i < 5; ++i) {
+      unsigned long t = Test::microTime();
+      Reader reader(data);
+      sum = 0;
+      for (Reader::Token token = reader.next(); token != Reader::END; token = reader.next()) {
+         if (token == Reader::VALUE && reader.value().type() == JNUMBER) {
+            sum += reader.value().asDouble();
+         }
+      }
+      t = Test::microTime() - t;
+      bestRead = (i == 0 || t < bestRead) ? t : bestRead;
+
+      t = Test::microTime();
+      Reader skipper(data);
+      skipper.next();
+      while (skipper.next() != Reader::END) {
+         skipper.skip();
+      }
+      t = Test::microTime() - t;
+      bestSkip = (i == 0 || t < bestSkip) ? t : bestSkip;
+   }
+   NumberSummer summer;
+   parseEvents(data, summer);
+   if (sum != summer.sum) {
+      printf("different sums: %g %g\n", sum, summer.sum);
+   }
+   printf("%-20s next(): %7.1fMB/s, skip(): %7.1fMB/s\n", fn, nBytes * 1.0 / bestRead,
+          nBytes * 1.0 / bestSkip);
+   free((void*) data);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Parses «fn» and reads five fields, with and without ON_DEMAND.
+static void onDemandTest(const char *fn)
+{
+   const char * const data = readFile(fn);
+   const size_t nBytes = strlen(data);
+   static const ParseMode modes[] = { ZERO_COPY, ZERO_COPY | ON_DEMAND };
+   for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+      Tree doc;
+      unsigned long best = 0;
+      int sum = 0;
+      for (int i = 0; i < 5; ++i) {
+         doc.reset();
+         unsigned long t = Test::microTime();
+         doc.parse(data, modes[m]);
+         const Value &root = doc.root();
+         sum = root["level"].asInt() + root["integer0"].asInt() + root["object0"]["level"].asInt()
+            + root["object9"]["integer1"].asInt() + (int) root["array"].length();
+         t = Test::microTime() - t;
+         best = (i == 0 || t < best) ? t : best;
+      }
+      printf("%-20s %-9s: %10luBytes, %10.6fs, %7.1fMB/s (%d)\n", fn,
+             (modes[m] & ON_DEMAND) ? "on demand" : "full", (unsigned long) nBytes, best / 1e6,
+             nBytes * 1.0 / best, sum);
+   }
+   free((void*) data);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Parses «fn» and reads five fields, with a full tree and with a Projection.
+static void projectionTest(const char *fn)
+{
+   const char * const data = readFile(fn);
+   const size_t nBytes = strlen(data);
+   const Projection projection("level,integer0,object0.level,object9.integer1,array");
+   for (int p = 0; p < 2; ++p) {
+      Tree doc;
+      unsigned long best = 0;
+      int sum = 0;
+      for (int i = 0; i < 5; ++i) {
+         doc.reset();
+         unsigned long t = Test::microTime();
+         if (p) {
+            doc.parse(data, projection, ZERO_COPY);
+         } else {
+            doc.parse(data, ZERO_COPY);
+         }
+         const Value &root = doc.root();
+         sum = root["level"].asInt() + root["integer0"].asInt() + root["object0"]["level"].asInt()
+            + root["object9"]["integer1"].asInt() + (int) root["array"].length();
+         t = Test::microTime() - t;
+         best = (i == 0 || t < best) ? t : best;
+      }
+      printf("%-20s %-9s: %10luBytes, %10.6fs, %7.1fMB/s, %10lu bytes of tree (%d)\n", fn,
+             p ? "projected" : "full", (unsigned long) nBytes, best / 1e6, nBytes * 1.0 / best,
+             (unsigned long) doc.capacity(), sum);
+   }
+   free((void*) data);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Reads and parses «fn», compared with Tree::parseFile().
+static void fileTest(const char *fn)
+{
+   static const char *const labels[] = { "read+parse", "parseFile", "zero copy" };
+   for (int k = 0; k < 3; ++k) {
+      Tree doc;
+      unsigned long best = 0;
+      struct stat st;
+      stat(fn, &st);
+      const size_t nBytes = st.st_size;
+      for (int i = 0; i < 5; ++i) {
+         doc.reset();
+         unsigned long t = Test::microTime();
+         if (k == 0) {
+            char *data = readFile(fn);
+            doc.parse(data, DESTRUCTIVE);
+            t = Test::microTime() - t;
+            free(data);
+         } else {
+            doc.parseFile(fn, k == 1 ? DESTRUCTIVE : ZERO_COPY);
+            t = Test::microTime() - t;
+         }
+         best = (i == 0 || t < best) ? t : best;
+      }
+      printf("%-20s %-10s: %10luBytes, %10.6fs, %7.1fMB/s\n", fn, labels[k],
+             (unsigned long) nBytes, best / 1e6, nBytes * 1.0 / best);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Sums the member «key» of all objects in «v».
+static long sumMembers(const Value &v, const Key &key)
+{
+   long sum = 0;
+   if (v.type() == JOBJECT) {
+      const Value &x = v[key];
+      sum += (x.type() == JNUMBER) ? x.asInt() : 0;
+   }
+   if (v.type() == JOBJECT || v.type() == JARRAY) {
+      for (const Value *c = v.children(); c != 0; c = c->next_) {
+         sum += sumMembers(*c, key);
+      }
+   }
+   return sum;
+}
+
+/// Parses «fn» with and without INTERN_KEYS and looks up a member in all objects.
+static void internTest(const char *fn)
+{
+   const char * const data = readFile(fn);
+   const size_t nBytes = strlen(data);
+   KeyDictionary dictionary;
+   for (int k = 0; k < 2; ++k) {
+      Tree doc;
+      doc.setKeyDictionary(&dictionary);
+      const ParseMode mode = k ? (ZERO_COPY | INTERN_KEYS) : ZERO_COPY;
+      const Key key = k ? dictionary.key("integer9") : Key("integer9");
+      unsigned long best = 0;
+      unsigned long bestLookup = 0;
+      long sum = 0;
+      for (int i = 0; i < 5; ++i) {
+         doc.reset();
+         unsigned long t = Test::microTime();
+         doc.parse(data, mode);
+         t = Test::microTime() - t;
+         best = (i == 0 || t < best) ? t : best;
+         t = Test::microTime();
+         sum = sumMembers(doc.root(), key);
+         t = Test::microTime() - t;
+         bestLookup = (i == 0 || t < bestLookup) ? t : bestLookup;
+      }
+      printf("%-20s %-9s: %10luBytes, %10.6fs, %7.1fMB/s, lookups %10.6fs (%ld)\n", fn,
+             k ? "interned" : "plain", (unsigned long) nBytes, best / 1e6, nBytes * 1.0 / best,
+             bestLookup / 1e6, sum);
+   }
+   free((void*) data);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Feeds «fn» to a PushParser in pieces of various sizes, compared with parsing a copy at once.
+static void pushTest(const char *fn)
+{
+   const char * const data = readFile(fn);
+   const size_t nBytes = strlen(data);
+   Tree doc;
+
+   for (size_t step = 64; step <= 65536; step *= 32) {
+      unsigned long best = 0;
+      for (int i = 0; i < 5; ++i) {
+         doc.reset();
+         unsigned long t = Test::microTime();
+         PushParser parser(doc);
+         for (size_t k = 0; k < nBytes; k += step) {
+            parser.feed(data + k, std::min(step, nBytes - k));
+         }
+         parser.finish();
+         t = Test::microTime() - t;
+         best = (i == 0 || t < best) ? t : best;
+      }
+      printf("%-20s push %5u: %10luBytes, %10.6fs, %7.1fMB/s\n", fn, (unsigned) step,
+             (unsigned long) nBytes, best / 1e6, nBytes * 1.0 / best);
+   }
+   unsigned long best = 0;
+   for (int i = 0; i < 5; ++i) {
+      doc.reset();
+      unsigned long t = Test::microTime();
+      doc.parse(data, nBytes);
+      t = Test::microTime() - t;
+      best = (i == 0 || t < best) ? t : best;
+   }
+   printf("%-20s at once   : %10luBytes, %10.6fs, %7.1fMB/s\n", fn, (unsigned long) nBytes,
+          best / 1e6, nBytes * 1.0 / best);
+   free((void*) data);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Parses «fn» with PARALLEL on 1, 2, 4, ... threads, reusing the Tree's memory.
+static void parallelTest(const char *fn)
+{
+   const char * const data = readFile(fn);
+   const unsigned long nBytes = strlen(data);
+   char *c = (char*) malloc(nBytes + 1);
+   Tree doc;
+
+   for (unsigned threads = 1; threads <= 16; threads *= 2) {
+      doc.setThreads(threads);
+      unsigned long best = 0;
+      for (int i = 0; i < 5; ++i) {
+         memcpy(c, data, nBytes + 1);
+         doc.reset();
+         unsigned long t = Test::microTime();
+         doc.parse(c, DESTRUCTIVE | PARALLEL);
+         t = Test::microTime() - t;
+         best = (i == 0 || t < best) ? t : best;
+      }
+      printf("%-20s %2u threads: %10ldBytes, %10.6fs, %7.1fMB/s\n",
+             fn, threads, nBytes, best / 1e6, nBytes * 1.0 / best);
+   }
+   free(c);
+   free((void*) data);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Measures the time for a full traversal of the document as Tree and as Tape.
+static void traversalTest(const char *fn)
+{
+   const char * const data = readFile(fn);
+   Tree tree(data);
+   Tape tape;
+   tape.assign(tree.root());
+   for (int i = 0; i < 3; ++i) {
+      unsigned long t = Test::microTime();
+      const double s1 = sumNumbers(tree.root());
+      const unsigned long t1 = Test::microTime() - t;
+      t = Test::microTime();
+      const double s2 = sumNumbers(tape.root());
+      const unsigned long t2 = Test::microTime() - t;
+      ASSERT(s1 == s2);
+      printf("%-20s traverse: tree %8.1fms, tape %8.1fms (%lu entries)\n",
+             fn, t1 / 1e3, t2 / 1e3, (unsigned long) tape.size());
+   }
+   free((void*) data);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Measures the latency of parsing a small document with heap and with inline buffer.
+static void smallDocumentTest()
+{
+   const char *source =
+      "{\"id\":12345,\"user\":\"alice\",\"roles\":[\"admin\",\"dev\"],"
+      "\"active\":true,\"quota\":{\"used\":1.5,\"limit\":10}}";
+   const int n = 1000000;
+   for (int i = 0; i < 3; ++i) {
+      unsigned long t = Test::microTime();
+      for (int k = 0; k < n; ++k) {
+         Tree tree;
+         tree.parse(source);
+      }
+      const unsigned long t1 = Test::microTime() - t;
+      t = Test::microTime();
+      for (int k = 0; k < n; ++k) {
+         char buffer[4096];
+         Tree tree(buffer, sizeof(buffer));
+         tree.parse(source);
+      }
+      const unsigned long t2 = Test::microTime() - t;
+      printf("small document (%u bytes): heap %6.1fns, inline buffer %6.1fns\n",
+             (unsigned) strlen(source), t1 * 1e3 / n, t2 * 1e3 / n);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Measures the time for looking up each member of an object with «width» members once.
+static void lookupTest(size_t width, ParseMode mode, const char *label, bool useKeys = false)
+{
+   std::string source = "{";
+   std::vector<std::string> names;
+   for (size_t i = 0; i < width; ++i) {
+      names.push_back("member_" + toString(i * 7919));
+      source += (i == 0 ? "\"" : ",\"") + names.back() + "\":" + toString(i);
+   }
+   source += "}";
+   const std::vector<Key> keys(names.begin(), names.end());
+   Tree doc;
+   doc.parse(source.data(), source.size(), mode);
+   const size_t rounds = 1 + 4000000 / (width * width);
+   unsigned long sum = 0;
+   unsigned long t = Test::microTime();
+   for (size_t r = 0; r < rounds; ++r) {
+      for (size_t i = 0; i < width; ++i) {
+         sum += (useKeys ? doc[keys[i]] : doc[names[i]]).asInt();
+      }
+   }
+   t = Test::microTime() - t;
+   ASSERT(sum == rounds * width * (width - 1) / 2);
+   printf("lookup width=%-7u %-8s: %10.1fns/lookup\n",
+          (unsigned) width, label, t * 1e3 / (rounds * width));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// The struct that shapeTest() compares with (a local type cannot be a template argument in C++98).
+struct ShapeRecord { long id, name, price, quantity, active, category, weight, stock; };
+
+/// Reads one member of a million records with eight members, with and without SHAPE_OBJECTS,
+/// compared with a field of a struct.
+static void shapeTest()
+{
+   static const char *const NAMES[] = {"id", "name", "price", "quantity", "active", "category",
+                                       "weight", "stock"};
+   const size_t nRecords = 1000000;
+   std::string source = "[";
+   for (size_t i = 0; i < nRecords; ++i) {
+      source += i == 0 ? "{" : ",{";
+      for (size_t k = 0; k < 8; ++k) {
+         source += (k == 0 ? "\"" : ",\"") + std::string(NAMES[k]) + "\":" + toString(i % 100);
+      }
+      source += "}";
+   }
+   source += "]";
+
+   std::vector<ShapeRecord> records(nRecords);
+   for (size_t i = 0; i < nRecords; ++i) {
+      records[i].stock = i % 100;
+   }
+   unsigned long best = 0;
+   long expected = 0;
+   for (int r = 0; r < 5; ++r) {
+      unsigned long t = Test::microTime();
+      long sum = 0;
+      for (size_t i = 0; i < nRecords; ++i) {
+         sum += records[i].stock;
+      }
+      t = Test::microTime() - t;
+      best = (r == 0 || t < best) ? t : best;
+      expected = sum;
+   }
+   printf("shapes %-16s: %7.2fns/record\n", "struct", best * 1e3 / nRecords);
+
+   for (int shaped = 0; shaped < 2; ++shaped) {
+      Tree doc;
+      unsigned long parse = Test::microTime();
+      doc.parse(source.data(), source.size(), shaped ? SHAPE_OBJECTS : NON_DESTRUCTIVE);
+      parse = Test::microTime() - parse;
+      printf("shapes %-16s: parse %10.6fs\n", shaped ? "shaped" : "plain", parse / 1e6);
+      const Key key("stock");
+      Field field("stock");
+      for (int k = 0; k < 2; ++k) {
+         best = 0;
+         for (int r = 0; r < 5; ++r) {
+            unsigned long t = Test::microTime();
+            long sum = 0;
+            for (const Value *x = doc.root().children(); x != 0; x = x->next_) {
+               sum += (k == 0 ? x->get(key) : x->get(field)).asInt();
+            }
+            t = Test::microTime() - t;
+            best = (r == 0 || t < best) ? t : best;
+            ASSERT(sum == expected);
+         }
+         printf("shapes %-16s: %7.2fns/record\n", k == 0 ? "  key" : "  field",
+                best * 1e3 / nRecords);
+      }
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Converts a million records into four columns, by hand and with Columns, with and without
+/// SHAPE_OBJECTS, and sums one column.
+static void columnsTest()
+{
+   const size_t nRecords = 1000000;
+   std::string source = "[";
+   for (size_t i = 0; i < nRecords; ++i) {
+      source += (i == 0 ? "{\"id\":" : ",{\"id\":") + toString(i) + ",\"price\":"
+         + toString(i % 1000) + ".25,\"active\":" + (i % 3 ? "true" : "false")
+         + ",\"name\":\"item\"}";
+   }
+   source += "]";
+   std::vector<int64_t> ids(nRecords);
+   std::vector<double> prices(nRecords);
+   std::vector<bool> active(nRecords);
+   std::vector<const char *> names(nRecords);
+   for (int shaped = 0; shaped < 2; ++shaped) {
+      Tree doc;
+      doc.parse(source.data(), source.size(), shaped ? SHAPE_OBJECTS : NON_DESTRUCTIVE);
+      unsigned long bestHand = 0;
+      for (int r = 0; r < 3; ++r) {
+         unsigned long t = Test::microTime();
+         size_t i = 0;
+         for (const Value *x = doc.root().children(); x != 0; x = x->next_, ++i) {
+            ids[i] = x->get("id").asInt64();
+            prices[i] = x->get("price").asDouble();
+            active[i] = x->get("active").asBool();
+            names[i] = x->get("name").asString();
+         }
+         t = Test::microTime() - t;
+         bestHand = (r == 0 || t < bestHand) ? t : bestHand;
+      }
+      Columns columns;
+      columns.add("id", COLUMN_INT64);
+      columns.add("price", COLUMN_DOUBLE);
+      columns.add("active", COLUMN_BOOL);
+      columns.add("name", COLUMN_STRING);
+      unsigned long best = 0;
+      for (int r = 0; r < 3; ++r) {
+         unsigned long t = Test::microTime();
+         columns.extract(doc.root());
+         t = Test::microTime() - t;
+         best = (r == 0 || t < best) ? t : best;
+      }
+      unsigned long t = Test::microTime();
+      const double *price = columns.doubles(1);
+      double sum = 0;
+      for (size_t i = 0; i < columns.rows(); ++i) {
+         sum += price[i];
+      }
+      t = Test::microTime() - t;
+      ASSERT(columns.rows() == nRecords && columns.int64s(0)[nRecords - 1] == ids.back());
+      printf("columns %-7s: by hand %8.2fns/record, extract %8.2fns/record, sum %6.2fns/row "
+             "(%.0f)\n", shaped ? "shaped" : "plain", bestHand * 1e3 / nRecords,
+             best * 1e3 / nRecords, t * 1e3 / nRecords, sum);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Parses a time series and a list of coordinate pairs with and without PACK_NUMBERS, and reads
+/// them into buffers by walking the elements and with copyTo().
+static void packedNumbersTest()
+{
+   const size_t nValues = 1000000;
+   std::string source = "{\"t\":[";
+   for (size_t i = 0; i < nValues; ++i) {
+      source += (i ? "," : "") + toString(1700000000 + 60 * i);
+   }
+   source += "],\"v\":[";
+   char buffer[40];
+   for (size_t i = 0; i < nValues; ++i) {
+      snprintf(buffer, sizeof(buffer), "%s%.6f", i ? "," : "", (double) (i % 100003) / 7.0);
+      source += buffer;
+   }
+   source += "],\"xy\":[";
+   for (size_t i = 0; i < nValues / 2; ++i) {
+      snprintf(buffer, sizeof(buffer), "%s[%.7f,%.7f]", i ? "," : "", (i % 3600) / 10.0 - 180,
+               (i % 1800) / 10.0 - 90);
+      source += buffer;
+   }
+   source += "]}";
+   std::vector<int64_t> times(nValues);
+   std::vector<double> values(nValues);
+   std::vector<double> xy(nValues);
+   for (int packed = 0; packed < 2; ++packed) {
+      const ParseMode mode = packed ? ZERO_COPY | PACK_NUMBERS : ZERO_COPY;
+      unsigned long bestParse = 0;
+      for (int r = 0; r < 3; ++r) {
+         Tree doc;
+         unsigned long t = Test::microTime();
+         doc.parse(source.c_str(), mode);
+         t = Test::microTime() - t;
+         bestParse = (r == 0 || t < bestParse) ? t : bestParse;
+      }
+      Tree doc;
+      doc.parse(source.c_str(), mode);
+      const size_t capacity = doc.capacity();
+      unsigned long bestWalk = 0;
+      unsigned long bestCopy = 0;
+      for (int r = 0; r < 3; ++r) {
+         unsigned long t = Test::microTime();
+         doc["t"].copyTo(&times[0], nValues);
+         doc["v"].copyTo(&values[0], nValues);
+         size_t i = 0;
+         for (const Value *p = doc["xy"].children(); p != 0; p = p->next_) {
+            i += p->copyTo(&xy[i], 2);
+         }
+         t = Test::microTime() - t;
+         bestCopy = (r == 0 || t < bestCopy) ? t : bestCopy;
+      }
+      for (int r = 0; r < 3; ++r) {
+         // Walking creates the element Values of packed arrays, so each round gets a new Tree.
+         Tree walked;
+         walked.parse(source.c_str(), mode);
+         unsigned long t = Test::microTime();
+         size_t i = 0;
+         for (const Value *x = walked["t"].children(); x != 0; x = x->next_) {
+            times[i++] = x->asInt64();
+         }
+         i = 0;
+         for (const Value *x = walked["v"].children(); x != 0; x = x->next_) {
+            values[i++] = x->asDouble();
+         }
+         i = 0;
+         for (const Value *p = walked["xy"].children(); p != 0; p = p->next_) {
+            for (const Value *x = p->children(); x != 0; x = x->next_) {
+               xy[i++] = x->asDouble();
+            }
+         }
+         t = Test::microTime() - t;
+         bestWalk = (r == 0 || t < bestWalk) ? t : bestWalk;
+      }
+      ASSERT(times[nValues - 1] == doc["t"][nValues - 1].asInt64());
+      printf("numbers %-6s: parse %7.2fms (%6.1fMB), walk %7.2fms, copyTo %7.2fms\n",
+             packed ? "packed" : "plain", bestParse / 1e3, capacity / 1e6, bestWalk / 1e3,
+             bestCopy / 1e3);
+   }
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -920,7 +3245,29 @@ int main(int argc, char **argv)
    printf("sizeof(Value)=%u\n",(unsigned)sizeof(Value));
    if (argc > 1) {
       for (int i = 1; i < argc; ++i) {
-         performanceTest(argv[i]);
+         performanceTest(argv[i], DESTRUCTIVE, "scalar");
+         performanceTest(argv[i], DESTRUCTIVE | STRUCTURAL_INDEX, "indexed");
+         traversalTest(argv[i]);
+         parallelTest(argv[i]);
+         pushTest(argv[i]);
+         eventsTest(argv[i]);
+         readerTest(argv[i]);
+         onDemandTest(argv[i]);
+         projectionTest(argv[i]);
+         fileTest(argv[i]);
+         internTest(argv[i]);
+      }
+      smallDocumentTest();
+      streamTest();
+      linesTest();
+      shapeTest();
+      columnsTest();
+      packedNumbersTest();
+      for (size_t width = 4; width <= 4096; width *= 4) {
+         lookupTest(width, NON_DESTRUCTIVE, "linear");
+         lookupTest(width, INDEX_OBJECTS, "hashed");
+         lookupTest(width, NON_DESTRUCTIVE, "key", true);
+         lookupTest(width, INDEX_OBJECTS, "key+hash", true);
       }
       return 0;
    }